@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "Constants.h"
+#include "MeshSampler.h"
+
+// Below this many triangles per thread, spinning up threads costs more than it saves
+const size_t MIN_TRIANGLES_PER_WORKER = 16 * 1024;
+
+void MeshSampler::Build(const Model* model, const glm::mat4& transform, std::vector<meshTriangle>& triangles,
+                        std::vector<aliasEntry>& aliasTable) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    size_t numTriangles = model->NumVerts() / 3;
+    size_t firstTriangle = triangles.size();
+    triangles.resize(firstTriangle + numTriangles);
+    aliasTable.resize(firstTriangle + numTriangles);
+
+    // Transform the triangles and measure their areas straight out of model_, split across threads
+    std::vector<float> areas(numTriangles);
+    int numWorkers = NumWorkers(numTriangles);
+    std::vector<double> partialAreas(numWorkers, 0.0);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < numWorkers; w++) {
+        workers.emplace_back([&, w]() {
+            size_t begin = numTriangles * w / numWorkers;
+            size_t end = numTriangles * (w + 1) / numWorkers;
+            double areaSum = 0;
+            for (size_t t = begin; t < end; t++) {
+                glm::vec3 corners[3];
+                for (int v = 0; v < 3; v++) {
+                    const float* vert = model->model_ + (t * 3 + v) * ATTRIBUTE_STRIDE + POSITION_OFFSET;
+                    corners[v] = glm::vec3(transform * glm::vec4(vert[0], vert[1], vert[2], 1.0));
+                }
+
+                float area = 0.5f * glm::length(glm::cross(corners[1] - corners[0], corners[2] - corners[0]));
+                areas[t] = area;
+                areaSum += area;
+
+                triangles[firstTriangle + t] = meshTriangle{{corners[0].x, corners[0].y, corners[0].z, area},
+                                                            {corners[1].x, corners[1].y, corners[1].z, 1.f},
+                                                            {corners[2].x, corners[2].y, corners[2].z, 1.f}};
+            }
+            partialAreas[w] = areaSum;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    double totalArea = 0;
+    for (double partial : partialAreas) {
+        totalArea += partial;
+    }
+
+    if (totalArea <= 0) {
+        printf("Mesh has no surface area to sample\n");
+        triangles.resize(firstTriangle);
+        aliasTable.resize(firstTriangle);
+        return;
+    }
+
+    BuildAliasTable(areas, float(totalArea), GLuint(firstTriangle), aliasTable.data() + firstTriangle);
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    printf("Built alias table for %zu triangles on %d threads in %.3fms\n", numTriangles, numWorkers, elapsed);
+}
+
+// Vose's method. Every bucket is scaled so the average is 1, then each under-full bucket is topped up by exactly one over-full one
+void MeshSampler::BuildAliasTable(const std::vector<float>& areas, float totalArea, GLuint firstIndex, aliasEntry* table) {
+    size_t n = areas.size();
+    if (n == 0 || totalArea <= 0) return;
+
+    std::vector<float> scaled(n);
+    std::vector<GLuint> small, large;
+    small.reserve(n);
+    large.reserve(n);
+
+    float scale = n / totalArea;
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = areas[i] * scale;
+        if (scaled[i] < 1) {
+            small.push_back(i);
+        } else {
+            large.push_back(i);
+        }
+    }
+
+    while (!small.empty() && !large.empty()) {
+        GLuint less = small.back();
+        small.pop_back();
+        GLuint more = large.back();
+
+        table[less] = aliasEntry{scaled[less], firstIndex + more};
+
+        scaled[more] = (scaled[more] + scaled[less]) - 1;
+        if (scaled[more] < 1) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+
+    // Whatever's left is full up to float rounding
+    for (GLuint i : large) {
+        table[i] = aliasEntry{1.f, firstIndex + i};
+    }
+    for (GLuint i : small) {
+        table[i] = aliasEntry{1.f, firstIndex + i};
+    }
+}
+
+int MeshSampler::NumWorkers(size_t numItems) {
+    int hardwareThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    int wanted = int(numItems / MIN_TRIANGLES_PER_WORKER) + 1;
+    return std::min(hardwareThreads, wanted);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+#include "Model.h"
+#include "ParticleManager.h"
+
+// Walker/Vose alias table over a mesh's triangle areas, so the emit kernel can pick an area-weighted triangle in O(1)
+class MeshSampler {
+   public:
+    // Appends the model's transformed triangles and their alias table entries. Alias indices are absolute indices into triangles
+    static void Build(const Model* model, const glm::mat4& transform, std::vector<meshTriangle>& triangles,
+                      std::vector<aliasEntry>& aliasTable);
+
+   private:
+    static void BuildAliasTable(const std::vector<float>& areas, float totalArea, GLuint firstIndex, aliasEntry* table);
+    static int NumWorkers(size_t numItems);
+};
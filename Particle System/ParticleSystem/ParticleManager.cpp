@@ -1,8 +1,11 @@
 #define GLM_FORCE_RADIANS
 
 #include <SDL_stdinc.h>
+#include <algorithm>
+#include <cstddef>
 #include <ctime>
 #include "Constants.h"
+#include "MeshSampler.h"
 #include "ParticleManager.h"
 #include "ShaderManager.h"
 #include "Utils.h"
@@ -12,6 +15,7 @@ const float radius = 0.5;
 const float bounceFactor = -0.8;
 const int numAtomicCounters = 1;
 const GLint bufMask = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+const splashHeader emptySplashHeader = {0, 1, 1, 0, ParticleManager::SPLASH_CAPACITY, {0, 0, 0}};
 
 GLuint ParticleManager::posSSbo;
 GLuint ParticleManager::velSSbo;
@@ -20,6 +24,17 @@ GLuint ParticleManager::colModSSbo;
 GLuint ParticleManager::lifeSSbo;
 GLuint ParticleManager::paramSSbo;
 GLuint ParticleManager::atomicsSSbo;
+GLuint ParticleManager::fireballSSbo;
+GLuint ParticleManager::emitterSSbo;
+GLuint ParticleManager::deadListSSbo;
+GLuint ParticleManager::meshTriangleSSbo;
+GLuint ParticleManager::aliasTableSSbo;
+GLuint ParticleManager::eventSSbos[EVENT_BUFFER_FRAMES];
+GLuint ParticleManager::splashSSbo;
+GLuint ParticleManager::sortKeySSbos[2];
+GLuint ParticleManager::sortValueSSbos[2];
+GLuint ParticleManager::sortHistogramSSbo;
+GLuint ParticleManager::sortScratchSSbo;
 
 int ParticleManager::numAlive;
 ParticleMode ParticleManager::PARTICLE_MODE;
@@ -41,17 +56,47 @@ ParticleManager::ParticleManager() {
         0.f,            // Player pos
         1.0f,           // sim speed
         0.0f,           // grav factor
-        0.1f,           // spawn rate - particles per second
+        0,              // spawn count - filled in from the emitters each step
         1.f,            // Time
         PARTICLE_MODE,  // Which particle sim to do
-        0,              // Fireball state
+        PARTICLES_PER_FIREBALL,
+        0,  // Number of emitters
     };
     if (PARTICLE_MODE == Free_Mode) {
         particleParameters.minZ = -5000.f;
     }
 
+    for (int i = 0; i < MAX_FIREBALLS; i++) {
+        fireballs[i] = fireball{0.f, 0.f, 0.f, 0};  // Waiting to spawn
+        fireballVelocities[i] = glm::vec3(0, 0, 0);
+        computesSinceFireballEvent[i] = 0;
+    }
+
+    for (int i = 0; i < NUM_EVENT_TYPES; i++) {
+        eventCounts[i] = 0;
+    }
+    for (int i = 0; i < EVENT_BUFFER_FRAMES; i++) {
+        eventFences[i] = nullptr;
+    }
+
+    SetKernelFusion(Fully_Fused);
+
     numAlive = 0;
     InitGL();
+
+    if (PARTICLE_MODE == Water_Mode) {
+        // The waterfall pours out of the end of the tube
+        emitterParams waterfall = {};
+        waterfall.shape = Disk_Emitter;
+        waterfall.centerX = waterfall.centerY = 20.f;
+        waterfall.centerZ = 50.f;
+        waterfall.axisX = waterfall.axisZ = 0.7071f;
+        waterfall.radius = 10.f;
+        waterfall.thickness = 3.25f;
+        waterfall.speed = 24.5f;
+        waterfall.velocitySpread = 4.f;
+        AddEmitter(waterfall, 250000.f);
+    }
 }
 
 void ParticleManager::InitGL() {
@@ -135,6 +180,70 @@ void ParticleManager::InitGL() {
 
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
+    // Prepare the fireball states buffer
+    glGenBuffers(1, &fireballSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, fireballSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_FIREBALLS * sizeof(fireball), fireballs, GL_DYNAMIC_DRAW);
+
+    // Prepare the emitters buffer
+    glGenBuffers(1, &emitterSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_EMITTERS * sizeof(emitterParams), nullptr, GL_DYNAMIC_DRAW);
+
+    // Prepare the dead list. The top numDead entries are the indices of dead particles the emitters can hand out
+    glGenBuffers(1, &deadListSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, deadListSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+
+    printf("Initializing particle dead list...\n");
+    GLuint *deadList = (GLuint *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_PARTICLES * sizeof(GLuint), bufMask);
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        deadList[i] = i;  // Everything starts out dead
+    }
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+    // Mesh surface emitter triangles and alias tables are uploaded as emitters are added
+    glGenBuffers(1, &meshTriangleSSbo);
+    glGenBuffers(1, &aliasTableSSbo);
+
+    // Prepare the event buffers, one per frame in flight
+    particleEventHeader emptyHeader = {0, EVENT_CAPACITY, NUM_PARTICLES, 0, {0, 0, 0, 0}};
+    glGenBuffers(EVENT_BUFFER_FRAMES, eventSSbos);
+    for (int i = 0; i < EVENT_BUFFER_FRAMES; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, eventSSbos[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(particleEventHeader) + EVENT_CAPACITY * sizeof(particleEvent), nullptr,
+                     GL_DYNAMIC_READ);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particleEventHeader), &emptyHeader);
+    }
+
+    // Prepare the splash request buffer. Impacts append to it during the update and it's emptied after the splash stage
+    glGenBuffers(1, &splashSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, splashSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(splashHeader) + SPLASH_CAPACITY * sizeof(splashRequest), nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(splashHeader), &emptySplashHeader);
+
+    // Prepare the Morton sort's buffers. Keys and values ping-pong between the two halves of each pair, one pass per 4 bit digit
+    glGenBuffers(2, sortKeySSbos);
+    glGenBuffers(2, sortValueSSbos);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortKeySSbos[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortValueSSbos[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    }
+    glGenBuffers(1, &sortHistogramSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortHistogramSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, SORT_RADIX * SORT_NUM_GROUPS * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    // Big enough for any one attribute array, which get reordered one at a time
+    glGenBuffers(1, &sortScratchSSbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortScratchSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(position), nullptr, GL_DYNAMIC_COPY);
+
+    for (int i = 0; i < EVENT_BUFFER_FRAMES; i++) {
+        glGenQueries(MAX_TIMED_KERNELS + 1, timestampQueries[i]);
+    }
+
     printf("Done initializing particle buffers\n");
 }
 
@@ -143,64 +252,435 @@ int ParticleManager::GetNumParticles() {
 }
 
 void ParticleManager::UpdateComputeParameters(float dt) {
-    UpdateFireball(dt);
+    for (int i = 0; i < MAX_FIREBALLS; i++) {
+        UpdateFireball(i, dt);
+    }
+
+    UpdateEmitters();
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, paramSSbo);
     particleParams *params = (particleParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particleParams), bufMask);
     *params = particleParameters;
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, atomicsSSbo);
-    atomics *currentAtomics = (atomics *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(atomics), GL_MAP_READ_BIT);
-    numAlive = NUM_PARTICLES - currentAtomics->numDead;
+    // All fireball states go up together so a single dispatch can advance every fireball
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, fireballSSbo);
+    fireball *states = (fireball *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, MAX_FIREBALLS * sizeof(fireball), bufMask);
+    memcpy(states, fireballs, MAX_FIREBALLS * sizeof(fireball));
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+}
+
+void ParticleManager::ExecuteComputeShader() {
+    // Read back whatever this frame's event buffer recorded EVENT_BUFFER_FRAMES frames ago, then hand it to this frame
+    int eventBuffer = eventFrame % EVENT_BUFFER_FRAMES;
+    ConsumeEvents(eventBuffer);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, posSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, colSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, paramSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, lifeSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, atomicsSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, colModSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, fireballSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, emitterSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, deadListSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, meshTriangleSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, aliasTableSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, eventSSbos[eventBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, splashSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, sortScratchSSbo);  // Free outside of the sort, so split kernels pass acceleration in it
+
+    glUseProgram(ShaderManager::ParticleComputeShader);
+    if (kernelTimingEnabled) BeginKernelTimers(eventBuffer);
+
+    if (particleParameters.spawnCount > 0) {
+        // One thread per particle being spawned, so emission costs O(spawned) rather than O(capacity)
+        glUniform1i(ShaderManager::ParticleComputeStage, 0);
+        glDispatchCompute((particleParameters.spawnCount + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        if (kernelTimingEnabled) TimeKernel(eventBuffer, "emit");
+    }
+
+    glUniform1i(ShaderManager::ParticleComputeStage, 1);
+    for (size_t k = 0; k < updateKernels.size(); k++) {
+        if (k > 0) glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(ShaderManager::ParticleUpdatePasses, updateKernels[k]);
+        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);  // Compute shader!!
+
+        if (kernelTimingEnabled) {
+            const char* passNames[] = {"spawn", "attract", "integrate", "color", "collide", "despawn"};
+            std::string name;
+            for (int pass = 0; pass < 6; pass++) {
+                if (updateKernels[k] & (1 << pass)) name += (name.empty() ? "" : "+") + std::string(passNames[pass]);
+            }
+            TimeKernel(eventBuffer, name);
+        }
+    }
+
+    if (PARTICLE_MODE == Water_Mode) {
+        // The update sized this dispatch as impacts queued their splashes, so the CPU never has to read the count back
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glUniform1i(ShaderManager::ParticleComputeStage, 2);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, splashSSbo);
+        glDispatchComputeIndirect(0);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+        if (kernelTimingEnabled) TimeKernel(eventBuffer, "splash");
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    int numSSbos = 15;
+    for (int i = 0; i < numSSbos; i++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i + 1, 0);
+    }
+
+    if (PARTICLE_MODE == Water_Mode) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, splashSSbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(splashHeader), &emptySplashHeader);
+    }
+
+    if (mortonSortEnabled && eventFrame % SORT_INTERVAL == SORT_INTERVAL - 1) {
+        SortParticles();
+        if (kernelTimingEnabled) TimeKernel(eventBuffer, "sort");
+    }
+
+    // Snapshot the dead count alongside the events so it can be read back without stalling too
+    glBindBuffer(GL_COPY_READ_BUFFER, atomicsSSbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, eventSSbos[eventBuffer]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offsetof(particleEventHeader, numDead), sizeof(GLint));
+
+    eventFences[eventBuffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    eventFrame++;
+}
+
+// Reorders every particle attribute by the Morton code of the particle's position. Fireballs keep their slices of the pool, and in
+// water mode the dead particles end up at the back so the dead list can be rebuilt in order. Event records read back later still
+// use the indices from before the sort
+void ParticleManager::SortParticles() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, posSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, colSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, paramSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, lifeSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, atomicsSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, colModSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, deadListSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, sortHistogramSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, sortScratchSSbo);
+
+    glUseProgram(ShaderManager::ParticleSortShader);
+    glUniform1i(ShaderManager::ParticleSortNumGroups, SORT_NUM_GROUPS);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, sortKeySSbos[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, sortValueSSbos[0]);
+    glUniform1i(ShaderManager::ParticleSortStage, 0);
+    glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // LSD radix sort, 4 bits at a time: count each group's digits, scan the counts into offsets, then scatter
+    int in = 0;
+    for (int shift = 0; shift < SORT_KEY_BITS; shift += 4) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, sortKeySSbos[in]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, sortValueSSbos[in]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, sortKeySSbos[1 - in]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, sortValueSSbos[1 - in]);
+        glUniform1i(ShaderManager::ParticleSortDigitShift, shift);
+
+        glUniform1i(ShaderManager::ParticleSortStage, 1);
+        glDispatchCompute(SORT_NUM_GROUPS, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUniform1i(ShaderManager::ParticleSortStage, 2);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUniform1i(ShaderManager::ParticleSortStage, 3);
+        glDispatchCompute(SORT_NUM_GROUPS, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        in = 1 - in;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, sortKeySSbos[in]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, sortValueSSbos[in]);
+
+    // Pull each attribute through the sorted order into the scratch buffer, then copy it back over the original
+    GLuint attributes[] = {posSSbo, velSSbo, colSSbo, colModSSbo, lifeSSbo};
+    GLsizeiptr attributeSizes[] = {sizeof(position), sizeof(velocity), sizeof(color), sizeof(color), sizeof(GLfloat)};
+    glUniform1i(ShaderManager::ParticleSortStage, 4);
+    for (int a = 0; a < 5; a++) {
+        glUniform1i(ShaderManager::ParticleSortGatherAttribute, a);
+        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, sortScratchSSbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, attributes[a]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, NUM_PARTICLES * attributeSizes[a]);
+    }
+
+    if (PARTICLE_MODE == Water_Mode) {
+        glUniform1i(ShaderManager::ParticleSortStage, 5);
+        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUniform1i(ShaderManager::ParticleSortStage, 6);
+        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    for (int i = 1; i <= 20; i++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+    }
+}
+
+void ParticleManager::SetKernelFusion(KernelFusion fusion) {
+    kernelFusion = fusion;
+    if (fusion == Fully_Fused) {
+        SetUpdateKernels({All_Passes});
+    } else if (fusion == Partly_Fused) {
+        SetUpdateKernels({Spawn_Pass | Attract_Pass | Integrate_Pass, Color_Pass | Collide_Pass | Despawn_Pass});
+    } else {
+        SetUpdateKernels({Spawn_Pass, Attract_Pass, Integrate_Pass, Color_Pass, Collide_Pass, Despawn_Pass});
+    }
+}
+
+// Every pass must be run exactly once, and in order, so each kernel's passes must all come after the previous kernel's
+bool ParticleManager::SetUpdateKernels(const std::vector<int>& passMasks) {
+    int covered = 0;
+    for (int mask : passMasks) {
+        if (mask <= 0 || (mask & ~All_Passes) != 0 || (covered != 0 && (mask & -mask) <= covered)) {
+            printf("Invalid update kernel pass mask %i\n", mask);
+            return false;
+        }
+        covered |= mask;
+    }
+    if (covered != All_Passes) {
+        printf("Update kernels only cover passes %i of %i\n", covered, All_Passes);
+        return false;
+    }
+
+    updateKernels = passMasks;
+    kernelTimeTotals.clear();
+    kernelTimeSamples = 0;
+    return true;
+}
+
+void ParticleManager::BeginKernelTimers(int slot) {
+    // Collect this slot's timestamps from EVENT_BUFFER_FRAMES frames ago. If the GPU hasn't got to them, drop them rather than wait
+    std::vector<std::string>& kernels = timedKernels[slot];
+    if (!kernels.empty()) {
+        GLint available = 0;
+        glGetQueryObjectiv(timestampQueries[slot][kernels.size()], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 last;
+            glGetQueryObjectui64v(timestampQueries[slot][0], GL_QUERY_RESULT, &last);
+            for (size_t k = 0; k < kernels.size(); k++) {
+                GLuint64 end;
+                glGetQueryObjectui64v(timestampQueries[slot][k + 1], GL_QUERY_RESULT, &end);
+                double ms = (end - last) / 1000000.0;
+                last = end;
+
+                auto total = std::find_if(kernelTimeTotals.begin(), kernelTimeTotals.end(),
+                                          [&](const std::pair<std::string, double>& t) { return t.first == kernels[k]; });
+                if (total == kernelTimeTotals.end()) {
+                    kernelTimeTotals.push_back({kernels[k], ms});
+                } else {
+                    total->second += ms;
+                }
+            }
+            kernelTimeSamples++;
+        }
+        kernels.clear();
+    }
+
+    glQueryCounter(timestampQueries[slot][0], GL_TIMESTAMP);
+}
+
+void ParticleManager::TimeKernel(int slot, const std::string& name) {
+    std::vector<std::string>& kernels = timedKernels[slot];
+    if (kernels.size() >= MAX_TIMED_KERNELS) return;
+
+    glQueryCounter(timestampQueries[slot][kernels.size() + 1], GL_TIMESTAMP);
+    kernels.push_back(name);
+}
+
+void ParticleManager::PrintKernelTimes() {
+    if (kernelTimeSamples == 0) return;
+
+    // Kernels that don't run every frame (emit, sort) are averaged over every frame, so the column adds up to the frame's total
+    double frameTotal = 0;
+    printf("Kernel times over %i frames at %i particles:\n", kernelTimeSamples, NUM_PARTICLES);
+    for (const auto& total : kernelTimeTotals) {
+        double average = total.second / kernelTimeSamples;
+        frameTotal += average;
+        printf("  %-40s %8.3f ms\n", total.first.c_str(), average);
+    }
+    printf("  %-40s %8.3f ms\n", "total", frameTotal);
+
+    kernelTimeTotals.clear();
+    kernelTimeSamples = 0;
+}
+
+void ParticleManager::AddEventListener(const ParticleEventListener &listener) {
+    eventListeners.push_back(listener);
+}
+
+void ParticleManager::ConsumeEvents(int bufferIndex) {
+    GLsync fence = eventFences[bufferIndex];
+    if (fence == nullptr) return;  // Nothing has been written to this buffer yet
+
+    // This is normally long done. If the GPU is more than EVENT_BUFFER_FRAMES behind, we'd be waiting on it regardless
+    GLenum waitResult = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (waitResult == GL_TIMEOUT_EXPIRED) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    }
+    glDeleteSync(fence);
+    eventFences[bufferIndex] = nullptr;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, eventSSbos[bufferIndex]);
+    particleEventHeader header;
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particleEventHeader), &header);
+
+    numAlive = NUM_PARTICLES - header.numDead;
+    for (int i = 0; i < NUM_EVENT_TYPES; i++) {
+        eventCounts[i] = header.typeCounts[i];
+    }
+
+    GLuint numRecorded = std::min(header.numEvents, header.capacity);
+    if (!eventListeners.empty() && numRecorded > 0) {
+        particleEvent *events = (particleEvent *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, sizeof(particleEventHeader),
+                                                                  numRecorded * sizeof(particleEvent), GL_MAP_READ_BIT);
+        for (GLuint i = 0; i < numRecorded; i++) {
+            ParticleEventType type = ParticleEventType(events[i].typeAndParticle >> 30);
+            GLuint particle = events[i].typeAndParticle & 0x3FFFFFFF;
+            glm::vec3 position = glm::vec3(events[i].x, events[i].y, events[i].z);
+            for (auto &listener : eventListeners) {
+                listener(type, particle, position);
+            }
+        }
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+
+    // Reset the counters for reuse, leaving the capacity alone
+    particleEventHeader emptyHeader = {0, EVENT_CAPACITY, header.numDead, 0, {0, 0, 0, 0}};
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particleEventHeader), &emptyHeader);
+}
+
+int ParticleManager::AddEmitter(const emitterParams &params, float rate) {
+    if (emitters.size() >= MAX_EMITTERS) {
+        printf("Can't add more than %d emitters. Ignoring emitter\n", MAX_EMITTERS);
+        return -1;
+    }
+
+    emitters.push_back(emitter{params, rate, 0.f});
+    particleParameters.numEmitters = emitters.size();
+    return emitters.size() - 1;
+}
+
+int ParticleManager::AddMeshEmitter(const Model *model, const glm::mat4 &transform, emitterParams params, float rate) {
+    params.shape = Mesh_Surface_Emitter;
+    params.firstTriangle = meshTriangles.size();
+    MeshSampler::Build(model, transform, meshTriangles, aliasTable);
+    params.triangleCount = meshTriangles.size() - params.firstTriangle;
+
+    if (params.triangleCount == 0) {
+        printf("Mesh emitter has no surface area. Ignoring emitter\n");
+        return -1;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshTriangleSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshTriangles.size() * sizeof(meshTriangle), meshTriangles.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, aliasTableSSbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, aliasTable.size() * sizeof(aliasEntry), aliasTable.data(), GL_STATIC_DRAW);
+
+    return AddEmitter(params, rate);
+}
+
+void ParticleManager::UpdateEmitters() {
+    // Work out exactly how many particles each emitter spawns this step, and where its spawns start in the emit dispatch
+    float step = TIMESTEP * particleParameters.simulationSpeed;
+    GLuint totalSpawn = 0;
+    for (auto &e : emitters) {
+        GLuint count = 0;
+        if (step > 0) {
+            float wanted = e.rate * step + e.carry;
+            count = GLuint(wanted);
+            e.carry = wanted - count;
+        }
+
+        e.params.firstSpawn = totalSpawn;
+        e.params.spawnCount = count;
+        totalSpawn += count;
+    }
+
+    particleParameters.spawnCount = std::min(totalSpawn, GLuint(NUM_PARTICLES));
+
+    if (emitters.empty()) return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterSSbo);
+    emitterParams *params = (emitterParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, emitters.size() * sizeof(emitterParams),
+                                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    for (size_t i = 0; i < emitters.size(); i++) {
+        params[i] = emitters[i].params;
+    }
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 }
 
 void ParticleManager::SpawnFireball(const glm::vec3 &position, const glm::vec3 &velocity) {
-    if (particleParameters.fireballState == 0) {  // Fireball is waiting to spawn
-        fireballPositions[0] = position;
-        fireballVelocities[0] = velocity;
-        fireballAlive[0] = true;
-        particleParameters.fireballState = 1;  // Move to the spawning stage
-        computesSinceFireballEvent = 0;
+    // Take the next waiting fireball, starting after the most recently launched one so that a slot's particles get as long as
+    // possible to finish cooling before they're reclaimed
+    for (int n = 0; n < MAX_FIREBALLS; n++) {
+        int i = (nextFireball + n) % MAX_FIREBALLS;
+        if (fireballs[i].state == 0) {  // Fireball is waiting to spawn
+            fireballs[i].x = position.x;
+            fireballs[i].y = position.y;
+            fireballs[i].z = position.z;
+            fireballVelocities[i] = velocity;
+            fireballs[i].state = 1;  // Move to the spawning stage
+            computesSinceFireballEvent[i] = 0;
+            nextFireball = (i + 1) % MAX_FIREBALLS;
+            return;
+        }
     }
 }
 
-void ParticleManager::UpdateFireball(float dt) {
-    if (particleParameters.fireballState == 1) {  // Spawning
-        if (computesSinceFireballEvent > 0) {
+void ParticleManager::UpdateFireball(int index, float dt) {
+    fireball &fb = fireballs[index];
+
+    if (fb.state == 1) {  // Spawning
+        if (computesSinceFireballEvent[index] > 0) {
             // Now that all particles have spawned to the fireball, transition to the fireball movement stage
-            particleParameters.fireballState = 2;
-            computesSinceFireballEvent = 0;
+            fb.state = 2;
+            computesSinceFireballEvent[index] = 0;
         }
     }
 
-    if (particleParameters.fireballState == 2) {  // Moving
+    if (fb.state == 2) {  // Moving
         dt *= particleParameters.simulationSpeed;
         glm::vec3 dta = dt * glm::vec3(0, 0, -9.8);
-        fireballPositions[0] = fireballPositions[0] + fireballVelocities[0] * dt + 0.5f * dt * dta;
-        fireballVelocities[0] = fireballVelocities[0] + dta;
+        glm::vec3 position = glm::vec3(fb.x, fb.y, fb.z);
+        position = position + fireballVelocities[index] * dt + 0.5f * dt * dta;
+        fireballVelocities[index] = fireballVelocities[index] + dta;
 
-        if (fireballPositions[0].z < 0) {
+        if (position.z < 0) {
             // The fireball hit the ground, so transition to the exploding stage
-            fireballPositions[0].z = 0;
-            particleParameters.fireballState = 3;
-            computesSinceFireballEvent = 0;
+            position.z = 0;
+            fb.state = 3;
+            computesSinceFireballEvent[index] = 0;
         }
 
-        particleParameters.centerX = fireballPositions[0].x;
-        particleParameters.centerY = fireballPositions[0].y;
-        particleParameters.centerZ = fireballPositions[0].z;
+        fb.x = position.x;
+        fb.y = position.y;
+        fb.z = position.z;
     }
 
-    if (particleParameters.fireballState == 3 && computesSinceFireballEvent > 0) {  // Exploding and ready to reset
+    if (fb.state == 3 && computesSinceFireballEvent[index] > 0) {  // Exploding and ready to reset
         // Go back to the waiting stage
-        particleParameters.fireballState = 0;
+        fb.state = 0;
     }
 
-    if (particleParameters.fireballState == 1 || particleParameters.fireballState == 3) {
+    if (fb.state == 1 || fb.state == 3) {
         // Spawning or exploding and waiting for compute to transition
-        computesSinceFireballEvent++;
+        computesSinceFireballEvent[index]++;
     }
 }
 
@@ -1,4 +1,8 @@
 #pragma once
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
 #include "Model.h"
 #include "glad.h"
 
@@ -9,10 +13,17 @@ struct particleParams {
     GLfloat playerX, playerY, playerZ;
     GLfloat simulationSpeed;
     GLfloat gravityAccelerationFactor;
-    GLfloat spawnRate;
+    GLint spawnCount;  // Total particles the emitters spawn this step
     GLfloat time;
     GLint particleMode;
-    GLint fireballState;  // 0 = waiting to spawn, 1 = spawning, 2 = spawned and moving, 3 = exploding
+    GLint particlesPerFireball;
+    GLint numEmitters;
+};
+
+// Mirrors the Fireball struct in the compute shader (std430, 16 bytes)
+struct fireball {
+    GLfloat x, y, z;
+    GLint state;  // 0 = waiting to spawn, 1 = spawning, 2 = spawned and moving, 3 = exploding
 };
 
 struct position {
@@ -33,6 +44,91 @@ struct atomics {
 
 enum ParticleMode { Free_Mode = 0, Fireball_Mode = 1, Water_Mode = 2 };
 
+// The update passes, in the order they run. Must match the *PassBit constants in computeShader.glsl
+enum UpdatePass {
+    Spawn_Pass = 1,
+    Attract_Pass = 2,
+    Integrate_Pass = 4,
+    Color_Pass = 8,
+    Collide_Pass = 16,
+    Despawn_Pass = 32,
+    All_Passes = 63
+};
+
+// Presets for how the update passes are grouped into dispatches
+enum KernelFusion { Fully_Fused = 0, Partly_Fused = 1, Fully_Split = 2, NUM_KERNEL_FUSIONS = 3 };
+
+enum EmitterShape { Disk_Emitter = 0, Sphere_Emitter = 1, Box_Emitter = 2, Mesh_Surface_Emitter = 3 };
+
+// Mirrors the Emitter struct in the compute shader (std430, 80 bytes)
+struct emitterParams {
+    GLfloat centerX, centerY, centerZ;
+    GLint shape;
+    GLfloat axisX, axisY, axisZ;  // Disk normal, and the direction of the mean launch velocity
+    GLfloat radius;               // Disk/sphere radius
+    GLfloat halfExtentX, halfExtentY, halfExtentZ;  // Box size
+    GLfloat speed;                                  // Mean launch speed along the axis
+    GLfloat radialSpeed;     // Launch speed away from the center (sphere/box) or along the surface normal (mesh)
+    GLfloat velocitySpread;  // Width of the uniform noise added to each launch velocity component
+    GLfloat thickness;       // Disk only - how far back along the normal particles may spawn
+    GLuint firstSpawn;       // Exclusive prefix sum of the spawn counts, filled in each step
+    GLuint spawnCount;       // Filled in each step
+    GLuint firstTriangle;    // Mesh surface only
+    GLuint triangleCount;    // Mesh surface only
+    GLuint padding;
+};
+
+struct emitter {
+    emitterParams params;
+    float rate;   // Particles per second of simulation time
+    float carry;  // Fractional particle left over from previous steps, so low rates still come out exact
+};
+
+enum ParticleEventType { Death_Event = 0, Bounce_Event = 1, Spawn_Event = 2, NUM_EVENT_TYPES = 3 };
+
+// Mirrors the ParticleEvent struct in the compute shader
+struct particleEvent {
+    GLuint typeAndParticle;  // Event type in the top 2 bits, particle index in the rest
+    GLfloat x, y, z;
+};
+
+// Mirrors the header of the Evnts buffer in the compute shader. The events themselves follow it
+struct particleEventHeader {
+    GLuint numEvents;  // Can be more than capacity, in which case only the first capacity events were recorded
+    GLuint capacity;
+    GLint numDead;
+    GLuint padding;
+    GLuint typeCounts[4];
+};
+
+// Mirrors the header of the Splshs buffer in the compute shader. The first three fields double as the splash stage's
+// glDispatchComputeIndirect arguments
+struct splashHeader {
+    GLuint numGroupsX, numGroupsY, numGroupsZ;
+    GLuint numRequests;
+    GLuint capacity;
+    GLuint padding[3];
+};
+
+// Mirrors the SplashRequest struct in the compute shader
+struct splashRequest {
+    position impactPosition;
+    velocity impactVelocity;
+};
+
+typedef std::function<void(ParticleEventType type, GLuint particle, const glm::vec3& position)> ParticleEventListener;
+
+// One triangle of a mesh surface emitter. a.w holds the triangle's area
+struct meshTriangle {
+    position a, b, c;
+};
+
+// One bucket of a mesh emitter's alias table. Picking the bucket's own triangle has the given probability, otherwise pick alias
+struct aliasEntry {
+    GLfloat probability;
+    GLuint alias;
+};
+
 class ParticleManager {
    public:
     ParticleManager();
@@ -41,12 +137,39 @@ class ParticleManager {
     void InitGL();
     int GetNumParticles();
     void UpdateComputeParameters(float dt);
+    void ExecuteComputeShader();
     void SpawnFireball(const glm::vec3& position, const glm::vec3& velocity);
-
-    float genRate = 1000;
+    int AddEmitter(const emitterParams& params, float rate);
+    int AddMeshEmitter(const Model* model, const glm::mat4& transform, emitterParams params, float rate);
+    void AddEventListener(const ParticleEventListener& listener);
+    void SetKernelFusion(KernelFusion fusion);
+    bool SetUpdateKernels(const std::vector<int>& passMasks);
+    void PrintKernelTimes();
 
     static const int NUM_PARTICLES = 8 * 1024 * 1024;
     static const int WORK_GROUP_SIZE = 128;
+    static const int MAX_EMITTERS = 16;
+    static constexpr float TIMESTEP = 0.01f;  // Must match timestep in computeShader.glsl
+
+    // Event records are read back this many frames after they're written, so the CPU never waits on the GPU for them
+    static const int EVENT_BUFFER_FRAMES = 3;
+    static const int EVENT_CAPACITY = 64 * 1024;  // Per frame
+
+    static const int SPLASH_CAPACITY = 64 * 1024;  // Ground impacts that can splash per step
+    static const int CHILDREN_PER_SPLASH = 4;      // Must match ChildrenPerSplash in computeShader.glsl
+
+    // Particle arrays are reordered by Morton code this often, so particles near each other in space stay near each other in memory
+    static const int SORT_INTERVAL = 60;  // Frames
+    static const int SORT_ITEMS_PER_THREAD = 16;  // Must match ItemsPerThread in sortComputeShader.glsl
+    static const int SORT_NUM_GROUPS = NUM_PARTICLES / (WORK_GROUP_SIZE * SORT_ITEMS_PER_THREAD);
+    static const int SORT_RADIX = 16;
+    static const int SORT_KEY_BITS = 32;
+
+    static const int MAX_TIMED_KERNELS = 16;  // Per frame
+
+    // Each fireball owns a fixed, contiguous slice of the particle pool
+    static const int MAX_FIREBALLS = 32;
+    static const int PARTICLES_PER_FIREBALL = NUM_PARTICLES / MAX_FIREBALLS;
 
     static int numAlive;
 
@@ -57,6 +180,17 @@ class ParticleManager {
     static GLuint lifeSSbo;
     static GLuint paramSSbo;
     static GLuint atomicsSSbo;
+    static GLuint fireballSSbo;
+    static GLuint emitterSSbo;
+    static GLuint deadListSSbo;
+    static GLuint meshTriangleSSbo;
+    static GLuint aliasTableSSbo;
+    static GLuint eventSSbos[EVENT_BUFFER_FRAMES];
+    static GLuint splashSSbo;
+    static GLuint sortKeySSbos[2];
+    static GLuint sortValueSSbos[2];
+    static GLuint sortHistogramSSbo;
+    static GLuint sortScratchSSbo;
 
     static ParticleMode PARTICLE_MODE;
     // 0 = zero-g original sim
@@ -65,12 +199,45 @@ class ParticleManager {
 
     particleParams particleParameters;
 
-    glm::vec3 fireballPositions[1];
-    glm::vec3 fireballVelocities[1];
-    bool fireballAlive[1];
+    fireball fireballs[MAX_FIREBALLS];
+    glm::vec3 fireballVelocities[MAX_FIREBALLS];
+
+    std::vector<emitter> emitters;
+
+    bool mortonSortEnabled = true;
+
+    // Each entry is one dispatch of the update stage, running the passes in its UpdatePass mask
+    std::vector<int> updateKernels;
+    KernelFusion kernelFusion;
+
+    // GPU timestamps around every dispatch, averaged until PrintKernelTimes
+    bool kernelTimingEnabled = false;
+
+    // Event totals from the most recently read back frame
+    GLuint eventCounts[NUM_EVENT_TYPES];
 
    private:
-    void UpdateFireball(float dt);
+    void UpdateEmitters();
+    void ConsumeEvents(int bufferIndex);
+    void SortParticles();
+    void BeginKernelTimers(int slot);
+    void TimeKernel(int slot, const std::string& name);
+
+    void UpdateFireball(int index, float dt);
+
+    int computesSinceFireballEvent[MAX_FIREBALLS];
+    int nextFireball = 0;
+
+    std::vector<meshTriangle> meshTriangles;
+    std::vector<aliasEntry> aliasTable;
+
+    std::vector<ParticleEventListener> eventListeners;
+    GLsync eventFences[EVENT_BUFFER_FRAMES];
+    int eventFrame = 0;
 
-    int computesSinceFireballEvent = 0;
+    // Timestamps use the same ring of frames as the events. Query 0 of each frame is the start, query i is the end of kernel i - 1
+    GLuint timestampQueries[EVENT_BUFFER_FRAMES][MAX_TIMED_KERNELS + 1];
+    std::vector<std::string> timedKernels[EVENT_BUFFER_FRAMES];
+    std::vector<std::pair<std::string, double>> kernelTimeTotals;  // Milliseconds, in the order kernels were first seen
+    int kernelTimeSamples = 0;
 };
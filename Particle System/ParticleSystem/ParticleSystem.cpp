@@ -23,7 +23,11 @@ const char* INSTRUCTIONS =
     "WASD - Camera movement\n"
     "R/F - Camera up/down"
     "Space - Pause/Play simulation\n"
-    "g - Launch sun (in sunlauncher mode)\n"
+    "g - Launch sun (in sunlauncher mode, up to 32 at once)\n"
+    "t - Add a teapot that sprays water from its surface at the center of gravity (in water mode)\n"
+    "m - Toggle periodically reordering particles in memory by their position\n"
+    "k - Cycle how the particle update is split into GPU kernels (fused, partly fused, fully split)\n"
+    "p - Start timing each GPU kernel, press again to print the average times\n"
     "+/- - Increase/decrease various parameters, depending on the other keys held:\n"
     "   None - Modify simulation speed\n"
     "   Ctrl - Modify the factor that controls how attractive/repulsive the gravity center is\n"
@@ -311,6 +315,28 @@ int main(int argc, char* argv[]) {
                     glm::vec3 normalizedForward = glm::normalize(camera.GetForward());
                     particleManager.SpawnFireball(camera.GetPosition() + normalizedForward * spawnDistance,
                                                   normalizedForward * fireballSpawnVel);
+                } else if (windowEvent.key.keysym.sym == SDLK_t && ParticleManager::PARTICLE_MODE == Water_Mode) {
+                    static Model* teapotModel = new Model("models/teapot.txt");
+                    glm::mat4 transform = glm::translate(glm::mat4(), lastMouseWorldCoord);
+                    transform = glm::scale(transform, glm::vec3(5, 5, 5));
+
+                    emitterParams teapot = {};
+                    teapot.radialSpeed = 6.f;
+                    teapot.velocitySpread = 1.f;
+                    particleManager.AddMeshEmitter(teapotModel, transform, teapot, 100000.f);
+                } else if (windowEvent.key.keysym.sym == SDLK_m) {
+                    particleManager.mortonSortEnabled = !particleManager.mortonSortEnabled;
+                    printf("Morton reordering %s\n", particleManager.mortonSortEnabled ? "on" : "off");
+                } else if (windowEvent.key.keysym.sym == SDLK_k) {
+                    const char* fusionNames[] = {"fully fused", "partly fused", "fully split"};
+                    KernelFusion fusion = KernelFusion((particleManager.kernelFusion + 1) % NUM_KERNEL_FUSIONS);
+                    particleManager.SetKernelFusion(fusion);
+                    printf("Particle update kernels: %s\n", fusionNames[fusion]);
+                } else if (windowEvent.key.keysym.sym == SDLK_p) {
+                    if (particleManager.kernelTimingEnabled) {
+                        particleManager.PrintKernelTimes();
+                    }
+                    particleManager.kernelTimingEnabled = !particleManager.kernelTimingEnabled;
                 }
             }
 
@@ -359,25 +385,7 @@ int main(int argc, char* argv[]) {
         particleManager.UpdateComputeParameters(deltaTime);
 
         // Particles compute shader //
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleManager.posSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particleManager.velSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleManager.colSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleManager.paramSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, particleManager.lifeSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleManager.atomicsSSbo);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, particleManager.colModSSbo);
-
-        glUseProgram(ShaderManager::ParticleComputeShader);
-        glDispatchCompute(ParticleManager::NUM_PARTICLES / ParticleManager::WORK_GROUP_SIZE, 1, 1);  // Compute shader!!
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+        particleManager.ExecuteComputeShader();
 
         // Rendering //
         float gray = 0.6f;
@@ -411,12 +419,14 @@ int main(int argc, char* argv[]) {
         }
 
         stringstream debugText;
-        debugText << fixed << setprecision(3) << particleManager.GetNumParticles() << " total " /*<< particleManager.numAlive << " alive "*/
+        debugText << fixed << setprecision(3) << particleManager.GetNumParticles() << " total " << particleManager.numAlive << " alive"
                   << " | " << lastAverageFrameTime << " per frame (" << lastFramerate << "FPS) average over " << framesPerSample
                   << " frames "
                   << " | cameraPosition: " << camera.GetPosition() << " | CoG position: " << lastMouseWorldCoord
                   << " | simulationSpeed: " << particleManager.particleParameters.simulationSpeed
-                  << " | gravityFactor: " << particleManager.particleParameters.gravityAccelerationFactor << "/" << fullGravityAcceleration;
+                  << " | gravityFactor: " << particleManager.particleParameters.gravityAccelerationFactor << "/" << fullGravityAcceleration
+                  << " | events (spawn/bounce/death): " << particleManager.eventCounts[Spawn_Event] << "/"
+                  << particleManager.eventCounts[Bounce_Event] << "/" << particleManager.eventCounts[Death_Event];
         SDL_SetWindowTitle(window, debugText.str().c_str());
 
         // Render the environment
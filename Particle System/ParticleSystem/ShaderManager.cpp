@@ -4,6 +4,13 @@
 #include "ShaderManager.h"
 
 GLuint ShaderManager::ParticleComputeShader;
+GLuint ShaderManager::ParticleComputeStage;
+GLuint ShaderManager::ParticleUpdatePasses;
+GLuint ShaderManager::ParticleSortShader;
+GLuint ShaderManager::ParticleSortStage;
+GLuint ShaderManager::ParticleSortDigitShift;
+GLuint ShaderManager::ParticleSortGatherAttribute;
+GLuint ShaderManager::ParticleSortNumGroups;
 RenderShader ShaderManager::EnvironmentShader;
 RenderShader ShaderManager::ParticleShader;
 
@@ -13,6 +20,13 @@ void ShaderManager::InitShaders() {
     EnvironmentShader.Program = CompileRenderShader("environment-Vertex.glsl", "environment-Fragment.glsl");
     ParticleShader.Program = CompileRenderShader("particle-Vertex.glsl", "particle-Fragment.glsl");
     ParticleComputeShader = CompileComputeShaderProgram("computeShader.glsl");
+    ParticleComputeStage = glGetUniformLocation(ParticleComputeShader, "computationStage");
+    ParticleUpdatePasses = glGetUniformLocation(ParticleComputeShader, "updatePasses");
+    ParticleSortShader = CompileComputeShaderProgram("sortComputeShader.glsl");
+    ParticleSortStage = glGetUniformLocation(ParticleSortShader, "computationStage");
+    ParticleSortDigitShift = glGetUniformLocation(ParticleSortShader, "digitShift");
+    ParticleSortGatherAttribute = glGetUniformLocation(ParticleSortShader, "gatherAttribute");
+    ParticleSortNumGroups = glGetUniformLocation(ParticleSortShader, "numSortGroups");
 
     InitEnvironmentShaderAttributes();
     InitParticleShaderAttributes();
@@ -21,6 +35,7 @@ void ShaderManager::InitShaders() {
 void ShaderManager::Cleanup() {
     glDeleteProgram(EnvironmentShader.Program);
     glDeleteProgram(ParticleComputeShader);
+    glDeleteProgram(ParticleSortShader);
     glDeleteProgram(ParticleShader.Program);
 
     glDeleteVertexArrays(1, &EnvironmentShader.VAO);
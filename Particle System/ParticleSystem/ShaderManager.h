@@ -35,6 +35,13 @@ class ShaderManager {
     static RenderShader EnvironmentShader;
     static RenderShader ParticleShader;
     static GLuint ParticleComputeShader;
+    static GLuint ParticleComputeStage;
+    static GLuint ParticleUpdatePasses;
+    static GLuint ParticleSortShader;
+    static GLuint ParticleSortStage;
+    static GLuint ParticleSortDigitShift;
+    static GLuint ParticleSortGatherAttribute;
+    static GLuint ParticleSortNumGroups;
 
    private:
     static void InitEnvironmentShaderAttributes();
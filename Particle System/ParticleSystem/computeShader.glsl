@@ -25,16 +25,27 @@ layout(std430, binding = 5) buffer Life {
 };
 
 layout(std430, binding = 4) buffer Parameters {
-    vec3 GravityCenter;
+    vec3 MouseGravityCenter;
     float minX, minY, minZ;
     float maxX, maxY, maxZ;
     float PlayerX, PlayerY, PlayerZ;
     float SimulationSpeed;
     float GravityFactor;
-    float SpawnRate;
+    int SpawnCount;
     float Time;
     int ParticleMode;
-    int FireballState;
+    int ParticlesPerFireball;
+    int NumEmitters;
+};
+
+struct Fireball {
+    vec3 center;
+    int state;
+};
+
+// Every fireball's state machine, so one dispatch can advance all of them
+layout(std430, binding = 8) buffer Fireballs {
+    Fireball FireballStates[];
 };
 
 // layout(binding = 6, offset = 0) uniform atomic_uint NumDead;
@@ -42,11 +53,103 @@ layout(std430, binding = 6) buffer Atomics {
     int NumDead;
 };
 
+struct Emitter {
+    vec3 center;
+    int shape;
+    vec3 axis;
+    float radius;
+    vec3 halfExtents;
+    float speed;
+    float radialSpeed;
+    float velocitySpread;
+    float thickness;
+    uint firstSpawn;
+    uint spawnCount;
+    uint firstTriangle;
+    uint triangleCount;
+    uint padding;
+};
+
+layout(std430, binding = 9) buffer Emttrs {
+    Emitter Emitters[];
+};
+
+// The first NumDead entries are the indices of dead particles that emitters can spawn
+layout(std430, binding = 10) buffer Dead {
+    uint DeadList[];
+};
+
+struct MeshTriangle {
+    vec4 a;  // w holds the triangle's area
+    vec4 b;
+    vec4 c;
+};
+
+layout(std430, binding = 11) buffer MeshTris {
+    MeshTriangle MeshTriangles[];
+};
+
+struct AliasEntry {
+    float probability;
+    uint alias;
+};
+
+// One bucket per mesh triangle. Alias indices are absolute indices into MeshTriangles
+layout(std430, binding = 12) buffer Alias {
+    AliasEntry AliasTable[];
+};
+
+struct ParticleEvent {
+    uint typeAndParticle;  // Event type in the top 2 bits, particle index in the rest
+    float x, y, z;         // Where it happened
+};
+
+// Append buffer of what happened this step. NumEvents and EventTypeCounts keep counting past EventCapacity, so the totals stay
+// right even when records get dropped
+layout(std430, binding = 13) buffer Evnts {
+    uint NumEvents;
+    uint EventCapacity;
+    int DeadSnapshot;  // Copied from NumDead after the step
+    uint EventPadding;
+    uint EventTypeCounts[4];
+    ParticleEvent Events[];
+};
+
+struct SplashRequest {
+    vec4 position;  // Where the parent hit the ground
+    vec4 velocity;  // The parent's velocity just before it hit
+};
+
+// Splash requests appended by ground impacts during the update. The first three uints are the indirect dispatch arguments for the
+// splash stage, kept big enough for every accepted request's children as requests are appended
+layout(std430, binding = 14) buffer Splshs {
+    uint SplashGroupsX;
+    uint SplashGroupsY;
+    uint SplashGroupsZ;
+    uint NumSplashRequests;  // Can pass SplashCapacity, extra requests are dropped
+    uint SplashCapacity;
+    uint SplashPadding[3];
+    SplashRequest SplashRequests[];
+};
+
+// Acceleration from the attract pass, for when the integrate pass runs in a separate dispatch. Shares the sort's scratch buffer
+layout(std430, binding = 15) buffer Accel {
+    vec4 Accelerations[];
+};
+
+uniform int computationStage;
+uniform int updatePasses;  // Which of the update passes this dispatch runs
+
 layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
 
 const float timestep = 0.01;
 const float G = 50;
 const float bounceFactor = -0.7;
+const float waterDespawnTime = 15;
+
+const uint ChildrenPerSplash = 4;  // Must match CHILDREN_PER_SPLASH in ParticleManager.h
+const float splashLifetime = 1.5;
+const float minSplashSpeed = 10;  // Impacts slower than this don't splash
 
 // -- Poor man's enums -- //
 const int FreeMode = 0;
@@ -57,11 +160,52 @@ const int Waiting = 0;
 const int Spawning = 1;
 const int Moving = 2;
 const int Exploding = 3;
+
+const int DiskEmitter = 0;
+const int SphereEmitter = 1;
+const int BoxEmitter = 2;
+const int MeshSurfaceEmitter = 3;
+
+const int EmitStage = 0;
+const int UpdateStage = 1;
+const int SplashStage = 2;
+
+const int SpawnPassBit = 1;
+const int AttractPassBit = 2;
+const int IntegratePassBit = 4;
+const int ColorPassBit = 8;
+const int CollidePassBit = 16;
+const int DespawnPassBit = 32;
+
+const uint DeathEvent = 0;
+const uint BounceEvent = 1;
+const uint SpawnEvent = 2;
+const uint NumEventTypes = 3;
 // -- -- //
 
 uint gid = -1;
 float randSeed = 1;
 
+// Each invocation sees at most one event of each type per step. They're held here and written out together in FlushEvents
+uint pendingEvents = 0;
+uint pendingEventParticles[NumEventTypes];
+vec3 pendingEventPositions[NumEventTypes];
+
+bool pendingSplash = false;
+SplashRequest pendingSplashRequest;
+
+shared uint groupEventTotal;
+shared uint groupEventBase;
+shared uint groupEventTypeCounts[NumEventTypes];
+
+shared uint groupSplashTotal;
+shared uint groupSplashBase;
+
+// The center this particle is attracted to/orbiting. In fireball mode it's the center of the fireball that owns the particle
+vec3 GravityCenter;
+int FireballState = Waiting;
+vec3 Acceleration = vec3(0, 0, 0);
+
 // -- Random Function -- //
 // https://stackoverflow.com/a/28095165
 
@@ -172,34 +316,92 @@ void UpdateColor() {
     }
 }
 
-// -- Spawning -- //
-const float PI = 3.14159265358979323846264;
-const vec4 diskCenter = vec4(20, 20, 50, 1);
-const vec4 diskNormal = normalize(vec4(1, 0, 1, 1));
-const float diskRadius = 10;
-const float cylindricalHeight = -4;
-const float launchAngle = -PI / 2;
-const float launchVelocity = 30;
-const vec4 up = vec4(0, 0, 1, 1);
+// -- Events -- //
+void RecordEvent(uint type) {
+    pendingEvents |= 1u << type;
+    pendingEventParticles[type] = gid;
+    pendingEventPositions[type] = Positions[gid].xyz;
+}
 
+// Must be reached by every invocation in the work group. Reserves space for the whole group's events with one global atomic
+void FlushEvents() {
+    if (gl_LocalInvocationIndex == 0) {
+        groupEventTotal = 0;
+        for (uint type = 0; type < NumEventTypes; type++) {
+            groupEventTypeCounts[type] = 0;
+        }
+    }
+    barrier();
+
+    uint localOffset = 0;
+    if (pendingEvents != 0) {
+        localOffset = atomicAdd(groupEventTotal, uint(bitCount(pendingEvents)));
+        for (uint type = 0; type < NumEventTypes; type++) {
+            if ((pendingEvents & (1u << type)) != 0) {
+                atomicAdd(groupEventTypeCounts[type], 1u);
+            }
+        }
+    }
+    barrier();
 
-void SpawnInDisk() {
-    float r = diskRadius * sqrt(gold_noise(vec2(gid, gid), randSeed));
-    float theta = rand(gid + randSeed + 1) * 2 * PI;
+    if (gl_LocalInvocationIndex == 0 && groupEventTotal > 0) {
+        groupEventBase = atomicAdd(NumEvents, groupEventTotal);
+        for (uint type = 0; type < NumEventTypes; type++) {
+            atomicAdd(EventTypeCounts[type], groupEventTypeCounts[type]);
+        }
+    }
+    barrier();
+
+    uint slot = groupEventBase + localOffset;
+    for (uint type = 0; type < NumEventTypes; type++) {
+        if ((pendingEvents & (1u << type)) != 0) {
+            if (slot < EventCapacity) {
+                vec3 position = pendingEventPositions[type];
+                Events[slot] = ParticleEvent((type << 30) | pendingEventParticles[type], position.x, position.y, position.z);
+            }
+            slot++;
+        }
+    }
+}
+// -- -- //
 
-    vec4 vecInPlane = vec4(cross(up.xyz, diskNormal.xyz), 1);
-    vec4 rotated = rotationMatrix(diskNormal.xyz, theta) * vecInPlane;
+// -- Splashes -- //
+void RequestSplash(vec3 impactVelocity) {
+    pendingSplash = true;
+    pendingSplashRequest = SplashRequest(vec4(Positions[gid].xyz, 1), vec4(impactVelocity, 1));
+}
+
+// Must be reached by every invocation in the work group. Appends the group's splash requests with one global atomic, and grows the
+// splash stage's dispatch to cover them
+void FlushSplashes() {
+    if (gl_LocalInvocationIndex == 0) {
+        groupSplashTotal = 0;
+    }
+    barrier();
 
-    float cylinderNoise = gold_noise(vec2(gid, gid), randSeed + 4);
-    vec4 cylindricalOffset = cylinderNoise * diskNormal * cylindricalHeight;
+    uint localOffset = 0;
+    if (pendingSplash) {
+        localOffset = atomicAdd(groupSplashTotal, 1u);
+    }
+    barrier();
 
-    Positions[gid] = diskCenter + r * normalize(rotated) + cylindricalOffset;
+    if (gl_LocalInvocationIndex == 0 && groupSplashTotal > 0) {
+        groupSplashBase = atomicAdd(NumSplashRequests, groupSplashTotal);
+        uint accepted = min(groupSplashBase + groupSplashTotal, SplashCapacity);
+        atomicMax(SplashGroupsX, (accepted * ChildrenPerSplash + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x);
+    }
+    barrier();
 
-    float noiseX = (rand(gid + randSeed + 102) - 0.5) * 4;
-    float noiseY = (rand(gid + randSeed + 103) - 0.5) * 4;
-    float noiseZ = (rand(gid + randSeed + 104) - 0.5) * 4;
-    Velocities[gid] = vec4(noiseX, noiseY, noiseZ, 1) + diskNormal * launchVelocity;
+    uint slot = groupSplashBase + localOffset;
+    if (pendingSplash && slot < SplashCapacity) {
+        SplashRequests[slot] = pendingSplashRequest;
+    }
 }
+// -- -- //
+
+// -- Spawning -- //
+const float PI = 3.14159265358979323846264;
+const vec4 up = vec4(0, 0, 1, 1);
 
 // Adapted from https://karthikkaranth.me/blog/generating-random-points-in-a-sphere/
 vec3 RandomPointInSphere(float sphereRadius, vec3 sphereCenter) {
@@ -229,9 +431,7 @@ vec3 RandomPointInCube(float sideLength, vec3 center) {
 }
 
 void InitializeSpawnPositionAndVelocity() {
-    if (ParticleMode == WaterMode) {
-        SpawnInDisk();
-    } else if (ParticleMode == FreeMode) {
+    if (ParticleMode == FreeMode) {
         Positions[gid] = vec4(RandomPointInCube(100, vec3(50, 50, 50)), 1);
         Velocities[gid] = vec4(RandomVelocity(randSeed + gid, 4), 1);
     } else if (ParticleMode == FireballMode && FireballState == Spawning) {
@@ -240,6 +440,126 @@ void InitializeSpawnPositionAndVelocity() {
     }
 }
 
+// -- Emitters -- //
+vec3 RandomPointInDisk(Emitter emitter) {
+    float r = emitter.radius * sqrt(gold_noise(vec2(gid, gid), randSeed));
+    float theta = rand(gid + randSeed + 1) * 2 * PI;
+
+    vec3 inPlane = cross(up.xyz, emitter.axis);
+    if (length(inPlane) < 0.0001) {
+        inPlane = cross(vec3(1, 0, 0), emitter.axis);  // The disk is facing straight up or down
+    }
+    vec3 rotated = (rotationMatrix(emitter.axis, theta) * vec4(normalize(inPlane), 0)).xyz;
+
+    float depth = gold_noise(vec2(gid, gid), randSeed + 4) * emitter.thickness;
+
+    return emitter.center + r * normalize(rotated) - depth * emitter.axis;
+}
+
+vec3 RandomPointInBox(vec3 halfExtents, vec3 center) {
+    float x = (rand(gid + randSeed + 600) - 0.5) * 2 * halfExtents.x;
+    float y = (rand(gid + randSeed + 601) - 0.5) * 2 * halfExtents.y;
+    float z = (rand(gid + randSeed + 602) - 0.5) * 2 * halfExtents.z;
+
+    return vec3(x, y, z) + center;
+}
+
+vec3 RandomPointOnMesh(Emitter emitter, out vec3 normal) {
+    // Alias table lookup - pick a bucket uniformly, then either keep its triangle or take its alias. Triangles come out in proportion
+    // to their area in constant time
+    uint bucket = emitter.firstTriangle + min(uint(rand(gid + randSeed + 700) * emitter.triangleCount), emitter.triangleCount - 1);
+    AliasEntry entry = AliasTable[bucket];
+    uint triangle = rand(gid + randSeed + 703) < entry.probability ? bucket : entry.alias;
+    MeshTriangle tri = MeshTriangles[triangle];
+
+    vec3 n = cross(tri.b.xyz - tri.a.xyz, tri.c.xyz - tri.a.xyz);
+    normal = length(n) > 0 ? normalize(n) : vec3(0, 0, 0);
+
+    // Uniform point in the triangle
+    float su = sqrt(rand(gid + randSeed + 701));
+    float v = rand(gid + randSeed + 702);
+    return (1 - su) * tri.a.xyz + su * (1 - v) * tri.b.xyz + su * v * tri.c.xyz;
+}
+
+void SpawnFromEmitter(Emitter emitter) {
+    Lifetimes[gid] = 1;
+    SetSpawnColor();
+
+    vec3 position;
+    vec3 outward = vec3(0, 0, 0);  // Direction the radial part of the launch velocity points
+    if (emitter.shape == DiskEmitter) {
+        position = RandomPointInDisk(emitter);
+    } else if (emitter.shape == SphereEmitter) {
+        position = RandomPointInSphere(emitter.radius, emitter.center);
+    } else if (emitter.shape == BoxEmitter) {
+        position = RandomPointInBox(emitter.halfExtents, emitter.center);
+    } else {
+        position = RandomPointOnMesh(emitter, outward);
+    }
+
+    if (emitter.shape == SphereEmitter || emitter.shape == BoxEmitter) {
+        vec3 fromCenter = position - emitter.center;
+        outward = length(fromCenter) > 0 ? normalize(fromCenter) : vec3(0, 0, 0);
+    }
+
+    vec3 velocity = emitter.axis * emitter.speed + outward * emitter.radialSpeed;
+    velocity += RandomVelocity(randSeed + gid + 102, emitter.velocitySpread);
+
+    Positions[gid] = vec4(position, 1);
+    Velocities[gid] = vec4(velocity, 1);
+    UpdateColor();
+    RecordEvent(SpawnEvent);
+}
+
+void EmitParticle() {
+    uint spawnIndex = gl_GlobalInvocationID.x;
+    if (spawnIndex >= uint(SpawnCount)) return;
+
+    // Pop a particle off the dead list. If the list has run dry, undo the pop and skip this spawn
+    int slot = atomicAdd(NumDead, -1) - 1;
+    if (slot < 0) {
+        atomicAdd(NumDead, 1);
+        return;
+    }
+    gid = DeadList[slot];
+
+    // The emitters' firstSpawn values are a prefix sum of their spawn counts, so find the last emitter starting at or before us
+    int e = 0;
+    while (e < NumEmitters - 1 && spawnIndex >= Emitters[e + 1].firstSpawn) {
+        e++;
+    }
+
+    SpawnFromEmitter(Emitters[e]);
+}
+// -- -- //
+
+// One thread per splash child. Children are short-lived droplets thrown up and out from the impact point
+void SpawnSplashChild() {
+    uint child = gl_GlobalInvocationID.x;
+    if (child >= min(NumSplashRequests, SplashCapacity) * ChildrenPerSplash) return;
+
+    int slot = atomicAdd(NumDead, -1) - 1;
+    if (slot < 0) {
+        atomicAdd(NumDead, 1);
+        return;
+    }
+    gid = DeadList[slot];
+    SplashRequest request = SplashRequests[child / ChildrenPerSplash];
+
+    float impactSpeed = abs(request.velocity.z);
+    float theta = rand(gid + randSeed + 800) * 2 * PI;
+    float outward = (0.1 + 0.3 * rand(gid + randSeed + 801)) * impactSpeed;
+    vec3 velocity = vec3(cos(theta) * outward, sin(theta) * outward, (0.15 + 0.2 * rand(gid + randSeed + 802)) * impactSpeed);
+    velocity.xy += request.velocity.xy * 0.3;
+
+    Lifetimes[gid] = waterDespawnTime - splashLifetime;  // Splashes don't hang around as long as the water that made them
+    SetSpawnColor();
+    Positions[gid] = vec4(request.position.xy, request.position.z + 0.01, 1);
+    Velocities[gid] = vec4(velocity, 1);
+    UpdateColor();
+    RecordEvent(SpawnEvent);
+}
+
 void Spawn() {
     Lifetimes[gid] = 1;
     // atomicAdd(NumDead, -1);
@@ -247,21 +567,43 @@ void Spawn() {
     SetSpawnColor();
     UpdateColor();
     InitializeSpawnPositionAndVelocity();
+    RecordEvent(SpawnEvent);
 }
 
 void Die() {
+    RecordEvent(DeathEvent);
     Lifetimes[gid] = -1;
     Colors[gid].a = 0;
     Positions[gid] = vec4(10000, 10000, 10000, 1);
-    // atomicAdd(NumDead, 1);
+
+    if (ParticleMode == WaterMode) {
+        // Hand the particle back to the emitters
+        int slot = atomicAdd(NumDead, 1);
+        DeadList[slot] = gid;
+    }
 }
 // -- -- //
 
-void main() {
-    gid = gl_GlobalInvocationID.x;
-    randSeed = Time;
-    float dt = timestep * SimulationSpeed;
+// -- Update passes -- //
+// Each pass can run in its own dispatch or fused with the others into one, depending on the updatePasses mask. Passes that run in the
+// same dispatch share Acceleration in registers, otherwise it goes through the Accel buffer
+
+void LoadFireball() {
+    if (ParticleMode == FireballMode) {
+        // Each fireball owns a contiguous slice of the pool, so this is uniform across a work group
+        Fireball fireball = FireballStates[gid / ParticlesPerFireball];
+        GravityCenter = fireball.center;
+        FireballState = fireball.state;
+    } else {
+        GravityCenter = MouseGravityCenter;
+    }
+}
 
+bool IsDead() {
+    return Lifetimes[gid] < 0;
+}
+
+void SpawnPass(float dt) {
     if (ParticleMode == FireballMode) {
         if (FireballState == Spawning) {
             Spawn();
@@ -279,13 +621,9 @@ void main() {
         }
     }
 
-    if (Lifetimes[gid] < 0) {
+    if (IsDead()) {
         if (ParticleMode == FreeMode) {
             Spawn();
-        } else if (ParticleMode == 2 && dt > 0 && gold_noise(vec2(gid, gid), randSeed + 3) < 0.000000000001) {
-            Spawn();
-        } else {
-            return;
         }
     } else {
         Lifetimes[gid] += dt;
@@ -293,24 +631,37 @@ void main() {
             Lifetimes[gid] += 4 * dt;  // age still particles faster
         }
     }
+}
+
+bool IsIntegrated() {
+    return ParticleMode != FireballMode || (FireballState != Moving && FireballState != Spawning);
+}
+
+void AttractPass() {
+    if (!IsIntegrated()) return;
+
+    float r = length(GravityCenter - Positions[gid].xyz) / 5;
+    vec3 a = (normalize(GravityCenter - Positions[gid].xyz) * (G + (1 / pow(r, 2)))) * GravityFactor;
+    if (ParticleMode != FreeMode) {
+        a += vec3(0, 0, -9.86);
+    }
+    Acceleration = a;
+}
 
+void IntegratePass(float dt) {
     if (ParticleMode == FireballMode && FireballState == Moving) {
         Positions[gid].xyz = GravityCenter + Velocities[gid].xyz;
-    } else if (ParticleMode != FireballMode || FireballState != Spawning) {
+    } else if (IsIntegrated()) {
         vec3 p = Positions[gid].xyz;
         vec3 v = Velocities[gid].xyz;
-        float r = length(GravityCenter - Positions[gid].xyz) / 5;
-        vec3 a = (normalize(GravityCenter - Positions[gid].xyz) * (G + (1 / pow(r, 2)))) * GravityFactor;
-        if (ParticleMode != FreeMode) {
-            a += vec3(0, 0, -9.86);
-        }
-
-        vec3 dta = dt * a;
+        vec3 dta = dt * Acceleration;
 
         Positions[gid].xyz = p.xyz + v.xyz * dt + 0.5 * dt * dta;
         Velocities[gid].xyz = (v + dta) * 0.9999;
     }
+}
 
+void ColorPass(float dt) {
     UpdateColor();
 
     if (ParticleMode == FireballMode && (FireballState == Exploding || FireballState == Waiting)) {
@@ -319,7 +670,9 @@ void main() {
 
         ColorMods[gid].a = max(ColorMods[gid].a, 0);
     }
+}
 
+void CollidePass() {
     if (ParticleMode == WaterMode && length(Positions[gid].xyz - GravityCenter) < 4.75) {
         vec3 toParticle = normalize(Positions[gid].xyz - GravityCenter);
         //Positions[gid].xyz = Positions[gid].xyz + toParticle * 5;
@@ -328,7 +681,12 @@ void main() {
 
     if (Positions[gid].z < minZ && !(ParticleMode == FireballMode && FireballState == Spawning)) {
         Positions[gid].z = minZ + 0.001;
-        if (abs(Velocities[gid].z) > 10) {
+        RecordEvent(BounceEvent);
+        if (abs(Velocities[gid].z) > minSplashSpeed) {
+            if (ParticleMode == WaterMode) {
+                RequestSplash(Velocities[gid].xyz);
+            }
+
             float theta = (rand(randSeed + gid + 21) - 0.5) * 0.6 * PI;
             float xyFactor = 1.0;
             float bounceFac = -1.0;
@@ -373,10 +731,12 @@ void main() {
         Positions[gid].y = maxY;
         Velocities[gid].y *= bounceFactor;
     }
+}
 
+void DespawnPass() {
     float despawnTime;
     if (ParticleMode == WaterMode) {
-        despawnTime = 15;
+        despawnTime = waterDespawnTime;
     } else {
         despawnTime = 100;
     }
@@ -388,4 +748,55 @@ void main() {
     if (ParticleMode == FireballMode && (FireballState == Exploding || FireballState == Waiting) && (ColorMods[gid].a == 0 || length(Colors[gid].rgb) < 0.05)) {
         Die();    
     }
-}
\ No newline at end of file
+}
+
+void UpdateParticle() {
+    float dt = timestep * SimulationSpeed;
+    LoadFireball();
+
+    if ((updatePasses & SpawnPassBit) != 0) {
+        SpawnPass(dt);
+    }
+    if (IsDead()) return;
+
+    if ((updatePasses & AttractPassBit) != 0) {
+        AttractPass();
+        if ((updatePasses & IntegratePassBit) == 0) {
+            Accelerations[gid] = vec4(Acceleration, 0);
+        }
+    }
+    if ((updatePasses & IntegratePassBit) != 0) {
+        if ((updatePasses & AttractPassBit) == 0) {
+            Acceleration = Accelerations[gid].xyz;
+        }
+        IntegratePass(dt);
+    }
+    if ((updatePasses & ColorPassBit) != 0) {
+        ColorPass(dt);
+    }
+    if ((updatePasses & CollidePassBit) != 0) {
+        CollidePass();
+    }
+    if ((updatePasses & DespawnPassBit) != 0) {
+        DespawnPass();
+    }
+}
+// -- -- //
+
+void main() {
+    gid = gl_GlobalInvocationID.x;
+    randSeed = Time;
+
+    if (computationStage == EmitStage) {
+        EmitParticle();
+    } else if (computationStage == UpdateStage) {
+        UpdateParticle();
+        if (ParticleMode == WaterMode && (updatePasses & CollidePassBit) != 0) {
+            FlushSplashes();
+        }
+    } else if (computationStage == SplashStage) {
+        SpawnSplashChild();
+    }
+
+    FlushEvents();
+}
@@ -0,0 +1,291 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Reorders every particle attribute array by the 3D Morton code of the particle's position, so particles that are close in space are
+// close in memory. It's an LSD radix sort of (key, particle index) pairs, 4 bits per pass, followed by a gather of each attribute
+
+precision highp float;
+
+layout(std140, binding = 1) buffer Pos {
+    vec4 Positions[];
+};
+
+layout(std140, binding = 2) buffer Vel {
+    vec4 Velocities[];
+};
+
+layout(std140, binding = 3) buffer Col {
+    vec4 Colors[];
+};
+
+layout(std140, binding = 7) buffer ColMod {
+    vec4 ColorMods[];
+};
+
+layout(std430, binding = 5) buffer Life {
+    float Lifetimes[];
+};
+
+layout(std430, binding = 4) buffer Parameters {
+    vec3 MouseGravityCenter;
+    float minX, minY, minZ;
+    float maxX, maxY, maxZ;
+    float PlayerX, PlayerY, PlayerZ;
+    float SimulationSpeed;
+    float GravityFactor;
+    int SpawnCount;
+    float Time;
+    int ParticleMode;
+    int ParticlesPerFireball;
+    int NumEmitters;
+};
+
+layout(std430, binding = 6) buffer Atomics {
+    int NumDead;
+};
+
+layout(std430, binding = 10) buffer Dead {
+    uint DeadList[];
+};
+
+// The pass reads from SortKeys/SortValues and writes to SortKeysOut/SortValuesOut. The CPU swaps them between passes
+layout(std430, binding = 15) buffer Keys {
+    uint SortKeys[];
+};
+
+layout(std430, binding = 16) buffer Values {
+    uint SortValues[];  // The particle index each key came from
+};
+
+layout(std430, binding = 17) buffer KeysOut {
+    uint SortKeysOut[];
+};
+
+layout(std430, binding = 18) buffer ValuesOut {
+    uint SortValuesOut[];
+};
+
+// Digit-major (every group's count of digit 0, then every group's count of digit 1, ...), so that after an exclusive scan each entry
+// is where that group's particles with that digit start in the output
+layout(std430, binding = 19) buffer Histograms {
+    uint GroupHistograms[];
+};
+
+// Attributes are gathered into here and then copied back over the original
+layout(std430, binding = 20) buffer Scratch {
+    vec4 ScratchVec4[];
+};
+
+layout(std430, binding = 20) buffer ScratchFloats {
+    float ScratchFloat[];
+};
+
+uniform int computationStage;
+uniform int digitShift;
+uniform int gatherAttribute;
+uniform int numSortGroups;
+
+layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
+
+const uint ItemsPerThread = 16;  // Must match SORT_ITEMS_PER_THREAD in ParticleManager.h
+const uint Radix = 16;
+const uint DigitMask = Radix - 1;
+const uint DeadKey = 0xFFFFFFFFu;  // Sorts dead particles to the end, where the dead list can be rebuilt from them
+const float mortonCellSize = 0.5;
+
+// -- Poor man's enums -- //
+const int FreeMode = 0;
+const int FireballMode = 1;
+const int WaterMode = 2;
+
+const int KeyStage = 0;
+const int HistogramStage = 1;
+const int ScanStage = 2;
+const int ScatterStage = 3;
+const int GatherStage = 4;
+const int CountDeadStage = 5;
+const int RebuildDeadListStage = 6;
+
+const int GatherPositions = 0;
+const int GatherVelocities = 1;
+const int GatherColors = 2;
+const int GatherColorMods = 3;
+const int GatherLifetimes = 4;
+// -- -- //
+
+shared uint groupDigitCounts[Radix];
+shared uint threadDigitOffsets[Radix][128];
+shared uint threadTotals[128];
+
+// Spreads the low 10 bits of x out to every third bit
+uint SpreadBits(uint x) {
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// 30 bits. The grid wraps every 1024 cells, which only costs locality between particles that are very far apart anyway
+uint MortonCode(vec3 p) {
+    uvec3 cell = uvec3(ivec3(floor(p / mortonCellSize)));
+    return SpreadBits(cell.x) | (SpreadBits(cell.y) << 1) | (SpreadBits(cell.z) << 2);
+}
+
+void ComputeKey(uint i) {
+    uint key = MortonCode(Positions[i].xyz);
+    if (ParticleMode == FireballMode) {
+        // Each fireball owns a slice of the pool, so particles may only move within their slice. Its index goes in the top bits
+        key = ((i / uint(ParticlesPerFireball)) << 27) | (key >> 3);
+    } else if (ParticleMode == WaterMode && Lifetimes[i] < 0) {
+        key = DeadKey;
+    }
+
+    SortKeys[i] = key;
+    SortValues[i] = i;
+}
+
+uint Digit(uint key) {
+    return (key >> digitShift) & DigitMask;
+}
+
+void CountDigits() {
+    if (gl_LocalInvocationIndex < Radix) {
+        groupDigitCounts[gl_LocalInvocationIndex] = 0;
+    }
+    barrier();
+
+    uint first = gl_GlobalInvocationID.x * ItemsPerThread;
+    for (uint k = 0; k < ItemsPerThread; k++) {
+        atomicAdd(groupDigitCounts[Digit(SortKeys[first + k])], 1u);
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex < Radix) {
+        GroupHistograms[gl_LocalInvocationIndex * uint(numSortGroups) + gl_WorkGroupID.x] = groupDigitCounts[gl_LocalInvocationIndex];
+    }
+}
+
+// Run as a single work group. Each thread scans its own run of the histograms, then the runs are offset by the totals before them
+void ScanHistograms() {
+    uint total = Radix * uint(numSortGroups);
+    uint perThread = (total + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    uint first = min(gl_LocalInvocationIndex * perThread, total);
+    uint last = min(first + perThread, total);
+
+    uint sum = 0;
+    for (uint i = first; i < last; i++) {
+        sum += GroupHistograms[i];
+    }
+    threadTotals[gl_LocalInvocationIndex] = sum;
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        uint running = 0;
+        for (uint t = 0; t < gl_WorkGroupSize.x; t++) {
+            uint count = threadTotals[t];
+            threadTotals[t] = running;
+            running += count;
+        }
+    }
+    barrier();
+
+    uint running = threadTotals[gl_LocalInvocationIndex];
+    for (uint i = first; i < last; i++) {
+        uint count = GroupHistograms[i];
+        GroupHistograms[i] = running;
+        running += count;
+    }
+}
+
+// Each thread moves its run of items in order, after the runs of the threads before it, so the sort is stable
+void Scatter() {
+    uint first = gl_GlobalInvocationID.x * ItemsPerThread;
+    uint counts[Radix];
+    for (uint d = 0; d < Radix; d++) {
+        counts[d] = 0;
+    }
+    for (uint k = 0; k < ItemsPerThread; k++) {
+        counts[Digit(SortKeys[first + k])]++;
+    }
+    for (uint d = 0; d < Radix; d++) {
+        threadDigitOffsets[d][gl_LocalInvocationIndex] = counts[d];
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex < Radix) {
+        uint d = gl_LocalInvocationIndex;
+        uint running = GroupHistograms[d * uint(numSortGroups) + gl_WorkGroupID.x];
+        for (uint t = 0; t < gl_WorkGroupSize.x; t++) {
+            uint count = threadDigitOffsets[d][t];
+            threadDigitOffsets[d][t] = running;
+            running += count;
+        }
+    }
+    barrier();
+
+    for (uint d = 0; d < Radix; d++) {
+        counts[d] = threadDigitOffsets[d][gl_LocalInvocationIndex];
+    }
+    for (uint k = 0; k < ItemsPerThread; k++) {
+        uint key = SortKeys[first + k];
+        uint destination = counts[Digit(key)]++;
+        SortKeysOut[destination] = key;
+        SortValuesOut[destination] = SortValues[first + k];
+    }
+}
+
+void Gather(uint i) {
+    uint source = SortValues[i];
+    if (gatherAttribute == GatherPositions) {
+        ScratchVec4[i] = Positions[source];
+    } else if (gatherAttribute == GatherVelocities) {
+        ScratchVec4[i] = Velocities[source];
+    } else if (gatherAttribute == GatherColors) {
+        ScratchVec4[i] = Colors[source];
+    } else if (gatherAttribute == GatherColorMods) {
+        ScratchVec4[i] = ColorMods[source];
+    } else {
+        ScratchFloat[i] = Lifetimes[source];
+    }
+}
+
+// Dead particles are now all at the end. Exactly one thread sits on the boundary and records how many there are
+void CountDead(uint i) {
+    uint numParticles = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    bool dead = SortKeys[i] == DeadKey;
+    if (dead && (i == 0 || SortKeys[i - 1] != DeadKey)) {
+        NumDead = int(numParticles - i);
+    } else if (!dead && i == numParticles - 1) {
+        NumDead = 0;
+    }
+}
+
+void RebuildDeadList(uint i) {
+    uint numParticles = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    if (i < uint(NumDead)) {
+        DeadList[i] = numParticles - uint(NumDead) + i;
+    }
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+
+    if (computationStage == KeyStage) {
+        ComputeKey(i);
+    } else if (computationStage == HistogramStage) {
+        CountDigits();
+    } else if (computationStage == ScanStage) {
+        ScanHistograms();
+    } else if (computationStage == ScatterStage) {
+        Scatter();
+    } else if (computationStage == GatherStage) {
+        Gather(i);
+    } else if (computationStage == CountDeadStage) {
+        CountDead(i);
+    } else if (computationStage == RebuildDeadListStage) {
+        RebuildDeadList(i);
+    }
+}
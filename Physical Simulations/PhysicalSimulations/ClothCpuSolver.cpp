@@ -0,0 +1,1180 @@
+#include <algorithm>
+#include <cmath>
+#include "ClothCpuSolver.h"
+#include "glad.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Must match clothComputeShader.glsl
+const float GRAVITY_Z = -9.8f;
+const float DRAG_FACTOR = 0.4f;
+const float DAMPING_FACTOR = 0.1f;
+const float EXTRA_RADIUS_FACTOR = 1.01f;
+const float COLLISION_FRICTION = 0.9999f;
+const float CONTACT_SLOP = 1.0001f;
+const float WIND_X = 5.0f;  // The wind's velocity, which is along x
+const float AIR_DENSITY = 0.1f;
+const float WIND_DRAG_COEFFICIENT = 1.0f;
+const float WIND_LIFT_COEFFICIENT = 0.5f;
+
+// XPBD constraint types, in the order the shader projects them
+enum XpbdConstraint { Stretch_Left = 0, Stretch_Down = 1, Bend_Left = 2, Bend_Down = 3 };
+
+// -- Lane packs -- //
+// The kernels below are written once against these. ScalarPack does one strand at a time, AvxPack does 8
+struct ScalarPack {
+    typedef float F;
+    typedef bool M;
+    static const int WIDTH = 1;
+
+    static F Load(const float* p) {
+        return *p;
+    }
+    static void Store(float* p, F v) {
+        *p = v;
+    }
+    static F Set(float v) {
+        return v;
+    }
+    static F Sqrt(F v) {
+        return std::sqrt(v);
+    }
+    static F Select(M m, F a, F b) {
+        return m ? a : b;
+    }
+    static M Less(F a, F b) {
+        return a < b;
+    }
+    static M Greater(F a, F b) {
+        return a > b;
+    }
+    static M Equal(F a, F b) {
+        return a == b;
+    }
+    static M IsFinite(F v) {
+        return v - v == 0;
+    }
+    static M And(M a, M b) {
+        return a && b;
+    }
+    static M Or(M a, M b) {
+        return a || b;
+    }
+    static M All() {
+        return true;
+    }
+    static F StrandIndices(int firstStrand) {
+        return float(firstStrand);
+    }
+};
+
+#ifdef __AVX2__
+struct Vec8 {
+    __m256 v;
+    Vec8() {}
+    Vec8(__m256 v) : v(v) {}
+};
+inline Vec8 operator+(Vec8 a, Vec8 b) {
+    return _mm256_add_ps(a.v, b.v);
+}
+inline Vec8 operator-(Vec8 a, Vec8 b) {
+    return _mm256_sub_ps(a.v, b.v);
+}
+inline Vec8 operator-(Vec8 a) {
+    return _mm256_sub_ps(_mm256_setzero_ps(), a.v);
+}
+inline Vec8 operator*(Vec8 a, Vec8 b) {
+    return _mm256_mul_ps(a.v, b.v);
+}
+inline Vec8 operator/(Vec8 a, Vec8 b) {
+    return _mm256_div_ps(a.v, b.v);
+}
+inline Vec8 operator*(float a, Vec8 b) {
+    return _mm256_mul_ps(_mm256_set1_ps(a), b.v);
+}
+inline Vec8 operator*(Vec8 a, float b) {
+    return _mm256_mul_ps(a.v, _mm256_set1_ps(b));
+}
+inline Vec8& operator+=(Vec8& a, Vec8 b) {
+    return a = a + b;
+}
+inline Vec8& operator-=(Vec8& a, Vec8 b) {
+    return a = a - b;
+}
+
+struct AvxPack {
+    typedef Vec8 F;
+    typedef Vec8 M;  // All bits set in lanes where true
+    static const int WIDTH = 8;
+
+    static F Load(const float* p) {
+        return _mm256_loadu_ps(p);
+    }
+    static void Store(float* p, F v) {
+        _mm256_storeu_ps(p, v.v);
+    }
+    static F Set(float v) {
+        return _mm256_set1_ps(v);
+    }
+    static F Sqrt(F v) {
+        return _mm256_sqrt_ps(v.v);
+    }
+    static F Select(M m, F a, F b) {
+        return _mm256_blendv_ps(b.v, a.v, m.v);
+    }
+    static M Less(F a, F b) {
+        return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);
+    }
+    static M Greater(F a, F b) {
+        return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ);
+    }
+    static M Equal(F a, F b) {
+        return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ);
+    }
+    static M IsFinite(F v) {
+        return _mm256_cmp_ps(_mm256_sub_ps(v.v, v.v), _mm256_setzero_ps(), _CMP_EQ_OQ);
+    }
+    static M And(M a, M b) {
+        return _mm256_and_ps(a.v, b.v);
+    }
+    static M Or(M a, M b) {
+        return _mm256_or_ps(a.v, b.v);
+    }
+    static M All() {
+        return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    }
+    static F StrandIndices(int firstStrand) {
+        return _mm256_add_ps(_mm256_set1_ps(float(firstStrand)), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+};
+typedef AvxPack WidePack;
+#else
+typedef ScalarPack WidePack;
+#endif
+// -- -- //
+
+// -- Kernels -- //
+template <class P>
+struct Vec3P {
+    typename P::F x, y, z;
+};
+
+template <class P>
+inline Vec3P<P> LoadVec3(const float* x, const float* y, const float* z, int i) {
+    return {P::Load(x + i), P::Load(y + i), P::Load(z + i)};
+}
+
+template <class P>
+inline typename P::F Dot(const Vec3P<P>& a, const Vec3P<P>& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <class P>
+inline Vec3P<P> Normalize(const Vec3P<P>& a) {
+    typename P::F length = P::Sqrt(Dot<P>(a, a));
+    return {a.x / length, a.y / length, a.z / length};
+}
+
+template <class P>
+inline Vec3P<P> Cross(const Vec3P<P>& a, const Vec3P<P>& b) {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+// getSpringAcceleration from the shader
+template <class P>
+inline Vec3P<P> SpringAcceleration(const Vec3P<P>& p1, const Vec3P<P>& v1, typename P::F m1, const Vec3P<P>& p2, const Vec3P<P>& v2,
+                                   float rest, float stiffness, float damping) {
+    typedef typename P::F F;
+    Vec3P<P> toOne = {p1.x - p2.x, p1.y - p2.y, p1.z - p2.z};
+    F length = P::Sqrt(Dot<P>(toOne, toOne));
+    auto isZero = P::Equal(length, P::Set(0));
+    toOne = {P::Select(isZero, P::Set(0), toOne.x / length), P::Select(isZero, P::Set(0), toOne.y / length),
+             P::Select(isZero, P::Set(1), toOne.z / length)};
+
+    F dampV1 = Dot<P>(toOne, v1);
+    F dampV2 = Dot<P>(toOne, v2);
+    F force = -stiffness * (length - P::Set(rest)) - damping * (dampV1 - dampV2);
+
+    F scale = 0.5f * force / m1;
+    Vec3P<P> acc = {scale * toOne.x, scale * toOne.y, scale * toOne.z};
+
+    auto valid = P::And(P::And(P::IsFinite(acc.x), P::IsFinite(acc.y)), P::IsFinite(acc.z));
+    return {P::Select(valid, acc.x, P::Set(0)), P::Select(valid, acc.y, P::Set(0)), P::Select(valid, acc.z, P::Set(0))};
+}
+
+// getSpringAccelerationAfter from the shader. The spring's acceleration once the mass has moved on for h with acceleration a
+template <class P>
+inline Vec3P<P> SpringAccelerationAfter(float h, const Vec3P<P>& a, const Vec3P<P>& p1, const Vec3P<P>& v1, typename P::F m1,
+                                        const Vec3P<P>& p2, const Vec3P<P>& v2, float rest, float stiffness, float damping) {
+    Vec3P<P> v = {v1.x + a.x * h, v1.y + a.y * h, v1.z + a.z * h};
+    Vec3P<P> p = {p1.x + v.x * h, p1.y + v.y * h, p1.z + v.z * h};
+    return SpringAcceleration<P>(p, v, m1, p2, v2, rest, stiffness, damping);
+}
+
+// getAccelerationFromSpringConnection from the shader, for whichever scheme it was compiled with
+template <class P>
+inline void AddSpringAcceleration(Vec3P<P>& acc, typename P::M exists, const Vec3P<P>& p1, const Vec3P<P>& v1, typename P::F m1,
+                                  const Vec3P<P>& p2, const Vec3P<P>& v2, float rest, float stiffness, float damping, float dt,
+                                  ExplicitScheme scheme) {
+    Vec3P<P> a = SpringAcceleration<P>(p1, v1, m1, p2, v2, rest, stiffness, damping);
+    if (scheme == Midpoint_Scheme) {
+        a = SpringAccelerationAfter<P>(0.5f * dt, a, p1, v1, m1, p2, v2, rest, stiffness, damping);
+    } else if (scheme == Spring_Rk4_Scheme) {
+        Vec3P<P> a2 = SpringAccelerationAfter<P>(0.5f * dt, a, p1, v1, m1, p2, v2, rest, stiffness, damping);
+        Vec3P<P> a3 = SpringAccelerationAfter<P>(0.5f * dt, a2, p1, v1, m1, p2, v2, rest, stiffness, damping);
+        Vec3P<P> a4 = SpringAccelerationAfter<P>(dt, a3, p1, v1, m1, p2, v2, rest, stiffness, damping);
+        a = {(a.x + 2.0f * a2.x + 2.0f * a3.x + a4.x) * (1 / 6.0f), (a.y + 2.0f * a2.y + 2.0f * a3.y + a4.y) * (1 / 6.0f),
+             (a.z + 2.0f * a2.z + 2.0f * a3.z + a4.z) * (1 / 6.0f)};
+    }
+    acc.x += P::Select(exists, a.x, P::Set(0));
+    acc.y += P::Select(exists, a.y, P::Set(0));
+    acc.z += P::Select(exists, a.z, P::Set(0));
+}
+
+// 'Drag' and extra damping, from CalculateForces in the shader. The wind's forces replace the drag when they're given
+template <class P>
+inline void AddDrag(Vec3P<P>& acc, const Vec3P<P>& n, const Vec3P<P>& v, const float* windX, const float* windY, const float* windZ,
+                    int i) {
+    if (windX) {
+        Vec3P<P> wind = LoadVec3<P>(windX, windY, windZ, i);
+        acc = {acc.x + wind.x, acc.y + wind.y, acc.z + wind.z};
+    } else {
+        typename P::F amt = Dot<P>(n, v);
+        acc = {acc.x + DRAG_FACTOR * (-amt * n.x), acc.y + DRAG_FACTOR * (-amt * n.y), acc.z + DRAG_FACTOR * (-amt * n.z)};
+    }
+    acc = {acc.x - DAMPING_FACTOR * v.x, acc.y - DAMPING_FACTOR * v.y, acc.z - DAMPING_FACTOR * v.z};
+}
+
+// WindAt from the shader
+Vec3P<ScalarPack> WindAt(const Vec3P<ScalarPack>& p, float t, WindMode mode) {
+    if (mode != Gusty_Wind) return {WIND_X, 0, 0};
+    float gust = 1.0f + 0.6f * std::sin(1.3f * t - 0.25f * p.x) * std::sin(0.7f * t + 0.2f * p.y);
+    return {gust * WIND_X, 1.5f * std::sin(0.9f * t + 0.3f * p.z), 1.5f * 0.5f * std::cos(1.1f * t + 0.3f * p.y)};
+}
+
+// AerodynamicForce from the shader
+Vec3P<ScalarPack> AerodynamicForce(const Vec3P<ScalarPack>& areaNormal, const Vec3P<ScalarPack>& relativeWind) {
+    float area = std::sqrt(Dot<ScalarPack>(areaNormal, areaNormal));
+    float speed = std::sqrt(Dot<ScalarPack>(relativeWind, relativeWind));
+    if (area == 0 || speed == 0) return {0, 0, 0};
+
+    Vec3P<ScalarPack> n = {areaNormal.x / area, areaNormal.y / area, areaNormal.z / area};
+    Vec3P<ScalarPack> along = {relativeWind.x / speed, relativeWind.y / speed, relativeWind.z / speed};
+    float facing = Dot<ScalarPack>(n, along);
+    if (facing < 0) {
+        n = {-n.x, -n.y, -n.z};
+        facing = -facing;
+    }
+    Vec3P<ScalarPack> across = {n.x - facing * along.x, n.y - facing * along.y, n.z - facing * along.z};
+    float pressure = 0.5f * AIR_DENSITY * speed * speed * area * facing;
+    return {pressure * (WIND_DRAG_COEFFICIENT * along.x + WIND_LIFT_COEFFICIENT * across.x),
+            pressure * (WIND_DRAG_COEFFICIENT * along.y + WIND_LIFT_COEFFICIENT * across.y),
+            pressure * (WIND_DRAG_COEFFICIENT * along.z + WIND_LIFT_COEFFICIENT * across.z)};
+}
+// -- -- //
+
+void ClothCpuSolver::paddedArray::Resize(int n) {
+    storage.assign(n + 2 * SIMD_WIDTH, 0.f);
+    data = storage.data() + SIMD_WIDTH;
+}
+
+SpinBarrier::SpinBarrier(int numThreads) : numThreads(numThreads), waiting(0), generation(0) {}
+
+void SpinBarrier::Wait() {
+    int currentGeneration = generation.load(std::memory_order_acquire);
+    if (waiting.fetch_add(1, std::memory_order_acq_rel) == numThreads - 1) {
+        waiting.store(0, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+
+    int spins = 0;
+    while (generation.load(std::memory_order_acquire) == currentGeneration) {
+        if (++spins > 4096) std::this_thread::yield();  // Don't starve whoever we're waiting on if there are more workers than cores
+    }
+}
+
+int NumCpuWorkers(int numBlocks) {
+    int hardwareThreads = int(std::thread::hardware_concurrency());
+    return std::max(1, std::min(hardwareThreads, numBlocks));
+}
+
+// A mesh or a batch is laid out as one-mass strands, so the strand-minor order is just the GPU's order
+clothShape CurrentClothShape() {
+    bool isMesh = ClothManager::topology != Grid_Topology;
+    int strands = isMesh ? ClothManager::NumMasses() : ClothManager::numThreads;
+    int stride = (strands + ClothCpuSolver::SIMD_WIDTH - 1) / ClothCpuSolver::SIMD_WIDTH * ClothCpuSolver::SIMD_WIDTH;
+    return {strands, stride, isMesh ? 1 : ClothManager::massesPerThread, isMesh};
+}
+
+ClothCpuSolver::ClothCpuSolver()
+    : shape(CurrentClothShape()), numBlocks(shape.stride / SIMD_WIDTH), numWorkers(NumCpuWorkers(numBlocks)), barrier(numWorkers) {
+    paddedArray* arrays[] = {&px, &py, &pz, &vx, &vy, &vz, &nx, &ny, &nz, &ax, &ay, &az, &mass, &isFixed, &lastX, &lastY, &lastZ,
+                             &lambdas[0], &lambdas[1], &lambdas[2], &lambdas[3], &pushX, &pushY, &pushZ, &slowX, &slowY, &slowZ,
+                             &windX,      &windY,      &windZ};
+    for (paddedArray* array : arrays) {
+        array->Resize(shape.stride * shape.massesPerStrand);
+    }
+
+    // Padding strands stay pinned where they are. Download fills in the real masses
+    std::fill(isFixed.storage.begin(), isFixed.storage.end(), 1.f);
+    std::fill(mass.storage.begin(), mass.storage.end(), 1.f);
+
+    int numCells = shape.stride * shape.massesPerStrand;
+    tetherAnchors.assign(numCells, -1);
+    tetherLengths.assign(numCells, 0);
+    for (int g = 0; g < ClothManager::NumMasses(); g++) {
+        const tether& massTether = ClothManager::massTethers[g];
+        if (massTether.anchor == BAD_INDEX) continue;
+        tetherAnchors[CpuIndex(g)] = CpuIndex(massTether.anchor);
+        tetherLengths[CpuIndex(g)] = massTether.length;
+    }
+
+    const std::vector<GLuint>& corners = ClothManager::massTriangles.corners;
+    triangleCorners.resize(corners.size());
+    for (size_t c = 0; c < corners.size(); c++) {
+        triangleCorners[c] = CpuIndex(corners[c]);
+    }
+    triangleForces.assign(corners.size(), 0);  // Three corners' worth of force per triangle is three floats
+
+    massCells.assign(numCells, -1);
+    cellStarts.assign(numCells + 1, 0);
+    cellMasses.assign(numCells, 0);
+
+    // The calling thread is worker 0
+    for (int w = 1; w < numWorkers; w++) {
+        workers.emplace_back(&ClothCpuSolver::WorkerLoop, this, w);
+    }
+    printf("CPU cloth solver using %d threads, %s\n", numWorkers, WidePack::WIDTH > 1 ? "AVX2" : "scalar");
+}
+
+ClothCpuSolver::~ClothCpuSolver() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        quit = true;
+    }
+    frameStart.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ClothCpuSolver::CpuIndex(int gpuIndex) const {
+    int strand = gpuIndex / shape.massesPerStrand;
+    int massAlongStrand = gpuIndex % shape.massesPerStrand;
+    return massAlongStrand * shape.stride + strand;
+}
+
+int ClothCpuSolver::GpuIndex(int cpuIndex) const {
+    return (cpuIndex % shape.stride) * shape.massesPerStrand + cpuIndex / shape.stride;
+}
+
+void ClothCpuSolver::Download() {
+    std::vector<position> positions(ClothManager::NumMasses());
+    std::vector<velocity> velocities(ClothManager::NumMasses());
+    std::vector<normal> normals(ClothManager::NumMasses());
+    std::vector<massParams> masses(ClothManager::NumMasses());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::posSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(position), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::velSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, velocities.size() * sizeof(velocity), velocities.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::normSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, normals.size() * sizeof(normal), normals.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::massSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, masses.size() * sizeof(massParams), masses.data());
+
+    for (int g = 0; g < ClothManager::NumMasses(); g++) {
+        int c = CpuIndex(g);
+        px.data[c] = positions[g].x, py.data[c] = positions[g].y, pz.data[c] = positions[g].z;
+        vx.data[c] = velocities[g].vx, vy.data[c] = velocities[g].vy, vz.data[c] = velocities[g].vz;
+        nx.data[c] = normals[g].nx, ny.data[c] = normals[g].ny, nz.data[c] = normals[g].nz;
+        mass.data[c] = masses[g].mass;
+        isFixed.data[c] = masses[g].isFixed ? 1.f : 0.f;
+    }
+}
+
+void ClothCpuSolver::Upload(bool includeVelocities) {
+    std::vector<position> positions(ClothManager::NumMasses());
+    std::vector<normal> normals(ClothManager::NumMasses());
+    for (int g = 0; g < ClothManager::NumMasses(); g++) {
+        int c = CpuIndex(g);
+        positions[g] = {px.data[c], py.data[c], pz.data[c], 1.f};
+        normals[g] = {nx.data[c], ny.data[c], nz.data[c], 0.f};
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::posSSbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(position), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::normSSbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, normals.size() * sizeof(normal), normals.data());
+
+    if (includeVelocities) {
+        std::vector<velocity> velocities(ClothManager::NumMasses());
+        for (int g = 0; g < ClothManager::NumMasses(); g++) {
+            int c = CpuIndex(g);
+            velocities[g] = {vx.data[c], vy.data[c], vz.data[c], 0.f};
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::velSSbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, velocities.size() * sizeof(velocity), velocities.data());
+    }
+}
+
+float ClothCpuSolver::MaxDifferenceFromGPU(float* rmsDifference) {
+    std::vector<position> positions(ClothManager::NumMasses());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ClothManager::posSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(position), positions.data());
+
+    float maxDifference = 0;
+    double squaredSum = 0;
+    for (int g = 0; g < ClothManager::NumMasses(); g++) {
+        int c = CpuIndex(g);
+        float dx = positions[g].x - px.data[c], dy = positions[g].y - py.data[c], dz = positions[g].z - pz.data[c];
+        float squared = dx * dx + dy * dy + dz * dz;
+        maxDifference = std::max(maxDifference, std::sqrt(squared));
+        squaredSum += squared;
+    }
+
+    if (rmsDifference) *rmsDifference = float(std::sqrt(squaredSum / ClothManager::NumMasses()));
+    return maxDifference;
+}
+
+void ClothCpuSolver::Step(const simParams& params, int substeps, ExplicitScheme scheme, WindMode wind, float windTime) {
+    stepParams = params;
+    stepSubsteps = substeps;
+    stepScheme = scheme;
+    stepWind = wind;
+    stepWindTime = windTime;
+    stepIsXpbd = false;
+    StartFrame();
+}
+
+void ClothCpuSolver::StepXpbd(const simParams& params, float timestep, int iterations) {
+    stepParams = params;
+    xpbdTimestep = timestep;
+    xpbdIterations = iterations;
+    stepIsXpbd = true;
+    StartFrame();
+}
+
+// Wakes the workers, does worker 0's share, and waits for the rest
+void ClothCpuSolver::StartFrame() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        frameGeneration++;
+        workersDone = 0;
+    }
+    frameStart.notify_all();
+
+    RunFrame(0);
+
+    std::unique_lock<std::mutex> lock(frameMutex);
+    frameDone.wait(lock, [this]() { return workersDone == numWorkers - 1; });
+}
+
+void ClothCpuSolver::RunFrame(int worker) {
+    if (stepIsXpbd) {
+        RunXpbd(worker);
+    } else {
+        RunSubsteps(worker);
+    }
+}
+
+void ClothCpuSolver::WorkerLoop(int worker) {
+    int seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(frameMutex);
+            frameStart.wait(lock, [&]() { return quit || frameGeneration != seenGeneration; });
+            if (quit) return;
+            seenGeneration = frameGeneration;
+        }
+
+        RunFrame(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            workersDone++;
+        }
+        frameDone.notify_one();
+    }
+}
+
+// Normals are computed at the start of each substep instead of the end of the last one. They only read positions, so a worker can
+// compute its own and go straight into forces, saving a barrier
+void ClothCpuSolver::RunSubsteps(int worker) {
+    int firstBlock = numBlocks * worker / numWorkers;
+    int endBlock = numBlocks * (worker + 1) / numWorkers;
+
+    if (shape.isMesh) {
+        RunMeshSubsteps(worker, std::min(firstBlock * SIMD_WIDTH, shape.strands), std::min(endBlock * SIMD_WIDTH, shape.strands));
+        return;
+    }
+
+    StartVerlet(firstBlock * SIMD_WIDTH, endBlock * SIMD_WIDTH);
+    for (int step = 0; step < stepSubsteps; step++) {
+        if (stepWind != Normal_Drag) {  // Triangles cross workers, so they all have to be done before anyone gathers
+            ComputeWindForces(worker, step);
+            barrier.Wait();
+            GatherWind(firstBlock * SIMD_WIDTH, endBlock * SIMD_WIDTH);
+        }
+        ComputeNormals(firstBlock, endBlock);
+        ComputeForces(firstBlock, endBlock);
+        barrier.Wait();
+
+        Integrate(firstBlock, endBlock, step);
+        barrier.Wait();
+
+        if ((step + 1) % ClothManager::SELF_COLLISION_INTERVAL == 0) SelfCollide(worker);
+    }
+    ComputeNormals(firstBlock, endBlock);  // For rendering
+}
+
+template <class P>
+void ComputeForcesAt(int j, int s, const clothShape& shape, const simParams& params, const float* px, const float* py, const float* pz,
+                     const float* vx, const float* vy, const float* vz, const float* nx, const float* ny, const float* nz,
+                     const float* mass, const float* windX, const float* windY, const float* windZ, float* ax, float* ay, float* az,
+                     ExplicitScheme scheme) {
+    typedef typename P::F F;
+    int i = j * shape.stride + s;
+    Vec3P<P> p1 = LoadVec3<P>(px, py, pz, i);
+    Vec3P<P> v1 = LoadVec3<P>(vx, vy, vz, i);
+    F m1 = P::Load(mass + i);
+
+    Vec3P<P> acc = {P::Set(0), P::Set(0), P::Set(GRAVITY_Z)};
+
+    // A grid's springs of each type all have the same parameters, so the stencil stands in for its CSR adjacency and keeps the loads
+    // contiguous. Neighbouring strands are neighbouring lanes. Whether a spring exists along the strand is the same for the whole row
+    F strands = P::StrandIndices(s);
+    for (const gridSpring& spring : ClothManager::GRID_SPRINGS) {
+        int along = j + spring.masses;
+        if (along < 0 || along >= shape.massesPerStrand) continue;
+        auto exists = spring.strands > 0   ? P::Less(strands, P::Set(float(shape.strands - spring.strands)))
+                      : spring.strands < 0 ? P::Greater(strands, P::Set(float(-spring.strands - 1)))
+                                           : P::All();
+
+        int other = i + spring.masses * shape.stride + spring.strands;
+        float factor = ClothManager::StiffnessFactor(spring.type);
+        float span = std::sqrt(float(spring.strands * spring.strands + spring.masses * spring.masses));
+        AddSpringAcceleration<P>(acc, exists, p1, v1, m1, LoadVec3<P>(px, py, pz, other), LoadVec3<P>(vx, vy, vz, other),
+                                 span * params.restLength, factor * params.ks, factor * params.kd, params.dt, scheme);
+    }
+
+    AddDrag<P>(acc, LoadVec3<P>(nx, ny, nz, i), v1, windX, windY, windZ, i);
+
+    P::Store(ax + i, acc.x);
+    P::Store(ay + i, acc.y);
+    P::Store(az + i, acc.z);
+}
+
+// The gravity center over one substep. It moves in a straight line over the frame, from where it was at the end of the last one
+struct sweptSphere {
+    float fromX, fromY, fromZ;  // Center at the start of the substep
+    float toX, toY, toZ;        // and at the end
+    float velX, velY, velZ;
+    float radius;
+};
+
+// ObstacleCenterAfter in the shader, for both ends of the substep
+sweptSphere SphereDuringSubstep(const simParams& params, int substep, int substeps, float dt) {
+    float from = float(substep) / substeps, to = float(substep + 1) / substeps;
+    auto along = [](float last, float current, float t) { return last + (current - last) * t; };
+
+    sweptSphere sphere;
+    sphere.fromX = along(params.lastObstacleCenterX, params.obstacleCenterX, from);
+    sphere.fromY = along(params.lastObstacleCenterY, params.obstacleCenterY, from);
+    sphere.fromZ = along(params.lastObstacleCenterZ, params.obstacleCenterZ, from);
+    sphere.toX = along(params.lastObstacleCenterX, params.obstacleCenterX, to);
+    sphere.toY = along(params.lastObstacleCenterY, params.obstacleCenterY, to);
+    sphere.toZ = along(params.lastObstacleCenterZ, params.obstacleCenterZ, to);
+    float inverseDt = dt > 0 ? 1 / dt : 0;
+    sphere.velX = (sphere.toX - sphere.fromX) * inverseDt;
+    sphere.velY = (sphere.toY - sphere.fromY) * inverseDt;
+    sphere.velZ = (sphere.toZ - sphere.fromZ) * inverseDt;
+    sphere.radius = params.obstacleRadius * EXTRA_RADIUS_FACTOR;
+    return sphere;
+}
+
+// CollideWithSphere from the shader. Relative to the sphere, the mass moves in a straight line from start to p, so one the sphere went
+// right over during the substep is caught on the side it was hit from
+template <class P>
+inline void CollideWithSphere(const Vec3P<P>& start, Vec3P<P>& p, Vec3P<P>& v, const sweptSphere& sphere) {
+    typedef typename P::F F;
+    Vec3P<P> begin = {start.x - P::Set(sphere.fromX), start.y - P::Set(sphere.fromY), start.z - P::Set(sphere.fromZ)};
+    Vec3P<P> end = {p.x - P::Set(sphere.toX), p.y - P::Set(sphere.toY), p.z - P::Set(sphere.toZ)};
+    Vec3P<P> travel = {end.x - begin.x, end.y - begin.y, end.z - begin.z};
+
+    F a = Dot<P>(travel, travel), b = Dot<P>(begin, travel), c = Dot<P>(begin, begin) - P::Set(sphere.radius * sphere.radius);
+    F discriminant = b * b - a * c;
+    auto crossed = P::And(P::And(P::Greater(c, P::Set(0)), P::Less(b, P::Set(0))), P::Greater(discriminant, P::Set(0)));
+    F t = (-b - P::Sqrt(P::Select(crossed, discriminant, P::Set(0)))) / a;
+    crossed = P::And(crossed, P::Less(t, P::Set(1)));
+    auto hit = P::Or(crossed, P::Less(Dot<P>(end, end), P::Set(sphere.radius * sphere.radius)));
+
+    Vec3P<P> n = Normalize<P>({P::Select(crossed, begin.x + travel.x * t, end.x), P::Select(crossed, begin.y + travel.y * t, end.y),
+                               P::Select(crossed, begin.z + travel.z * t, end.z)});
+    F towardCenter = (v.x - P::Set(sphere.velX)) * n.x + (v.y - P::Set(sphere.velY)) * n.y + (v.z - P::Set(sphere.velZ)) * n.z;
+    p = {P::Select(hit, P::Set(sphere.toX) + n.x * sphere.radius, p.x), P::Select(hit, P::Set(sphere.toY) + n.y * sphere.radius, p.y),
+         P::Select(hit, P::Set(sphere.toZ) + n.z * sphere.radius, p.z)};
+    v = {P::Select(hit, (v.x - towardCenter * n.x) * COLLISION_FRICTION, v.x),
+         P::Select(hit, (v.y - towardCenter * n.y) * COLLISION_FRICTION, v.y),
+         P::Select(hit, (v.z - towardCenter * n.z) * COLLISION_FRICTION, v.z)};
+}
+
+// IntegrateForces, the sphere from ExecuteCollisions and RestartVerletIfMoved from the shader
+template <class P>
+void IntegrateAt(int i, const simParams& params, const sweptSphere& sphere, ExplicitScheme scheme, float* px, float* py, float* pz,
+                 float* vx, float* vy, float* vz, float* lastX, float* lastY, float* lastZ, const float* ax, const float* ay,
+                 const float* az, const float* isFixed) {
+    Vec3P<P> start = LoadVec3<P>(px, py, pz, i);
+    Vec3P<P> v = LoadVec3<P>(vx, vy, vz, i);
+    Vec3P<P> a = LoadVec3<P>(ax, ay, az, i);
+    auto fixed = P::Greater(P::Load(isFixed + i), P::Set(0));
+
+    Vec3P<P> newV, newP;
+    if (scheme == Verlet_Scheme) {
+        Vec3P<P> last = LoadVec3<P>(lastX, lastY, lastZ, i);
+        float dtSquared = params.dt * params.dt;
+        newP = {2.0f * start.x - last.x + a.x * dtSquared, 2.0f * start.y - last.y + a.y * dtSquared,
+                2.0f * start.z - last.z + a.z * dtSquared};
+        newV = v;
+        if (params.dt > 0) {  // Paused frames step by nothing
+            float inverseTwoDt = 1 / (2 * params.dt);
+            newV = {(newP.x - last.x) * inverseTwoDt, (newP.y - last.y) * inverseTwoDt, (newP.z - last.z) * inverseTwoDt};
+        }
+    } else {
+        newV = {v.x + a.x * params.dt, v.y + a.y * params.dt, v.z + a.z * params.dt};
+        newP = {start.x + newV.x * params.dt, start.y + newV.y * params.dt, start.z + newV.z * params.dt};
+    }
+    v = {P::Select(fixed, P::Set(0), newV.x), P::Select(fixed, P::Set(0), newV.y), P::Select(fixed, P::Set(0), newV.z)};
+    Vec3P<P> p = {P::Select(fixed, start.x, newP.x), P::Select(fixed, start.y, newP.y), P::Select(fixed, start.z, newP.z)};
+    Vec3P<P> integrated = p;
+
+    CollideWithSphere<P>(start, p, v, sphere);
+
+    P::Store(px + i, p.x), P::Store(py + i, p.y), P::Store(pz + i, p.z);
+    P::Store(vx + i, v.x), P::Store(vy + i, v.y), P::Store(vz + i, v.z);
+    if (scheme != Verlet_Scheme) return;
+    auto unmoved = P::And(P::And(P::Equal(p.x, integrated.x), P::Equal(p.y, integrated.y)), P::Equal(p.z, integrated.z));
+    P::Store(lastX + i, P::Select(unmoved, start.x, p.x - v.x * params.dt));
+    P::Store(lastY + i, P::Select(unmoved, start.y, p.y - v.y * params.dt));
+    P::Store(lastZ + i, P::Select(unmoved, start.z, p.z - v.z * params.dt));
+}
+
+// Same neighbour preference as the shader: (left, up), (up, right), (right, down), then (down, left)
+template <class P>
+void ComputeNormalsAt(int j, int s, const clothShape& shape, const float* px, const float* py, const float* pz, float* nx, float* ny,
+                      float* nz) {
+    int i = j * shape.stride + s;
+    Vec3P<P> p = LoadVec3<P>(px, py, pz, i);
+    auto normalFrom = [&](int first, int second) {
+        Vec3P<P> toFirst = Normalize<P>({P::Load(px + first) - p.x, P::Load(py + first) - p.y, P::Load(pz + first) - p.z});
+        Vec3P<P> toSecond = Normalize<P>({P::Load(px + second) - p.x, P::Load(py + second) - p.y, P::Load(pz + second) - p.z});
+        return Normalize<P>(Cross<P>(toFirst, toSecond));
+    };
+
+    typename P::F strands = P::StrandIndices(s);
+    Vec3P<P> preferred, fallback;
+    typename P::M usePreferred;
+    if (j > 0) {
+        preferred = normalFrom(i + 1, i - shape.stride);   // left, up
+        fallback = normalFrom(i - shape.stride, i - 1);    // up, right
+        usePreferred = P::Less(strands, P::Set(shape.strands - 1));
+    } else {
+        preferred = normalFrom(i - 1, i + shape.stride);  // right, down
+        fallback = normalFrom(i + shape.stride, i + 1);   // down, left
+        usePreferred = P::Greater(strands, P::Set(0));
+    }
+
+    P::Store(nx + i, P::Select(usePreferred, preferred.x, fallback.x));
+    P::Store(ny + i, P::Select(usePreferred, preferred.y, fallback.y));
+    P::Store(nz + i, P::Select(usePreferred, preferred.z, fallback.z));
+}
+
+void ClothCpuSolver::ComputeForces(int firstBlock, int endBlock) {
+    bool windy = stepWind != Normal_Drag;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstBlock * SIMD_WIDTH; s < endBlock * SIMD_WIDTH; s += WidePack::WIDTH) {
+            ComputeForcesAt<WidePack>(j, s, shape, stepParams, px.data, py.data, pz.data, vx.data, vy.data, vz.data, nx.data, ny.data,
+                                      nz.data, mass.data, windy ? windX.data : nullptr, windY.data, windZ.data, ax.data, ay.data,
+                                      az.data, stepScheme);
+        }
+    }
+}
+
+// ComputeWindForce from the shader, for the worker's share of the triangles
+void ClothCpuSolver::ComputeWindForces(int worker, int substep) {
+    typedef Vec3P<ScalarPack> V;
+    int numTriangles = int(triangleCorners.size()) / 3;
+    float time = stepWindTime + substep * stepParams.dt;
+    for (int t = numTriangles * worker / numWorkers; t < numTriangles * (worker + 1) / numWorkers; t++) {
+        int a = triangleCorners[3 * t], b = triangleCorners[3 * t + 1], c = triangleCorners[3 * t + 2];
+        V pa = LoadVec3<ScalarPack>(px.data, py.data, pz.data, a);
+        V pb = LoadVec3<ScalarPack>(px.data, py.data, pz.data, b);
+        V pc = LoadVec3<ScalarPack>(px.data, py.data, pz.data, c);
+        V center = {(pa.x + pb.x + pc.x) / 3, (pa.y + pb.y + pc.y) / 3, (pa.z + pb.z + pc.z) / 3};
+        V velocity = {(vx.data[a] + vx.data[b] + vx.data[c]) / 3, (vy.data[a] + vy.data[b] + vy.data[c]) / 3,
+                      (vz.data[a] + vz.data[b] + vz.data[c]) / 3};
+        V face = Cross<ScalarPack>({pb.x - pa.x, pb.y - pa.y, pb.z - pa.z}, {pc.x - pa.x, pc.y - pa.y, pc.z - pa.z});
+        V wind = WindAt(center, time, stepWind);
+        V force = AerodynamicForce({0.5f * face.x, 0.5f * face.y, 0.5f * face.z},
+                                   {wind.x - velocity.x, wind.y - velocity.y, wind.z - velocity.z});
+        triangleForces[3 * t] = force.x / 3, triangleForces[3 * t + 1] = force.y / 3, triangleForces[3 * t + 2] = force.z / 3;
+    }
+}
+
+// The gather half of the shader's CalculateForces, for every real mass the worker owns
+void ClothCpuSolver::GatherWind(int firstStrand, int endStrand) {
+    const triangleAdjacency& triangles = ClothManager::massTriangles;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < std::min(endStrand, shape.strands); s++) {
+            int i = j * shape.stride + s, g = GpuIndex(i);
+            float accX = 0, accY = 0, accZ = 0;
+            for (GLuint t = triangles.offsets[g]; t < triangles.offsets[g + 1]; t++) {
+                const float* force = &triangleForces[3 * triangles.triangles[t]];
+                accX += force[0] / mass.data[i], accY += force[1] / mass.data[i], accZ += force[2] / mass.data[i];
+            }
+            windX.data[i] = accX, windY.data[i] = accY, windZ.data[i] = accZ;
+        }
+    }
+}
+
+void ClothCpuSolver::Integrate(int firstBlock, int endBlock, int substep) {
+    sweptSphere sphere = SphereDuringSubstep(stepParams, substep, stepSubsteps, stepParams.dt);
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstBlock * SIMD_WIDTH; s < endBlock * SIMD_WIDTH; s += WidePack::WIDTH) {
+            IntegrateAt<WidePack>(j * shape.stride + s, stepParams, sphere, stepScheme, px.data, py.data, pz.data, vx.data, vy.data,
+                                  vz.data, lastX.data, lastY.data, lastZ.data, ax.data, ay.data, az.data, isFixed.data);
+        }
+    }
+    ApplyTethers(firstBlock * SIMD_WIDTH, endBlock * SIMD_WIDTH, true);
+    CollideWithObstacles(firstBlock * SIMD_WIDTH, endBlock * SIMD_WIDTH, true);
+}
+
+// StartVerlet from the shader, for every mass the worker owns. Only the Verlet scheme keeps the last positions
+void ClothCpuSolver::StartVerlet(int firstStrand, int endStrand) {
+    if (stepScheme != Verlet_Scheme) return;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            RestartVerlet(j * shape.stride + s);
+        }
+    }
+}
+
+// The shader only restarts a mass once everything's done moving it. Restarting it after each move lands in the same place
+void ClothCpuSolver::RestartVerlet(int i) {
+    if (stepScheme != Verlet_Scheme || stepIsXpbd) return;
+    lastX.data[i] = px.data[i] - vx.data[i] * stepParams.dt;
+    lastY.data[i] = py.data[i] - vy.data[i] * stepParams.dt;
+    lastZ.data[i] = pz.data[i] - vz.data[i] * stepParams.dt;
+}
+
+// ApplyTether from the shader. A grid mass' anchor is the first mass of its own strand, so the same worker's already moved it
+void ClothCpuSolver::ApplyTethers(int firstStrand, int endStrand, bool keepVelocities) {
+    if (stepParams.tetherStretch == 0) return;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            int anchor = tetherAnchors[i];
+            if (isFixed.data[i] > 0 || anchor < 0) continue;
+            glm::vec3 position(px.data[i], py.data[i], pz.data[i]);
+            glm::vec3 fromAnchor = position - glm::vec3(px.data[anchor], py.data[anchor], pz.data[anchor]);
+            float reach = glm::length(fromAnchor);
+            float longest = stepParams.tetherStretch * tetherLengths[i];
+            if (reach <= longest) continue;
+
+            glm::vec3 outward = fromAnchor / reach;
+            position -= (reach - longest) * outward;
+            px.data[i] = position.x, py.data[i] = position.y, pz.data[i] = position.z;
+            if (!keepVelocities) continue;
+            glm::vec3 velocity(vx.data[i], vy.data[i], vz.data[i]);
+            velocity -= std::max(glm::dot(velocity, outward), 0.0f) * outward;
+            vx.data[i] = velocity.x, vy.data[i] = velocity.y, vz.data[i] = velocity.z;
+            RestartVerlet(i);
+        }
+    }
+}
+
+// Mesh obstacles are one mass at a time, since every mass takes its own path through the tree. XPBD gets its velocities from how far the
+// masses moved, so it only wants the positions
+void ClothCpuSolver::CollideWithObstacles(int firstStrand, int endStrand, bool keepVelocities) {
+    const ObstacleBvh& obstacles = ClothManager::obstacles;
+    if (obstacles.NumObstacles() == 0) return;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            if (isFixed.data[i] > 0) continue;
+            glm::vec3 position(px.data[i], py.data[i], pz.data[i]), velocity(vx.data[i], vy.data[i], vz.data[i]);
+            glm::vec3 before = position;
+            obstacles.Collide(position, velocity);
+            px.data[i] = position.x, py.data[i] = position.y, pz.data[i] = position.z;
+            if (!keepVelocities) continue;
+            vx.data[i] = velocity.x, vy.data[i] = velocity.y, vz.data[i] = velocity.z;
+            if (position != before) RestartVerlet(i);
+        }
+    }
+}
+
+void ClothCpuSolver::ComputeNormals(int firstBlock, int endBlock) {
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstBlock * SIMD_WIDTH; s < endBlock * SIMD_WIDTH; s += WidePack::WIDTH) {
+            ComputeNormalsAt<WidePack>(j, s, shape, px.data, py.data, pz.data, nx.data, ny.data, nz.data);
+        }
+    }
+}
+
+// Springs can go anywhere, so forces and normals are one mass at a time through the CSR adjacency. Integration doesn't care
+void ClothCpuSolver::RunMeshSubsteps(int worker, int firstMass, int endMass) {
+    StartVerlet(firstMass, endMass);
+    for (int step = 0; step < stepSubsteps; step++) {
+        if (stepWind != Normal_Drag) {
+            ComputeWindForces(worker, step);
+            barrier.Wait();
+            GatherWind(firstMass, endMass);
+        }
+        ComputeMeshNormals(firstMass, endMass);
+        ComputeMeshForces(firstMass, endMass);
+        barrier.Wait();
+
+        sweptSphere sphere = SphereDuringSubstep(stepParams, step, stepSubsteps, stepParams.dt);
+        for (int i = firstMass; i < endMass; i++) {
+            IntegrateAt<ScalarPack>(i, stepParams, sphere, stepScheme, px.data, py.data, pz.data, vx.data, vy.data, vz.data, lastX.data,
+                                    lastY.data, lastZ.data, ax.data, ay.data, az.data, isFixed.data);
+        }
+        if (stepParams.tetherStretch > 0) {  // A mesh mass' anchor can be any other worker's, so they all have to be done moving it
+            barrier.Wait();
+            ApplyTethers(firstMass, endMass, true);
+        }
+        CollideWithObstacles(firstMass, endMass, true);
+        barrier.Wait();
+
+        if ((step + 1) % ClothManager::SELF_COLLISION_INTERVAL == 0) SelfCollide(worker);
+    }
+    ComputeMeshNormals(firstMass, endMass);
+}
+
+void ClothCpuSolver::ComputeMeshForces(int firstMass, int endMass) {
+    typedef ScalarPack P;
+    const springAdjacency& springs = ClothManager::springs;
+    for (int i = firstMass; i < endMass; i++) {
+        Vec3P<P> p1 = LoadVec3<P>(px.data, py.data, pz.data, i);
+        Vec3P<P> v1 = LoadVec3<P>(vx.data, vy.data, vz.data, i);
+        Vec3P<P> acc = {0, 0, GRAVITY_Z};
+        for (GLuint s = springs.offsets[i]; s < springs.offsets[i + 1]; s++) {
+            int other = springs.neighbours[s];
+            AddSpringAcceleration<P>(acc, P::All(), p1, v1, mass.data[i], LoadVec3<P>(px.data, py.data, pz.data, other),
+                                     LoadVec3<P>(vx.data, vy.data, vz.data, other), springs.restLengths[s], springs.stiffnesses[s],
+                                     springs.dampings[s], stepParams.dt, stepScheme);
+        }
+
+        bool windy = stepWind != Normal_Drag;
+        AddDrag<P>(acc, LoadVec3<P>(nx.data, ny.data, nz.data, i), v1, windy ? windX.data : nullptr, windY.data, windZ.data, i);
+        ax.data[i] = acc.x, ay.data[i] = acc.y, az.data[i] = acc.z;
+    }
+}
+
+// ComputeMeshNormals from the shader
+void ClothCpuSolver::ComputeMeshNormals(int firstMass, int endMass) {
+    const springAdjacency& springs = ClothManager::springs;
+    for (int i = firstMass; i < endMass; i++) {
+        Vec3P<ScalarPack> p = LoadVec3<ScalarPack>(px.data, py.data, pz.data, i);
+        Vec3P<ScalarPack> normal = {0, 0, 0};
+        for (GLuint s = springs.offsets[i]; s < springs.offsets[i + 1]; s++) {
+            if (springs.oppositeMasses[s] == BAD_INDEX) continue;
+            Vec3P<ScalarPack> neighbour = LoadVec3<ScalarPack>(px.data, py.data, pz.data, springs.neighbours[s]);
+            Vec3P<ScalarPack> opposite = LoadVec3<ScalarPack>(px.data, py.data, pz.data, springs.oppositeMasses[s]);
+            Vec3P<ScalarPack> face = Cross<ScalarPack>({neighbour.x - p.x, neighbour.y - p.y, neighbour.z - p.z},
+                                                       {opposite.x - p.x, opposite.y - p.y, opposite.z - p.z});
+            normal = {normal.x + face.x, normal.y + face.y, normal.z + face.z};
+        }
+
+        float length = std::sqrt(Dot<ScalarPack>(normal, normal));
+        float scale = length > 0 ? 1 / length : 0;
+        nx.data[i] = normal.x * scale, ny.data[i] = normal.y * scale, nz.data[i] = normal.z * scale;
+    }
+}
+
+// -- XPBD -- //
+// Mirrors the shader's colors. Constraints along a strand never leave a worker, so both of their colors run back to back without a
+// barrier between them. Constraints across strands can reach into the next worker's strands, so every other phase is followed by one
+void ClothCpuSolver::RunXpbd(int worker) {
+    int firstStrand = numBlocks * worker / numWorkers * SIMD_WIDTH;
+    int endStrand = numBlocks * (worker + 1) / numWorkers * SIMD_WIDTH;
+
+    XpbdPredict(firstStrand, endStrand);
+    barrier.Wait();
+
+    for (int iteration = 0; iteration < xpbdIterations; iteration++) {
+        for (int parity = 0; parity < 2; parity++) {
+            XpbdProjectAcrossStrands(firstStrand, endStrand, Stretch_Left, parity);
+            barrier.Wait();
+        }
+        XpbdProjectAlongStrands(firstStrand, endStrand, Stretch_Down);
+        barrier.Wait();
+        for (int parity = 0; parity < 2; parity++) {
+            XpbdProjectAcrossStrands(firstStrand, endStrand, Bend_Left, parity);
+            barrier.Wait();
+        }
+        XpbdProjectAlongStrands(firstStrand, endStrand, Bend_Down);
+        XpbdProjectCollisions(firstStrand, endStrand);
+        barrier.Wait();
+    }
+
+    XpbdUpdateVelocities(firstStrand, endStrand);
+    SelfCollide(worker);
+    ComputeNormals(firstStrand / SIMD_WIDTH, endStrand / SIMD_WIDTH);
+}
+
+void ClothCpuSolver::XpbdPredict(int firstStrand, int endStrand) {
+    float dt = xpbdTimestep;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            lastX.data[i] = px.data[i], lastY.data[i] = py.data[i], lastZ.data[i] = pz.data[i];
+            for (paddedArray& lambda : lambdas) {
+                lambda.data[i] = 0;
+            }
+
+            if (isFixed.data[i] > 0) {
+                vx.data[i] = vy.data[i] = vz.data[i] = 0;
+                continue;
+            }
+
+            float amt = nx.data[i] * vx.data[i] + ny.data[i] * vy.data[i] + nz.data[i] * vz.data[i];
+            vx.data[i] += (-DRAG_FACTOR * amt * nx.data[i] - DAMPING_FACTOR * vx.data[i]) * dt;
+            vy.data[i] += (-DRAG_FACTOR * amt * ny.data[i] - DAMPING_FACTOR * vy.data[i]) * dt;
+            vz.data[i] += (GRAVITY_Z - DRAG_FACTOR * amt * nz.data[i] - DAMPING_FACTOR * vz.data[i]) * dt;
+            px.data[i] += vx.data[i] * dt, py.data[i] += vy.data[i] * dt, pz.data[i] += vz.data[i] * dt;
+        }
+    }
+}
+
+float ClothCpuSolver::XpbdProjectDistance(int a, int b, float rest, float compliance, float lambda) {
+    float dx = px.data[a] - px.data[b], dy = py.data[a] - py.data[b], dz = pz.data[a] - pz.data[b];
+    float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+    float weightA = isFixed.data[a] > 0 ? 0 : 1 / mass.data[a];
+    float weightB = isFixed.data[b] > 0 ? 0 : 1 / mass.data[b];
+    float alphaTilde = compliance / (xpbdTimestep * xpbdTimestep);
+    float denominator = weightA + weightB + alphaTilde;
+    if (distance == 0 || denominator == 0) return 0;
+
+    float deltaLambda = (rest - distance - alphaTilde * lambda) / denominator;
+    float scale = deltaLambda / distance;
+    px.data[a] += weightA * scale * dx, py.data[a] += weightA * scale * dy, pz.data[a] += weightA * scale * dz;
+    px.data[b] -= weightB * scale * dx, py.data[b] -= weightB * scale * dy, pz.data[b] -= weightB * scale * dz;
+    return deltaLambda;
+}
+
+// Left is the next strand over, which is the next element in strand-minor order
+void ClothCpuSolver::XpbdProjectAcrossStrands(int firstStrand, int endStrand, int constraint, int parity) {
+    bool isBend = constraint == Bend_Left;
+    int span = isBend ? 2 : 1;
+    float rest = span * stepParams.restLength;
+    float compliance = 1 / (isBend ? ClothManager::BEND_STIFFNESS_FACTOR * stepParams.ks : stepParams.ks);
+
+    for (int s = firstStrand; s < endStrand; s++) {
+        if ((s / span) % 2 != parity || s + span >= shape.strands) continue;
+        for (int j = 0; j < shape.massesPerStrand; j++) {
+            int i = j * shape.stride + s;
+            lambdas[constraint].data[i] += XpbdProjectDistance(i, i + span, rest, compliance, lambdas[constraint].data[i]);
+        }
+    }
+}
+
+void ClothCpuSolver::XpbdProjectAlongStrands(int firstStrand, int endStrand, int constraint) {
+    bool isBend = constraint == Bend_Down;
+    int span = isBend ? 2 : 1;
+    float rest = span * stepParams.restLength;
+    float compliance = 1 / (isBend ? ClothManager::BEND_STIFFNESS_FACTOR * stepParams.ks : stepParams.ks);
+
+    for (int parity = 0; parity < 2; parity++) {
+        for (int j = 0; j + span < shape.massesPerStrand; j++) {
+            if ((j / span) % 2 != parity) continue;
+            for (int s = firstStrand; s < endStrand; s++) {
+                int i = j * shape.stride + s;
+                int other = i + span * shape.stride;
+                lambdas[constraint].data[i] += XpbdProjectDistance(i, other, rest, compliance, lambdas[constraint].data[i]);
+            }
+        }
+    }
+}
+
+void ClothCpuSolver::XpbdProjectCollisions(int firstStrand, int endStrand) {
+    sweptSphere sphere = SphereDuringSubstep(stepParams, 0, 1, xpbdTimestep);
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            Vec3P<ScalarPack> start = LoadVec3<ScalarPack>(lastX.data, lastY.data, lastZ.data, i);
+            Vec3P<ScalarPack> p = LoadVec3<ScalarPack>(px.data, py.data, pz.data, i), unused = {0, 0, 0};
+            CollideWithSphere<ScalarPack>(start, p, unused, sphere);  // Velocities come from how far the masses moved
+            px.data[i] = p.x, py.data[i] = p.y, pz.data[i] = p.z;
+        }
+    }
+    ApplyTethers(firstStrand, endStrand, false);
+    CollideWithObstacles(firstStrand, endStrand, false);
+}
+
+void ClothCpuSolver::XpbdUpdateVelocities(int firstStrand, int endStrand) {
+    float contactRadius = stepParams.obstacleRadius * EXTRA_RADIUS_FACTOR * CONTACT_SLOP;
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            if (isFixed.data[i] > 0) {
+                vx.data[i] = vy.data[i] = vz.data[i] = 0;
+                continue;
+            }
+
+            float velX = (px.data[i] - lastX.data[i]) / xpbdTimestep;
+            float velY = (py.data[i] - lastY.data[i]) / xpbdTimestep;
+            float velZ = (pz.data[i] - lastZ.data[i]) / xpbdTimestep;
+
+            float dx = px.data[i] - stepParams.obstacleCenterX, dy = py.data[i] - stepParams.obstacleCenterY,
+                  dz = pz.data[i] - stepParams.obstacleCenterZ;
+            float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+            if (distance <= contactRadius && distance > 0) {
+                float into = std::min((velX * dx + velY * dy + velZ * dz) / distance, 0.f) / distance;
+                velX = (velX - into * dx) * COLLISION_FRICTION;
+                velY = (velY - into * dy) * COLLISION_FRICTION;
+                velZ = (velZ - into * dz) * COLLISION_FRICTION;
+            }
+            vx.data[i] = velX, vy.data[i] = velY, vz.data[i] = velZ;
+        }
+    }
+}
+// -- -- //
+
+// -- Self-collision -- //
+// Same passes as DispatchSelfCollisions. Each worker hashes its own strands, worker 0 counting sorts the whole cloth, then each worker
+// works out its masses' corrections from everyone's old state before any of them are applied
+void ClothCpuSolver::SelfCollide(int worker) {
+    if (stepParams.selfCollisionDistance == 0) return;
+    int firstStrand = std::min(numBlocks * worker / numWorkers * SIMD_WIDTH, shape.strands);
+    int endStrand = std::min(numBlocks * (worker + 1) / numWorkers * SIMD_WIDTH, shape.strands);
+
+    HashMasses(firstStrand, endStrand);
+    barrier.Wait();
+    if (worker == 0) SortHashCells();
+    barrier.Wait();
+    FindSelfCollisions(firstStrand, endStrand);
+    barrier.Wait();
+    ApplySelfCollisions(firstStrand, endStrand);
+    barrier.Wait();
+}
+
+struct hashCell {
+    int x, y, z;
+};
+
+hashCell CellAt(float x, float y, float z, float size) {
+    return {int(std::floor(x / size)), int(std::floor(y / size)), int(std::floor(z / size))};
+}
+
+// Must match HashOf in clothComputeShader.glsl
+int HashOf(hashCell cell, int tableSize) {
+    unsigned int hash = (unsigned(cell.x) * 92837111u) ^ (unsigned(cell.y) * 689287499u) ^ (unsigned(cell.z) * 283923481u);
+    return int(hash % unsigned(tableSize));
+}
+
+void ClothCpuSolver::HashMasses(int firstStrand, int endStrand) {
+    int tableSize = int(massCells.size());
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            massCells[i] = HashOf(CellAt(px.data[i], py.data[i], pz.data[i], stepParams.selfCollisionDistance), tableSize);
+        }
+    }
+}
+
+// Counts, scans so each cell holds where it ends, then each mass takes the last free entry of its cell
+void ClothCpuSolver::SortHashCells() {
+    std::fill(cellStarts.begin(), cellStarts.end(), 0);
+    for (int cell : massCells) {
+        if (cell >= 0) cellStarts[cell]++;
+    }
+    for (size_t h = 1; h < cellStarts.size(); h++) {
+        cellStarts[h] += cellStarts[h - 1];
+    }
+    for (int i = 0; i < int(massCells.size()); i++) {
+        if (massCells[i] >= 0) cellMasses[--cellStarts[massCells[i]]] = i;
+    }
+}
+
+// FindSelfCollisions from the shader
+void ClothCpuSolver::FindSelfCollisions(int firstStrand, int endStrand) {
+    const springAdjacency& springs = ClothManager::springs;
+    float distance = stepParams.selfCollisionDistance;
+    int tableSize = int(massCells.size());
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            pushX.data[i] = pushY.data[i] = pushZ.data[i] = 0;
+            slowX.data[i] = slowY.data[i] = slowZ.data[i] = 0;
+            if (isFixed.data[i] > 0) continue;
+
+            int gpuIndex = GpuIndex(i);
+            auto sharesSpring = [&](int other) {
+                int otherGpuIndex = GpuIndex(other);
+                for (GLuint k = springs.offsets[gpuIndex]; k < springs.offsets[gpuIndex + 1]; k++) {
+                    if (int(springs.neighbours[k]) == otherGpuIndex) return true;
+                }
+                return false;
+            };
+
+            hashCell cell = CellAt(px.data[i], py.data[i], pz.data[i], distance);
+            float push[3] = {0, 0, 0}, slow[3] = {0, 0, 0};
+            int contacts = 0;
+            int visited[27], numVisited = 0;
+            for (int x = -1; x <= 1; x++) {
+                for (int y = -1; y <= 1; y++) {
+                    for (int z = -1; z <= 1; z++) {
+                        int hash = HashOf({cell.x + x, cell.y + y, cell.z + z}, tableSize);
+                        if (std::find(visited, visited + numVisited, hash) != visited + numVisited) continue;
+                        visited[numVisited++] = hash;
+
+                        for (int entry = cellStarts[hash]; entry < cellStarts[hash + 1]; entry++) {
+                            int other = cellMasses[entry];
+                            float toThis[3] = {px.data[i] - px.data[other], py.data[i] - py.data[other], pz.data[i] - pz.data[other]};
+                            float distanceSquared = toThis[0] * toThis[0] + toThis[1] * toThis[1] + toThis[2] * toThis[2];
+                            bool tooFar = distanceSquared >= distance * distance || distanceSquared == 0;
+                            if (other == i || tooFar || sharesSpring(other)) continue;
+
+                            float separation = std::sqrt(distanceSquared);
+                            float relativeVelocity[3] = {vx.data[i] - vx.data[other], vy.data[i] - vy.data[other],
+                                                         vz.data[i] - vz.data[other]};
+                            float approachSpeed = 0;
+                            for (int axis = 0; axis < 3; axis++) {
+                                toThis[axis] /= separation;
+                                approachSpeed += relativeVelocity[axis] * toThis[axis];
+                            }
+                            for (int axis = 0; axis < 3; axis++) {
+                                push[axis] += 0.5f * (distance - separation) * toThis[axis];
+                                if (approachSpeed < 0) slow[axis] -= 0.5f * approachSpeed * toThis[axis];
+                            }
+                            contacts++;
+                        }
+                    }
+                }
+            }
+
+            if (contacts == 0) continue;
+            pushX.data[i] = push[0] / contacts, pushY.data[i] = push[1] / contacts, pushZ.data[i] = push[2] / contacts;
+            slowX.data[i] = slow[0] / contacts, slowY.data[i] = slow[1] / contacts, slowZ.data[i] = slow[2] / contacts;
+        }
+    }
+}
+
+void ClothCpuSolver::ApplySelfCollisions(int firstStrand, int endStrand) {
+    for (int j = 0; j < shape.massesPerStrand; j++) {
+        for (int s = firstStrand; s < endStrand; s++) {
+            int i = j * shape.stride + s;
+            px.data[i] += pushX.data[i], py.data[i] += pushY.data[i], pz.data[i] += pushZ.data[i];
+            vx.data[i] += slowX.data[i], vy.data[i] += slowY.data[i], vz.data[i] += slowZ.data[i];
+            if (stepScheme != Verlet_Scheme || stepIsXpbd) continue;  // Verlet's last positions move with the mass, as in the shader
+            lastX.data[i] += pushX.data[i] - slowX.data[i] * stepParams.dt;
+            lastY.data[i] += pushY.data[i] - slowY.data[i] * stepParams.dt;
+            lastZ.data[i] += pushZ.data[i] - slowZ.data[i] * stepParams.dt;
+        }
+    }
+}
+// -- -- //
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ClothManager.h"
+
+// Keeps a group of threads in lock step between phases of a substep. Spins, since a phase only takes microseconds
+class SpinBarrier {
+   public:
+    explicit SpinBarrier(int numThreads);
+    void Wait();
+
+   private:
+    int numThreads;
+    std::atomic<int> waiting;
+    std::atomic<int> generation;
+};
+
+// Shape of the strand-minor arrays. Strands are padded out to a whole number of SIMD blocks with pinned masses
+struct clothShape {
+    int strands;  // Real strands
+    int stride;   // Strands in memory
+    int massesPerStrand;
+    bool isMesh;  // Springs come from ClothManager's CSR adjacency instead of the grid. Each strand is a single mass
+};
+
+// CPU version of clothComputeShader.glsl, for machines without a usable GPU. Same explicit schemes and XPBD step, same constants.
+// Data is structure-of-arrays in strand-minor order (index = massAlongStrand * stride + strand), so 8 neighbouring strands sit next
+// to each other and one AVX2 register holds the same mass of 8 strands. Workers each own a contiguous range of strands
+class ClothCpuSolver {
+   public:
+    ClothCpuSolver();
+    ~ClothCpuSolver();
+
+    // Copies the simulation state out of / into the cloth's SSBOs
+    void Download();
+    void Upload(bool includeVelocities);
+
+    void Step(const simParams& params, int substeps, ExplicitScheme scheme, WindMode wind, float windTime);
+    void StepXpbd(const simParams& params, float timestep, int iterations);
+
+    // Largest distance between a mass here and the same mass in the position SSBO
+    float MaxDifferenceFromGPU(float* rmsDifference);
+
+    int GetNumWorkers() const {
+        return numWorkers;
+    }
+
+    static const int SIMD_WIDTH = 8;
+
+   private:
+    int CpuIndex(int gpuIndex) const;
+    int GpuIndex(int cpuIndex) const;
+
+    void WorkerLoop(int worker);
+    void StartFrame();
+    void RunFrame(int worker);
+    void RunSubsteps(int worker);
+    void RunMeshSubsteps(int worker, int firstMass, int endMass);
+    void RunXpbd(int worker);
+    void ComputeForces(int firstBlock, int endBlock);
+    void Integrate(int firstBlock, int endBlock, int substep);
+    void ComputeNormals(int firstBlock, int endBlock);
+    void ComputeWindForces(int worker, int substep);
+    void GatherWind(int firstStrand, int endStrand);
+    void CollideWithObstacles(int firstStrand, int endStrand, bool keepVelocities);
+    void ApplyTethers(int firstStrand, int endStrand, bool keepVelocities);
+    void StartVerlet(int firstStrand, int endStrand);
+    void RestartVerlet(int i);
+    void ComputeMeshForces(int firstMass, int endMass);
+    void ComputeMeshNormals(int firstMass, int endMass);
+    void XpbdPredict(int firstStrand, int endStrand);
+    void XpbdProjectAcrossStrands(int firstStrand, int endStrand, int constraint, int parity);
+    void XpbdProjectAlongStrands(int firstStrand, int endStrand, int constraint);
+    void XpbdProjectCollisions(int firstStrand, int endStrand);
+    void XpbdUpdateVelocities(int firstStrand, int endStrand);
+    float XpbdProjectDistance(int a, int b, float rest, float compliance, float lambda);
+    void SelfCollide(int worker);
+    void HashMasses(int firstStrand, int endStrand);
+    void SortHashCells();
+    void FindSelfCollisions(int firstStrand, int endStrand);
+    void ApplySelfCollisions(int firstStrand, int endStrand);
+
+    // Each array is padded by SIMD_WIDTH on both sides so neighbour loads at the ends of the cloth stay in bounds
+    struct paddedArray {
+        std::vector<float> storage;
+        float* data;
+        void Resize(int n);
+    };
+
+    paddedArray px, py, pz;
+    paddedArray vx, vy, vz;
+    paddedArray nx, ny, nz;
+    paddedArray ax, ay, az;
+    paddedArray mass;
+    paddedArray isFixed;  // 1 for pinned masses, 0 otherwise
+
+    // ClothManager's tethers, by CPU index. -1 for no anchor
+    std::vector<int> tetherAnchors;
+    std::vector<float> tetherLengths;
+
+    // Wind. Each triangle's force on each of its corners, then each mass' share of its triangles' forces as an acceleration
+    std::vector<int> triangleCorners;  // ClothManager's triangles, by CPU index
+    std::vector<float> triangleForces;
+    paddedArray windX, windY, windZ;
+
+    // XPBD state, and the Verlet scheme's
+    paddedArray lastX, lastY, lastZ;
+    paddedArray lambdas[4];  // Per constraint type, owned by the mass at the constraint's left or upper end
+
+    // Self-collision spatial hash, over CPU indices. Cell h's masses are entries cellStarts[h] through cellStarts[h + 1] - 1 of cellMasses
+    std::vector<int> massCells;  // -1 for padding strands
+    std::vector<int> cellStarts;
+    std::vector<int> cellMasses;
+    paddedArray pushX, pushY, pushZ;
+    paddedArray slowX, slowY, slowZ;
+
+    clothShape shape;  // Taken from ClothManager's resolution when the solver is created
+    int numBlocks;     // Groups of SIMD_WIDTH strands processed together
+    int numWorkers;
+    std::vector<std::thread> workers;
+    SpinBarrier barrier;
+
+    // Frame hand-off. Workers sleep between frames rather than spin
+    std::mutex frameMutex;
+    std::condition_variable frameStart;
+    std::condition_variable frameDone;
+    int frameGeneration = 0;
+    int workersDone = 0;
+    bool quit = false;
+
+    simParams stepParams;
+    int stepSubsteps = 0;
+    ExplicitScheme stepScheme = Midpoint_Scheme;
+    WindMode stepWind = Normal_Drag;
+    float stepWindTime = 0;
+    bool stepIsXpbd = false;
+    float xpbdTimestep = 0;
+    int xpbdIterations = 0;
+};
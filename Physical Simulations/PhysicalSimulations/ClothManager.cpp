@@ -1,8 +1,16 @@
 #define GLM_FORCE_RADIANS
 
 #include <SDL_stdinc.h>
+#include <algorithm>
 #include <ctime>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <queue>
+#include <set>
 #include <gtc/type_ptr.hpp>
+#include "ClothCpuSolver.h"
 #include "ClothManager.h"
 #include "Constants.h"
 #include "Environment.h"
@@ -19,29 +27,133 @@ GLuint ClothManager::newVelSSbo;
 GLuint ClothManager::massSSbo;
 GLuint ClothManager::paramSSbo;
 GLuint ClothManager::lastPosSSbo;
+GLuint ClothManager::deltaVelSSbo;
+GLuint ClothManager::residualSSbo;
+GLuint ClothManager::searchSSbo;
+GLuint ClothManager::preconditionedSSbo;
+GLuint ClothManager::productSSbo;
+GLuint ClothManager::springBlockSSbo;
+GLuint ClothManager::preconditionerSSbo;
+GLuint ClothManager::partialsSSbo;
+GLuint ClothManager::lambdaSSbo;
+springAdjacency ClothManager::springs;
+GLuint ClothManager::springOffsetSSbo;
+GLuint ClothManager::springNeighbourSSbo;
+GLuint ClothManager::springRestLengthSSbo;
+GLuint ClothManager::springStiffnessSSbo;
+GLuint ClothManager::springDampingSSbo;
+GLuint ClothManager::springOppositeSSbo;
+GLuint ClothManager::hashCellSSbo;
+GLuint ClothManager::hashMassSSbo;
+GLuint ClothManager::selfCollisionSSbo;
+ObstacleBvh ClothManager::obstacles;
+GLuint ClothManager::obstacleNodeSSbo;
+GLuint ClothManager::obstacleTriangleSSbo;
+GLuint ClothManager::triangleSSbo;
+GLuint ClothManager::energySSbo;
+std::vector<tether> ClothManager::massTethers;
+GLuint ClothManager::tetherSSbo;
+GLuint ClothManager::coarsePosSSbo;
+GLuint ClothManager::coarseVelSSbo;
+GLuint ClothManager::coarsePosOutSSbo;
+GLuint ClothManager::coarseVelOutSSbo;
+GLuint ClothManager::coarseNormSSbo;
+GLuint ClothManager::coarseMassSSbo;
+GLuint ClothManager::coarseParamSSbo;
+GLuint ClothManager::coarseStartSSbo;
+triangleAdjacency ClothManager::massTriangles;
+GLuint ClothManager::triangleForceSSbo;
+GLuint ClothManager::triangleOffsetSSbo;
+GLuint ClothManager::massTriangleSSbo;
 
-ClothManager::ClothManager() {
+int ClothManager::numThreads = DEFAULT_NUM_THREADS;
+int ClothManager::massesPerThread = DEFAULT_MASSES_PER_THREAD;
+ClothTopology ClothManager::topology = Grid_Topology;
+std::unique_ptr<Model> ClothManager::clothMesh;
+std::vector<clothInstance> ClothManager::batch;
+std::vector<glm::vec3> ClothManager::batchVertices;
+std::vector<unsigned int> ClothManager::batchIndices;
+
+ClothManager::ClothManager(int strands, int massesPerStrand) {
     srand(time(NULL));
-    simParameters = simParams{0, 0, 0, 4, 0, 150, 30, 0.4 * CLOTH_HEIGHT / float(MASSES_PER_THREAD)};
+    numThreads = strands;
+    massesPerThread = massesPerStrand;
+    simParameters = simParams{0, 0, 0, 4, 0, 150, 30, 0.4 * CLOTH_HEIGHT / float(massesPerThread), 0, 0, 0, 0, 0, 0};
     InitGL();
 }
 
+ClothManager::~ClothManager() = default;
+
+// Creates the buffer the first time, then just resizes it, so anything that refers to it (like the cloth's VAO) stays valid
+static void PrepareBuffer(GLuint *ssbo, GLsizeiptr size, GLenum usage) {
+    if (*ssbo == 0) glGenBuffers(1, ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, *ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, usage);
+}
+
+template <class T>
+static void UploadBuffer(GLuint *ssbo, const std::vector<T> &data) {
+    PrepareBuffer(ssbo, data.size() * sizeof(T), GL_STATIC_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size() * sizeof(T), data.data());
+}
+
 void ClothManager::InitGL() {
-    assert(NUM_MASSES % WORK_GROUP_SIZE == 0);
+    int numMasses = NumAllocatedMasses();
+
+    // Prepare the spring adjacency buffers //
+    printf("Building spring adjacency...\n");
+    BuildSpringAdjacency();
+    UploadBuffer(&springOffsetSSbo, springs.offsets);
+    UploadBuffer(&springNeighbourSSbo, springs.neighbours);
+    UploadBuffer(&springRestLengthSSbo, springs.restLengths);
+    UploadBuffer(&springStiffnessSSbo, springs.stiffnesses);
+    UploadBuffer(&springDampingSSbo, springs.dampings);
+    UploadBuffer(&springOppositeSSbo, springs.oppositeMasses);
+    springsMayBeTorn = simParameters.tearStrain > 0;
+    ////
+
+    // Prepare the tethers buffer //
+    BuildTethers();
+    UploadBuffer(&tetherSSbo, massTethers);
+    SetTethers(tethers);
+    ////
 
     // Prepare the positions buffer //
-    glGenBuffers(1, &posSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, posSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(position), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&posSSbo, numMasses * sizeof(position), GL_STATIC_DRAW);
 
     printf("Initializing mass positions...\n");
-    position *positions = (position *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(position), bufMask);
-    for (int i = 0; i < NUM_MASSES; i++) {
-        int threadnum = i / MASSES_PER_THREAD;  // Deliberate int div for floor
+    position *positions = (position *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(position), bufMask);
+    for (int i = 0; i < numMasses; i++) {
+        if (i >= NumMasses()) {  // Padding, parked well away from the obstacle
+            positions[i] = {0, 0, -1000.0f, 1.0f};
+            continue;
+        }
+
+        if (!IsGridLayout()) {  // Wherever the obj or the batch puts it
+            glm::vec3 vertex = MeshVertices()[i];
+            positions[i] = {vertex.x, vertex.y, vertex.z, 1.0f};
+            continue;
+        }
+
+        if (topology == Strand_Topology) {  // Roots on a square patch, each strand sticking straight out from it to fall from there
+            int strand = i / massesPerThread, side = int(std::ceil(std::sqrt(float(numThreads))));
+            float spacing = STRAND_PATCH_SIZE / std::max(side - 1, 1);
+            float x = (i % massesPerThread) * simParameters.restLength;
+            float y = (strand % side) * spacing - STRAND_PATCH_SIZE / 2;
+            float z = 20.0f - (strand / side) * spacing;
+            if (i % massesPerThread != 0) {
+                y += (Utils::randBetween(0, 1) - 0.5) * simParameters.restLength * 0.5;
+                z += (Utils::randBetween(0, 1) - 0.5) * simParameters.restLength * 0.5;
+            }
+            positions[i] = {x, y, z, 1.0f};
+            continue;
+        }
+
+        int threadnum = i / massesPerThread;  // Deliberate int div for floor
         // positions[i] = {Utils::randBetween(0, 1), Utils::randBetween(0, 1) + threadnum * 3, 20, 0};
-        float y = threadnum * 0.3 * (CLOTH_WIDTH / float(NUM_THREADS));
-        float x = (i % MASSES_PER_THREAD) * simParameters.restLength;
-        if (i % MASSES_PER_THREAD != 0) {
+        float y = threadnum * 0.3 * (CLOTH_WIDTH / float(numThreads));
+        float x = (i % massesPerThread) * simParameters.restLength;
+        if (i % massesPerThread != 0) {
             y += (Utils::randBetween(0, 1) - 0.5) * simParameters.restLength * 0.5;
             x += (Utils::randBetween(0, 1) - 0.5) * simParameters.restLength * 0.5;
         }
@@ -51,37 +163,53 @@ void ClothManager::InitGL() {
     ////
 
     // Prepare the mass parameters buffer //
-    glGenBuffers(1, &massSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, massSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(massParams), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&massSSbo, numMasses * sizeof(massParams), GL_STATIC_DRAW);
 
     printf("Initializing springs...\n");
-    massParams *massParameters = (massParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(massParams), bufMask);
-    for (int i = 0; i < NUM_MASSES; i++) {
-        massParameters[i].isFixed = i % MASSES_PER_THREAD == 0;
+    massParams *massParameters = (massParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(massParams), bufMask);
+    for (int i = 0; i < numMasses; i++) {
+        massParameters[i].isFixed = i < NumMasses() && IsPinned(i);
         // massParameters[i].isFixed = false;
-        massParameters[i].mass = float(CLOTH_WEIGHT) / float(NUM_MASSES);
+        massParameters[i].mass = topology == Strand_Topology ? STRAND_MASS : float(CLOTH_WEIGHT) / float(NumMasses());
+        if (i >= NumMasses()) {  // Padding
+            massParameters[i].isFixed = true;
+            massParameters[i].connections = {BAD_INDEX, BAD_INDEX, BAD_INDEX, BAD_INDEX};
+            continue;
+        }
+
+        if (topology == Mesh_Topology) {  // The springs are only in the CSR adjacency
+            massParameters[i].connections = {BAD_INDEX, BAD_INDEX, BAD_INDEX, BAD_INDEX};
+            continue;
+        }
+
+        if (topology == Batch_Topology) {  // Same, but each instance is weighed like a grid of its own
+            const clothInstance &instance = InstanceOf(i);
+            massParameters[i].mass = instance.weight / float(instance.strands * instance.massesPerStrand);
+            massParameters[i].connections = {BAD_INDEX, BAD_INDEX, BAD_INDEX, BAD_INDEX};
+            continue;
+        }
 
         // Initialize connections
         unsigned int left = BAD_INDEX, right = BAD_INDEX, up = BAD_INDEX, down = BAD_INDEX;
-        int threadnum = i / MASSES_PER_THREAD;
-        int y = i % MASSES_PER_THREAD;
-        if (threadnum < NUM_THREADS - 1) {
-            left = i + MASSES_PER_THREAD;
+        int threadnum = i / massesPerThread;
+        int y = i % massesPerThread;
+        if (threadnum < numThreads - 1) {
+            left = i + massesPerThread;
         }
 
         if (threadnum > 0) {
-            right = i - MASSES_PER_THREAD;
+            right = i - massesPerThread;
         }
 
         if (y > 0) {
             up = i - 1;
         }
 
-        if (y < MASSES_PER_THREAD - 1) {
+        if (y < massesPerThread - 1) {
             down = i + 1;
         }
 
+        if (topology == Strand_Topology) left = right = BAD_INDEX;  // Strands don't touch each other
         massParameters[i].connections = {left, right, up, down};
     }
 
@@ -89,51 +217,92 @@ void ClothManager::InitGL() {
     ////
 
     // Prepare the velocities buffer
-    glGenBuffers(1, &velSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, velSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(velocity), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&velSSbo, numMasses * sizeof(velocity), GL_STATIC_DRAW);
 
     printf("Initializing mass velocities\n");
-    velocity *vels = (velocity *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(velocity), bufMask);
-    memset(vels, 0, NUM_MASSES * sizeof(velocity));
+    velocity *vels = (velocity *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(velocity), bufMask);
+    memset(vels, 0, numMasses * sizeof(velocity));
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
     ////
 
     // Prepare the normals buffer
-    glGenBuffers(1, &normSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, normSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(normal), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&normSSbo, numMasses * sizeof(normal), GL_STATIC_DRAW);
 
     printf("Initializing cloth normals\n");
-    normal *normals = (normal *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(normal), bufMask);
-    memset(normals, 0, NUM_MASSES * sizeof(normal));
+    normal *normals = (normal *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(normal), bufMask);
+    memset(normals, 0, numMasses * sizeof(normal));
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
     ////
 
     // Prepare the new velocities buffer
-    glGenBuffers(1, &newVelSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, newVelSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(velocity), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&newVelSSbo, numMasses * sizeof(velocity), GL_STATIC_DRAW);
 
-    vels = (velocity *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(velocity), bufMask);
-    memset(vels, 0, NUM_MASSES * sizeof(velocity));
+    vels = (velocity *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(velocity), bufMask);
+    memset(vels, 0, numMasses * sizeof(velocity));
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
     ////
 
     // Prepare the last positions buffer
-    glGenBuffers(1, &lastPosSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lastPosSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_MASSES * sizeof(position), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&lastPosSSbo, numMasses * sizeof(position), GL_STATIC_DRAW);
 
-    positions = (position *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_MASSES * sizeof(position), bufMask);
-    memset(positions, 0, NUM_MASSES * sizeof(position));
+    positions = (position *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, numMasses * sizeof(position), bufMask);
+    memset(positions, 0, numMasses * sizeof(position));
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
     ////
 
+    // Implicit solver state. Entirely written by the shader before it's read, so nothing to initialize
+    GLuint *vectorSSbos[] = {&deltaVelSSbo, &residualSSbo, &searchSSbo, &preconditionedSSbo, &productSSbo};
+    for (GLuint *ssbo : vectorSSbos) {
+        PrepareBuffer(ssbo, numMasses * sizeof(velocity), GL_DYNAMIC_COPY);
+    }
+
+    PrepareBuffer(&springBlockSSbo, std::max(NumSprings(), 1) * sizeof(mat3Block), GL_DYNAMIC_COPY);
+
+    PrepareBuffer(&preconditionerSSbo, numMasses * sizeof(mat3Block), GL_DYNAMIC_COPY);
+
+    PrepareBuffer(&partialsSSbo, NumPartials() * sizeof(GLfloat), GL_DYNAMIC_COPY);
+    ////
+
+    // XPBD state. Reset by the shader at the start of every step
+    PrepareBuffer(&lambdaSSbo, numMasses * 4 * sizeof(GLfloat), GL_DYNAMIC_COPY);
+    ////
+
+    // Self-collision state. Rebuilt by the shader every pass
+    PrepareBuffer(&hashCellSSbo, NumHashCellEntries() * sizeof(GLint), GL_DYNAMIC_COPY);
+    PrepareBuffer(&hashMassSSbo, numMasses * sizeof(GLuint), GL_DYNAMIC_COPY);
+    PrepareBuffer(&selfCollisionSSbo, 2 * numMasses * sizeof(position), GL_DYNAMIC_COPY);
+    ////
+
+    // Energy monitor state. Readings of the old cloth mean nothing to the new one
+    PrepareBuffer(&energySSbo, NumEnergyReadings() * sizeof(energyReading), GL_DYNAMIC_READ);
+    if (energyFence != 0) glDeleteSync(energyFence);
+    energyFence = 0;
+    lastReadEnergy = 0;
+    calmReadings = 0;
+    ////
+
+    // Multiresolution state. The coarse grid is restricted from the fine one at the start of every frame, so only its masses need
+    // setting up. Buffers can't be empty, so there's always at least one coarse mass' worth
+    int numCoarseMasses = std::max(NumCoarseMasses(), 1);
+    GLuint *coarseSSbos[] = {&coarsePosSSbo, &coarseVelSSbo, &coarsePosOutSSbo, &coarseVelOutSSbo, &coarseNormSSbo};
+    for (GLuint *ssbo : coarseSSbos) {
+        PrepareBuffer(ssbo, numCoarseMasses * sizeof(position), GL_DYNAMIC_COPY);
+    }
+    PrepareBuffer(&coarseStartSSbo, 2 * numCoarseMasses * sizeof(position), GL_DYNAMIC_COPY);
+    PrepareBuffer(&coarseParamSSbo, sizeof(simParams), GL_DYNAMIC_DRAW);
+
+    std::vector<massParams> coarseMasses(numCoarseMasses);
+    for (int i = 0; i < NumCoarseMasses(); i++) {
+        int strand = i / CoarseMassesPerThread(), along = i % CoarseMassesPerThread();
+        coarseMasses[i].isFixed = IsPinned(MULTIRESOLUTION_FACTOR * (strand * massesPerThread + along));
+        coarseMasses[i].mass = float(CLOTH_WEIGHT) / float(NumCoarseMasses());
+        coarseMasses[i].connections = {BAD_INDEX, BAD_INDEX, BAD_INDEX, BAD_INDEX};  // The tiled kernel uses the grid's stencil
+    }
+    UploadBuffer(&coarseMassSSbo, coarseMasses);
+    ////
+
     // Misc data //
-    glGenBuffers(1, &paramSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, paramSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(simParams), nullptr, GL_STATIC_DRAW);
+    PrepareBuffer(&paramSSbo, sizeof(simParams), GL_STATIC_DRAW);
 
     simParams *params = (simParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(simParams), bufMask);
     *params = simParameters;
@@ -143,6 +312,135 @@ void ClothManager::InitGL() {
     printf("Done initializing buffers\n");
 }
 
+// A grid mass' springs, in the order they're stored. Left is the next strand over and up is the previous mass along the strand, so the
+// structural springs are in the order the connections used to be read in
+const gridSpring ClothManager::GRID_SPRINGS[NUM_GRID_SPRINGS] = {
+    {1, 0, Structural_Spring}, {-1, 0, Structural_Spring}, {0, -1, Structural_Spring}, {0, 1, Structural_Spring},
+    {1, -1, Shear_Spring},     {-1, -1, Shear_Spring},     {1, 1, Shear_Spring},       {-1, 1, Shear_Spring},
+    {2, 0, Bend_Spring},       {-2, 0, Bend_Spring},       {0, -2, Bend_Spring},       {0, 2, Bend_Spring}};
+
+void ClothManager::AddSpring(int other, SpringType type, float restLength, GLuint opposite, float stiffness) {
+    float factor = stiffness * StiffnessFactor(type);
+    springs.neighbours.push_back(other);
+    springs.restLengths.push_back(restLength);
+    springs.stiffnesses.push_back(factor * simParameters.ks);
+    springs.dampings.push_back(factor * simParameters.kd);
+    springs.oppositeMasses.push_back(opposite);
+}
+
+// Each spring's parameters are stored with it, so the shader never has to work out what type of spring it's looking at.
+// A mesh's springs are at the lengths they have in the obj. A batch is a mesh whose pieces happen not to touch, and each instance's
+// springs are scaled by its stiffness. Strands only get the grid's springs along them
+void ClothManager::BuildSpringAdjacency() {
+    springs = springAdjacency();
+    springs.offsets.push_back(0);
+
+    if (IsGridLayout()) {
+        for (int i = 0; i < NumMasses(); i++) {
+            int threadnum = i / massesPerThread;
+            int y = i % massesPerThread;
+            for (const gridSpring &spring : GRID_SPRINGS) {
+                if (topology == Strand_Topology && spring.strands != 0) continue;
+                int strand = threadnum + spring.strands, along = y + spring.masses;
+                if (strand < 0 || strand >= numThreads || along < 0 || along >= massesPerThread) continue;
+                float span = std::sqrt(float(spring.strands * spring.strands + spring.masses * spring.masses));
+                AddSpring(strand * massesPerThread + along, spring.type, span * simParameters.restLength);
+            }
+            springs.offsets.push_back(springs.neighbours.size());
+        }
+    } else {
+        // Each triangle's edges, in winding order, know the corner opposite them. The reverse of an edge on the mesh's boundary doesn't
+        const std::vector<unsigned int> &indices = MeshTriangleIndices();
+        std::vector<std::map<GLuint, GLuint>> adjacent(NumMasses());
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            for (int corner = 0; corner < 3; corner++) {
+                GLuint from = indices[t + corner], to = indices[t + (corner + 1) % 3], opposite = indices[t + (corner + 2) % 3];
+                adjacent[from][to] = opposite;
+                adjacent[to].emplace(from, BAD_INDEX);
+            }
+        }
+
+        // An edge between two triangles gets a bend spring between their far corners, unless those are already neighbours
+        std::vector<std::set<GLuint>> bends(NumMasses());
+        for (int i = 0; i < NumMasses(); i++) {
+            for (auto &edge : adjacent[i]) {
+                GLuint left = edge.second, right = adjacent[edge.first][i];
+                if (GLuint(i) > edge.first || left == BAD_INDEX || right == BAD_INDEX || adjacent[left].count(right)) continue;
+                bends[left].insert(right);
+                bends[right].insert(left);
+            }
+        }
+
+        const std::vector<glm::vec3> &vertices = MeshVertices();
+        for (int i = 0; i < NumMasses(); i++) {
+            float stiffness = topology == Batch_Topology ? InstanceOf(i).stiffness : 1;
+            for (auto &edge : adjacent[i]) {
+                AddSpring(edge.first, Structural_Spring, glm::distance(vertices[i], vertices[edge.first]), edge.second, stiffness);
+            }
+            for (GLuint other : bends[i]) {
+                AddSpring(other, Bend_Spring, glm::distance(vertices[i], vertices[other]), BAD_INDEX, stiffness);
+            }
+            springs.offsets.push_back(springs.neighbours.size());
+        }
+    }
+
+    // Padding masses have no springs
+    springs.offsets.resize(NumAllocatedMasses() + 1, springs.offsets.back());
+    SetSelfCollisions(selfCollisions);
+}
+
+// Nothing's pinned on a mesh. A grid, the strands and each of a batch's instances hang from the first mass of every strand
+bool ClothManager::IsPinned(int mass) {
+    if (topology == Mesh_Topology) return false;
+    if (topology == Batch_Topology) {
+        const clothInstance &instance = InstanceOf(mass);
+        return (mass - instance.firstMass) % instance.massesPerStrand == 0;
+    }
+    return mass % massesPerThread == 0;
+}
+
+// A grid mass' closest pinned mass is the first mass of its strand. Anything else finds its closest pinned mass, and how far away it is,
+// with Dijkstra's algorithm over the springs at their rest lengths
+void ClothManager::BuildTethers() {
+    massTethers.assign(NumAllocatedMasses(), tether{BAD_INDEX, 0});
+    if (IsGridLayout()) {
+        for (int i = 0; i < NumMasses(); i++) {
+            if (!IsPinned(i)) massTethers[i] = {GLuint(i - i % massesPerThread), (i % massesPerThread) * simParameters.restLength};
+        }
+        return;
+    }
+
+    std::vector<GLuint> anchors(NumMasses(), BAD_INDEX);
+    std::vector<float> reach(NumMasses(), INFINITY);
+    typedef std::pair<float, int> reached;
+    std::priority_queue<reached, std::vector<reached>, std::greater<reached>> frontier;
+    for (int i = 0; i < NumMasses(); i++) {
+        if (!IsPinned(i)) continue;
+        anchors[i] = i;
+        reach[i] = 0;
+        frontier.push({0.0f, i});
+    }
+
+    while (!frontier.empty()) {
+        reached next = frontier.top();
+        frontier.pop();
+        int i = next.second;
+        if (next.first > reach[i]) continue;  // Already reached a shorter way
+        for (GLuint s = springs.offsets[i]; s < springs.offsets[i + 1]; s++) {
+            GLuint other = springs.neighbours[s];
+            float throughHere = reach[i] + springs.restLengths[s];
+            if (throughHere >= reach[other]) continue;
+            reach[other] = throughHere;
+            anchors[other] = anchors[i];
+            frontier.push({throughHere, int(other)});
+        }
+    }
+
+    for (int i = 0; i < NumMasses(); i++) {
+        if (!IsPinned(i) && anchors[i] != BAD_INDEX) massTethers[i] = {anchors[i], reach[i]};
+    }
+}
+
 void ClothManager::UpdateComputeParameters() const {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, paramSSbo);
     simParams *params = (simParams *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(simParams), bufMask);
@@ -151,49 +449,900 @@ void ClothManager::UpdateComputeParameters() const {
 }
 
 void ClothManager::ExecuteComputeShader() {
-    UpdateComputeParameters();
+    if (UsesTiledDispatch()) {
+        ExecuteTiledComputeShader();
+        return;
+    }
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, posSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, normSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, paramSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, newVelSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, massSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, lastPosSSbo);
+    UpdateComputeParameters();
+    BindSSbos();
 
     glUseProgram(ShaderManager::ClothComputeShader);
+    glUniform1i(ShaderManager::ClothTopology, topology);
+    bool coarseGrid = UsesMultiresolution();
+    if (coarseGrid) StepCoarseGrid();
+    glUniform1i(ShaderManager::ClothInternalForcesOnly, coarseGrid);
+    glUniform1i(ShaderManager::ClothWindMode, windMode);
+    int substeps = ExplicitSubsteps();  // The fine grid steps through the whole frame either way
+    glUniform1i(ShaderManager::ClothObstacleSubsteps, substeps);
+    if (explicitScheme == Verlet_Scheme) DispatchStage(Start_Verlet_Stage);
 
-    for (int i = 0; i < COMPUTES_PER_FRAME; i++) {
+    for (int i = 0; i < substeps; i++) {
+        if (windMode != Normal_Drag) DispatchWindForces(i);
         glUniform1i(ShaderManager::ClothComputeStage, 0);
-        glDispatchCompute(NUM_MASSES / WORK_GROUP_SIZE, 1, 1);  // Run the cloth sim compute shader
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);         // Wait for all to finish
+        glDispatchCompute(NumWorkGroups(), 1, 1);  // Run the cloth sim compute shader
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);  // Wait for all to finish
 
         glUniform1i(ShaderManager::ClothComputeStage, 1);
-        glDispatchCompute(NUM_MASSES / WORK_GROUP_SIZE, 1, 1);
+        glUniform1i(ShaderManager::ClothObstacleSubstep, i);
+        glDispatchCompute(NumWorkGroups(), 1, 1);
         glMemoryBarrier(GL_SHADER_STORAGE_BUFFER);
+
+        if ((i + 1) % SELF_COLLISION_INTERVAL == 0) DispatchSelfCollisions();
+        if ((i + 1) % TEAR_INTERVAL == 0) DispatchTearing();
+        if ((i + 1) % ENERGY_INTERVAL == 0 || i + 1 == substeps) DispatchEnergyMeasurement();
     }
+    MaskTornTriangles();
+
+    UnbindSSbos();
+}
+
+// The same explicit substeps as ExecuteComputeShader, MAX_TILED_SUBSTEPS at a time in a single dispatch. Tiles only exchange results
+// between dispatches, so this is ~10x fewer dispatches and barriers per frame in exchange for redundantly stepping each tile's halo.
+// Positions and velocities ping-pong with the last positions and accelerations buffers, which the explicit step doesn't otherwise need.
+// The energy is only measured once the frame's done
+void ClothManager::ExecuteTiledComputeShader() {
+    UpdateComputeParameters();
+    BindSSbos();
 
-    int numSSbos = 7;
-    for (int i = 0; i < numSSbos; i++) {
+    glUseProgram(ShaderManager::ClothTiledComputeShader);
+    glUniform1i(ShaderManager::ClothTiledMassesPerThread, massesPerThread);
+    glUniform1i(ShaderManager::ClothTiledNumThreads, numThreads);
+    int totalSubsteps = ExplicitSubsteps();
+    glUniform1i(ShaderManager::ClothTiledObstacleSubsteps, totalSubsteps);
+
+    GLuint positionsIn = posSSbo, velocitiesIn = velSSbo;
+    GLuint positionsOut = lastPosSSbo, velocitiesOut = newVelSSbo;
+    for (int i = 0; i < totalSubsteps; i += MAX_TILED_SUBSTEPS) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, positionsIn);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velocitiesIn);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, positionsOut);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, velocitiesOut);
+
+        int substeps = std::min(MAX_TILED_SUBSTEPS, totalSubsteps - i);
+        glUniform1i(ShaderManager::ClothTiledSubsteps, substeps);
+        glUniform1i(ShaderManager::ClothTiledObstacleSubstep, i);
+        glDispatchCompute(NumTilesAlong(), NumTilesAcross(), 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        std::swap(positionsIn, positionsOut);
+        std::swap(velocitiesIn, velocitiesOut);
+
+        // Once per SELF_COLLISION_INTERVAL substeps, like the unfused loop, but at the end of the dispatch that reaches the interval
+        if ((i + substeps) / SELF_COLLISION_INTERVAL != i / SELF_COLLISION_INTERVAL) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, positionsIn);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velocitiesIn);
+            glUseProgram(ShaderManager::ClothComputeShader);
+            DispatchSelfCollisions();
+            glUseProgram(ShaderManager::ClothTiledComputeShader);
+        }
+    }
+
+    if (positionsIn != posSSbo) {  // Odd number of dispatches, so the latest state is in the spare buffers
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, positionsIn);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, posSSbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, NumAllocatedMasses() * sizeof(position));
+        glBindBuffer(GL_COPY_READ_BUFFER, velocitiesIn);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, velSSbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, NumAllocatedMasses() * sizeof(velocity));
+    }
+
+    if (adaptiveTimestep) {
+        BindSSbos();
+        glUseProgram(ShaderManager::ClothComputeShader);
+        DispatchEnergyMeasurement();
+    }
+
+    UnbindSSbos();
+}
+
+const int NUM_BOUND_SSBOS = 37;
+
+void ClothManager::BindSSbos() const {
+    GLuint ssbos[NUM_BOUND_SSBOS] = {posSSbo,             velSSbo,           normSSbo,            paramSSbo,            newVelSSbo,
+                                     massSSbo,            lastPosSSbo,       deltaVelSSbo,        residualSSbo,         searchSSbo,
+                                     preconditionedSSbo,  productSSbo,       springBlockSSbo,     preconditionerSSbo,   partialsSSbo,
+                                     lambdaSSbo,          springOffsetSSbo,  springNeighbourSSbo, springRestLengthSSbo, springOppositeSSbo,
+                                     springStiffnessSSbo, springDampingSSbo, hashCellSSbo,        hashMassSSbo,         selfCollisionSSbo,
+                                     obstacleNodeSSbo,    obstacleTriangleSSbo, triangleSSbo,        ShaderManager::ClothShader.IBO,
+                                     energySSbo,          tetherSSbo,        coarsePosSSbo,       coarseVelSSbo,        coarseStartSSbo,
+                                     triangleForceSSbo,   triangleOffsetSSbo, massTriangleSSbo};
+    for (int i = 0; i < NUM_BOUND_SSBOS; i++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i + 1, ssbos[i]);
+    }
+}
+
+void ClothManager::UnbindSSbos() const {
+    for (int i = 0; i < NUM_BOUND_SSBOS; i++) {
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i + 1, 0);
     }
 }
 
+void ClothManager::DispatchStage(ClothComputeStage stage) {
+    glUniform1i(ShaderManager::ClothComputeStage, stage);
+    glDispatchCompute(NumWorkGroups(), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Restricts the cloth to the coarse grid, steps that through the whole frame with the tiled kernel, then adds what it did back onto the
+// fine grid. Each coarse mass weighs MULTIRESOLUTION_FACTOR^2 fine ones, so the coarse grid is stable at MULTIRESOLUTION_FACTOR times
+// the timestep. Expects the cloth compute shader to be in use and the SSBOs bound, and leaves them that way
+void ClothManager::StepCoarseGrid() {
+    glUniform1i(ShaderManager::ClothMassesPerThread, massesPerThread);
+    glUniform1i(ShaderManager::ClothNumMasses, NumMasses());
+    DispatchStage(Restrict_To_Coarse_Stage);
+
+    int substeps = MultiresolutionSubsteps();
+    simParams coarseParameters = simParameters;
+    coarseParameters.restLength *= MULTIRESOLUTION_FACTOR;
+    coarseParameters.dt = ExplicitSubsteps() * simParameters.dt / substeps;  // The same frame as the fine grid
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, coarseParamSSbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(simParams), &coarseParameters);
+
+    glUseProgram(ShaderManager::ClothTiledComputeShader);
+    glUniform1i(ShaderManager::ClothTiledMassesPerThread, CoarseMassesPerThread());
+    glUniform1i(ShaderManager::ClothTiledNumThreads, CoarseNumThreads());
+    glUniform1i(ShaderManager::ClothTiledObstacleSubsteps, substeps);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, coarseNormSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, coarseParamSSbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, coarseMassSSbo);
+
+    for (int i = 0; i < substeps; i += MAX_TILED_SUBSTEPS) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, coarsePosSSbo);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, coarseVelSSbo);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, coarsePosOutSSbo);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, coarseVelOutSSbo);
+
+        glUniform1i(ShaderManager::ClothTiledSubsteps, std::min(MAX_TILED_SUBSTEPS, substeps - i));
+        glUniform1i(ShaderManager::ClothTiledObstacleSubstep, i);
+        glDispatchCompute(TilesCovering(CoarseMassesPerThread(), TILE_ALONG), TilesCovering(CoarseNumThreads(), TILE_ACROSS), 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // Nothing else holds on to the coarse buffers, so they trade places instead of being copied back
+        std::swap(coarsePosSSbo, coarsePosOutSSbo);
+        std::swap(coarseVelSSbo, coarseVelOutSSbo);
+    }
+
+    BindSSbos();
+    glUseProgram(ShaderManager::ClothComputeShader);
+    DispatchStage(Prolong_From_Coarse_Stage);
+}
+
+// Breaks overstretched springs. Expects the cloth compute shader to be in use and the SSBOs bound
+void ClothManager::DispatchTearing() {
+    if (simParameters.tearStrain == 0) return;
+    DispatchStage(Tear_Springs_Stage);
+}
+
+// Rebuilds the IBO from the untorn triangles on the GPU, so tearing never has to read anything back. Same expectations as
+// DispatchTearing
+void ClothManager::MaskTornTriangles() {
+    if (!springsMayBeTorn) return;
+    int numTriangles = NumTriangleIndices() / 3;
+    glUniform1i(ShaderManager::ClothNumTriangles, numTriangles);
+    glUniform1i(ShaderManager::ClothComputeStage, Mask_Triangles_Stage);
+    glDispatchCompute((numTriangles + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);  // The wind reads it too
+}
+
+// Works out the wind's force on every triangle for the next forces stage to gather. Same expectations as DispatchTearing
+void ClothManager::DispatchWindForces(int substep) {
+    int numTriangles = NumTriangleIndices() / 3;
+    glUniform1i(ShaderManager::ClothNumTriangles, numTriangles);
+    glUniform1f(ShaderManager::ClothWindTime, windTime + substep * simParameters.dt);
+    glUniform1i(ShaderManager::ClothComputeStage, Wind_Forces_Stage);
+    glDispatchCompute((numTriangles + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Reduces the energy and stability of the cloth as it is now into the reading the CPU will read back. Each work group sums its masses,
+// then a single group sums the groups. Same expectations as DispatchTearing
+void ClothManager::DispatchEnergyMeasurement() {
+    if (!adaptiveTimestep || energyFence != 0) return;
+    glUniform1i(ShaderManager::ClothNumMasses, NumMasses());
+    glUniform1i(ShaderManager::ClothFirstEnergyReading, energyReadingsThisFrame == 0);
+
+    DispatchStage(Measure_Energy_Stage);
+    glUniform1i(ShaderManager::ClothComputeStage, Sum_Energy_Stage);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    energyReadingsThisFrame++;
+}
+
+// Never waits. If the GPU hasn't got to the last frame's readings yet, they're picked up next frame
+void ClothManager::ReadBackEnergy() {
+    if (energyFence == 0) return;
+    GLenum status = glClientWaitSync(energyFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+    glDeleteSync(energyFence);
+    energyFence = 0;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, energySSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(energyReading), &lastEnergy);
+    AdaptTimestep(lastEnergy);
+}
+
+// Only the explicit integrator's timestep adapts, since the others take a fixed number of steps per frame. Backing off can't undo a
+// NaN that's already happened, but it keeps the next one from happening at the same timestep
+void ClothManager::AdaptTimestep(const energyReading &reading) {
+    float energy = reading.kinetic + reading.potential;
+    bool spiked = energy > ENERGY_SPIKE_FACTOR * lastReadEnergy + ENERGY_SPIKE_FLOOR;
+    lastReadEnergy = energy;
+    if (!adaptiveTimestep || simParameters.dt == 0 || integrator != Explicit_Integrator) return;  // Nothing to adapt
+
+    if (spiked || reading.numNans > 0 || reading.maxStrain > UNSTABLE_STRAIN) {
+        simParameters.dt = std::max(MIN_ADAPTIVE_TIMESTEP, simParameters.dt * TIMESTEP_BACKOFF);
+        calmReadings = 0;
+    } else if (++calmReadings >= CALM_READINGS_TO_GROW) {
+        simParameters.dt = std::min(MAX_ADAPTIVE_TIMESTEP, simParameters.dt * TIMESTEP_GROWTH);
+        calmReadings = 0;
+    }
+}
+
+// Static obstacles are built once. Ones that have moved since the last frame keep their tree's shape and just get their boxes refit,
+// and only their part of the buffers is uploaded again. Anything added or removed rebuilds everything
+void ClothManager::UpdateObstacles(const Environment &environment) {
+    std::vector<const GameObject *> current = environment.Obstacles();
+    if (int(current.size()) != obstacles.NumObstacles()) {
+        obstacles.Clear();
+        for (const GameObject *obstacle : current) {
+            obstacles.Add(*obstacle);
+        }
+        // Buffers can't be empty, so an environment without obstacles still gets a node. Nothing reads it
+        UploadBuffer(&obstacleNodeSSbo, obstacles.Nodes().empty() ? std::vector<bvhNode>(1) : obstacles.Nodes());
+        UploadBuffer(&obstacleTriangleSSbo, obstacles.Triangles().empty() ? std::vector<glm::vec4>(3) : obstacles.Triangles());
+
+        GLint numNodes = GLint(obstacles.Nodes().size());
+        glProgramUniform1i(ShaderManager::ClothComputeShader, ShaderManager::ClothObstacleNodes, numNodes);
+        glProgramUniform1i(ShaderManager::ClothTiledComputeShader, ShaderManager::ClothTiledObstacleNodes, numNodes);
+        glProgramUniform1i(ShaderManager::StrandComputeShader, ShaderManager::StrandObstacleNodes, numNodes);
+        return;
+    }
+
+    for (int i = 0; i < obstacles.NumObstacles(); i++) {
+        if (!obstacles.Moved(i, *current[i])) continue;
+        obstacles.Refit(i, *current[i]);
+
+        int firstNode = obstacles.FirstNode(i), firstTriangle = obstacles.FirstTriangle(i);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, obstacleNodeSSbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstNode * sizeof(bvhNode), obstacles.NumNodes(i) * sizeof(bvhNode),
+                        &obstacles.Nodes()[firstNode]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, obstacleTriangleSSbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * firstTriangle * sizeof(glm::vec4), 3 * obstacles.NumTriangles(i) * sizeof(glm::vec4),
+                        &obstacles.Triangles()[3 * firstTriangle]);
+    }
+}
+
+// Counting sorts the masses into a spatial hash of cells selfCollisionDistance wide, then has each mass look through its 27 cells for
+// masses that are too close. Each mass works out its own correction from the others' old state, so pairs need no atomics. Expects the
+// cloth compute shader to be in use and the SSBOs bound
+void ClothManager::DispatchSelfCollisions() {
+    if (simParameters.selfCollisionDistance == 0) return;
+    glUniform1i(ShaderManager::ClothNumMasses, NumMasses());
+
+    DispatchStage(Hash_Clear_Stage);
+    DispatchStage(Hash_Count_Stage);
+    DispatchStage(Hash_Scan_Groups_Stage);
+    glUniform1i(ShaderManager::ClothComputeStage, Hash_Scan_Totals_Stage);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    DispatchStage(Hash_Offset_Stage);
+    DispatchStage(Hash_Fill_Stage);
+
+    DispatchStage(Self_Collision_Stage);
+    DispatchStage(Apply_Self_Collision_Stage);
+}
+
+// Backward Euler, solving (M - h*dF/dv - h^2*dF/dx) * dv = h * (F + h * dF/dx * v) with a fixed number of block-Jacobi preconditioned
+// conjugate gradient iterations. The dot products are reduced per work group, then every group of the next stage sums the partials
+void ClothManager::ExecuteImplicitStep() {
+    if (simParameters.dt == 0) return;  // Paused
+    UpdateComputeParameters();
+    BindSSbos();
+
+    glUseProgram(ShaderManager::ClothComputeShader);
+    glUniform1f(ShaderManager::ClothImplicitDt, IMPLICIT_TIMESTEP);
+    glUniform1i(ShaderManager::ClothTopology, topology);
+    glUniform1i(ShaderManager::ClothObstacleSubsteps, IMPLICIT_STEPS_PER_FRAME);
+
+    for (int step = 0; step < IMPLICIT_STEPS_PER_FRAME; step++) {
+        glUniform1i(ShaderManager::ClothObstacleSubstep, step);
+        DispatchStage(Build_Implicit_System_Stage);
+        for (int iteration = 0; iteration < PCG_ITERATIONS; iteration++) {
+            glUniform1i(ShaderManager::ClothSolverIteration, iteration);
+            DispatchStage(Apply_System_Stage);
+            DispatchStage(Update_Solution_Stage);
+            DispatchStage(Update_Search_Direction_Stage);
+        }
+        DispatchStage(Finish_Implicit_Step_Stage);
+        DispatchSelfCollisions();
+        DispatchTearing();
+        DispatchStage(Normals_Stage);
+        DispatchEnergyMeasurement();
+    }
+    MaskTornTriangles();
+
+    UnbindSSbos();
+}
+
+// One XPBD step per frame: predict, project every constraint color (Gauss-Seidel within a color is free of conflicts), then derive
+// velocities from how far the masses moved
+void ClothManager::ExecuteXpbdStep() {
+    if (simParameters.dt == 0) return;  // Paused
+    UpdateComputeParameters();
+    BindSSbos();
+
+    glUseProgram(ShaderManager::ClothComputeShader);
+    glUniform1f(ShaderManager::ClothXpbdDt, XPBD_TIMESTEP);
+    glUniform1i(ShaderManager::ClothMassesPerThread, massesPerThread);
+    glUniform1i(ShaderManager::ClothTopology, topology);
+    glUniform1i(ShaderManager::ClothObstacleSubstep, 0);
+    glUniform1i(ShaderManager::ClothObstacleSubsteps, 1);
+
+    DispatchStage(Xpbd_Predict_Stage);
+    for (int iteration = 0; iteration < xpbdIterations; iteration++) {
+        for (int color = 0; color < XPBD_NUM_COLORS; color++) {
+            glUniform1i(ShaderManager::ClothXpbdColor, color);
+            DispatchStage(Xpbd_Constraint_Stage);
+        }
+        DispatchStage(Xpbd_Collision_Stage);
+    }
+    DispatchStage(Xpbd_Velocity_Stage);
+    DispatchSelfCollisions();
+    DispatchTearing();
+    DispatchStage(Normals_Stage);
+    DispatchEnergyMeasurement();
+    MaskTornTriangles();
+
+    UnbindSSbos();
+}
+
+// Each strand takes the whole frame's substeps in shared memory, so the frame is a single dispatch
+void ClothManager::ExecuteStrandStep() {
+    if (simParameters.dt == 0) return;  // Paused
+    UpdateComputeParameters();
+    BindSSbos();
+
+    glUseProgram(ShaderManager::StrandComputeShader);
+    glUniform1i(ShaderManager::StrandNumStrands, numThreads);
+    glUniform1i(ShaderManager::StrandMassesPerStrand, massesPerThread);
+    glUniform1i(ShaderManager::StrandSlot, StrandSlot());
+    glUniform1i(ShaderManager::StrandSubsteps, STRAND_SUBSTEPS_PER_FRAME);
+    glUniform1i(ShaderManager::StrandIterations, STRAND_ITERATIONS);
+    glUniform1f(ShaderManager::StrandFrameTime, XPBD_TIMESTEP);
+    glUniform1i(ShaderManager::StrandWindMode, windMode);
+    glUniform1f(ShaderManager::StrandWindTime, windTime);
+
+    glDispatchCompute(StrandWorkGroups(), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    UnbindSSbos();
+}
+
+void ClothManager::Simulate() {
+    ReadBackEnergy();
+    energyReadingsThisFrame = 0;
+
+    if (topology == Strand_Topology) {
+        ExecuteStrandStep();
+    } else if (integrator == Implicit_Euler) {
+        ExecuteImplicitStep();
+    } else if (integrator == Xpbd && solver == Cpu_Solver) {
+        if (simParameters.dt > 0) {  // Not paused
+            cpuSolver->StepXpbd(simParameters, XPBD_TIMESTEP, xpbdIterations);
+            cpuSolver->Upload(false);
+        }
+    } else if (integrator == Xpbd) {
+        ExecuteXpbdStep();
+    } else if (solver == Cpu_Solver) {
+        cpuSolver->Step(simParameters, ExplicitSubsteps(), explicitScheme, windMode, windTime);
+        cpuSolver->Upload(false);
+    } else {
+        ExecuteComputeShader();
+    }
+    if (topology == Strand_Topology) {
+        if (simParameters.dt > 0) windTime += XPBD_TIMESTEP;
+    } else if (integrator == Explicit_Integrator) {
+        windTime += ExplicitSubsteps() * simParameters.dt;
+    }
+
+    // The CPU solver keeps its velocities to itself, so only the GPU gets measured
+    if (energyReadingsThisFrame > 0) energyFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // The next frame sweeps the obstacle on from here
+    simParameters.lastObstacleCenterX = simParameters.obstacleCenterX;
+    simParameters.lastObstacleCenterY = simParameters.obstacleCenterY;
+    simParameters.lastObstacleCenterZ = simParameters.obstacleCenterZ;
+}
+
+void ClothManager::SetSolver(ClothSolver newSolver) {
+    if (newSolver == solver) return;
+    if (newSolver == Cpu_Solver && topology == Strand_Topology) {
+        printf("The strands only run on the GPU\n");
+        return;
+    }
+    if (newSolver == Cpu_Solver && integrator == Implicit_Euler) {
+        printf("The implicit integrator only runs on the GPU\n");
+        return;
+    }
+    if (newSolver == Cpu_Solver && springsMayBeTorn) {  // The CPU solver would join the torn springs back up
+        printf("Torn springs only exist on the GPU. Turn tearing off and change the cloth's resolution or shape to mend it first\n");
+        return;
+    }
+
+    if (!cpuSolver) cpuSolver.reset(new ClothCpuSolver());
+    if (newSolver == Cpu_Solver) {
+        cpuSolver->Download();
+    } else {
+        cpuSolver->Upload(true);  // The GPU picks up where the CPU left off
+    }
+    solver = newSolver;
+}
+
+void ClothManager::SetIntegrator(ClothIntegrator newIntegrator) {
+    if (newIntegrator == Implicit_Euler && solver == Cpu_Solver) {
+        printf("The implicit integrator only runs on the GPU\n");
+        return;
+    }
+    if (newIntegrator == Xpbd && topology != Grid_Topology) {
+        printf("The XPBD integrator's constraint colors only work on a grid\n");
+        return;
+    }
+    integrator = newIntegrator;
+}
+
+// The shader's variant for the scheme takes over. The CPU solver is handed the scheme with every step
+void ClothManager::SetExplicitScheme(ExplicitScheme newScheme) {
+    explicitScheme = newScheme;
+    ShaderManager::UseClothComputeVariant(newScheme);
+}
+
+bool ClothManager::IntegratorAvailable(ClothIntegrator candidate) const {
+    if (candidate == Implicit_Euler) return solver == Gpu_Solver;
+    if (candidate == Xpbd) return topology == Grid_Topology;
+    return true;
+}
+
+// Switches between the grid, the mesh in CLOTH_MESH_FILE, the batch and the strands. The cloth starts over. The strands have a resolution
+// of their own, and the grid gets its back afterwards
+void ClothManager::SetTopology(ClothTopology newTopology) {
+    if (newTopology == Mesh_Topology && !clothMesh) clothMesh.reset(new Model(CLOTH_MESH_FILE, false));
+    if (newTopology == Batch_Topology && batch.empty()) BuildBatch();
+    if (newTopology != Grid_Topology && integrator == Xpbd) {
+        printf("The XPBD integrator only works on a grid, switching to the explicit one\n");
+        integrator = Explicit_Integrator;
+    }
+    if (newTopology == Strand_Topology && solver == Cpu_Solver) {
+        printf("The strands only run on the GPU, switching to it\n");
+        solver = Gpu_Solver;  // Nothing to hand over, since everything starts over
+    }
+
+    if (topology == Strand_Topology && newTopology != Strand_Topology) {
+        numThreads = clothThreads;
+        massesPerThread = clothMassesPerThread;
+        simParameters.restLength = 0.4 * CLOTH_HEIGHT / float(massesPerThread);
+    }
+    if (topology != Strand_Topology && newTopology == Strand_Topology) {
+        clothThreads = numThreads;
+        clothMassesPerThread = massesPerThread;
+        topology = newTopology;
+        ResizeStrands(DEFAULT_NUM_STRANDS, DEFAULT_MASSES_PER_STRAND);
+        return;
+    }
+
+    topology = newTopology;
+    Rebuild();
+}
+
+// Reallocates everything for a new number of strands, each STRAND_LENGTH long however many masses it has. They start over
+void ClothManager::ResizeStrands(int strands, int massesPerStrand) {
+    assert(topology == Strand_Topology && massesPerStrand >= 2 && massesPerStrand <= MAX_STRAND_MASSES);
+    numThreads = strands;
+    massesPerThread = massesPerStrand;
+    simParameters.restLength = STRAND_LENGTH / float(massesPerThread - 1);
+    Rebuild();
+}
+
+// A curtain, a flag on a pole and two capes, all hanging from their first row. Each instance is triangulated the same way as the grid
+void ClothManager::BuildBatch() {
+    batch = {{{0, -4, 20}, {0, 0, -10}, {0, 12, 0}, 64, 48, 10, 1},
+             {{0, 12, 20}, {10, 0, 0}, {0, 0, -6}, 48, 64, 5, 0.5f},
+             {{-6, 0, 16}, {0, 0, -6}, {0, 4, 0}, 24, 36, 3, 2},
+             {{-6, 8, 16}, {0, 0, -6}, {0, 4, 0}, 24, 36, 3, 2}};
+    batchVertices.clear();
+    batchIndices.clear();
+
+    for (clothInstance &instance : batch) {
+        instance.firstMass = int(batchVertices.size());
+        instance.firstIndex = int(batchIndices.size());
+        for (int strand = 0; strand < instance.strands; strand++) {
+            for (int along = 0; along < instance.massesPerStrand; along++) {
+                batchVertices.push_back(instance.corner + instance.across * (strand / float(instance.strands - 1)) +
+                                        instance.along * (along / float(instance.massesPerStrand - 1)));
+            }
+        }
+
+        for (int strand = 0; strand < instance.strands - 1; strand++) {
+            for (int along = 0; along < instance.massesPerStrand - 1; along++) {
+                GLuint corner = instance.firstMass + strand * instance.massesPerStrand + along;
+                GLuint nextStrand = corner + instance.massesPerStrand;
+                batchIndices.insert(batchIndices.end(), {corner, corner + 1, nextStrand, corner + 1, nextStrand + 1, nextStrand});
+            }
+        }
+        instance.numIndices = int(batchIndices.size()) - instance.firstIndex;
+    }
+}
+
+const clothInstance &ClothManager::InstanceOf(int mass) {
+    auto after = std::upper_bound(batch.begin(), batch.end(), mass,
+                                  [](int m, const clothInstance &instance) { return m < instance.firstMass; });
+    return *(after - 1);
+}
+
+// Turning tearing off leaves what's already torn alone. The cloth heals when it's rebuilt
+void ClothManager::SetTearing(bool enabled) {
+    tearing = enabled;
+    simParameters.tearStrain = enabled ? TEAR_STRAIN : 0;
+    if (enabled) springsMayBeTorn = true;
+    SetTethers(tethers);
+}
+
+void ClothManager::SetTethers(bool enabled) {
+    tethers = enabled;
+    simParameters.tetherStretch = enabled && !springsMayBeTorn ? TETHER_STRETCH : 0;
+}
+
+// The explicit timestep goes back to the default when it stops adapting
+void ClothManager::SetAdaptiveTimestep(bool enabled) {
+    adaptiveTimestep = enabled;
+    if (!enabled && simParameters.dt > 0) simParameters.dt = COMPUTE_SHADER_TIMESTEP;
+}
+
+// Enough substeps of dt to make up a frame. Paused frames still take the default number, without moving anything
+int ClothManager::ExplicitSubsteps() const {
+    if (simParameters.dt == 0) return COMPUTES_PER_FRAME;
+    return std::max(1, int((1 / IDEAL_FRAMERATE) / simParameters.dt + 0.5f));
+}
+
+// Tiles only make sense on a grid, and only while it has all of its springs. The tiled kernel only has the midpoint scheme
+bool ClothManager::UsesTiledDispatch() const {
+    return integrator == Explicit_Integrator && explicitScheme == Midpoint_Scheme && solver == Gpu_Solver && tiledDispatch &&
+           topology == Grid_Topology && !springsMayBeTorn && windMode == Normal_Drag && !UsesMultiresolution();
+}
+
+// The coarse grid steps with the tiled kernel, so it needs the same grid of springs and still air. It wouldn't know about any torn springs
+bool ClothManager::UsesMultiresolution() const {
+    return multiresolution && integrator == Explicit_Integrator && solver == Gpu_Solver && topology == Grid_Topology &&
+           !springsMayBeTorn && windMode == Normal_Drag;
+}
+
+// The coarse grid takes this many substeps per frame, each MULTIRESOLUTION_FACTOR times as long as the fine grid's
+int ClothManager::MultiresolutionSubsteps() const {
+    return std::max(1, int(ExplicitSubsteps() / float(MULTIRESOLUTION_FACTOR) + 0.5f));
+}
+
+// Masses that don't share a spring are at least the shortest spring apart at rest, so that's as close as they may get. Any closer and a
+// mass could slip through the gap between four others
+void ClothManager::SetSelfCollisions(bool enabled) {
+    selfCollisions = enabled;
+    float shortest = springs.restLengths.empty() ? 0 : *std::min_element(springs.restLengths.begin(), springs.restLengths.end());
+    simParameters.selfCollisionDistance = enabled ? shortest : 0;
+}
+
+// Runs one frame on both solvers from the same state and reports how far apart they end up. The GPU keeps its result
+void ClothManager::CompareSolvers() {
+    if (topology == Strand_Topology) {
+        printf("The strands only run on the GPU, so there's nothing to compare\n");
+        return;
+    }
+    if (springsMayBeTorn) {
+        printf("Torn springs only exist on the GPU, so the CPU can't step the same cloth\n");
+        return;
+    }
+    if (!cpuSolver) cpuSolver.reset(new ClothCpuSolver());
+    if (solver == Cpu_Solver) cpuSolver->Upload(true);
+    cpuSolver->Download();
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    int substeps = ExplicitSubsteps();
+    ExecuteComputeShader();
+    glFinish();
+    auto gpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    startTime = std::chrono::high_resolution_clock::now();
+    cpuSolver->Step(simParameters, substeps, explicitScheme, windMode, windTime);
+    auto cpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    float rmsDifference;
+    float maxDifference = cpuSolver->MaxDifferenceFromGPU(&rmsDifference);
+    printf("After %i steps - GPU: %.3fms, CPU (%d threads): %.3fms, max position difference: %g, RMS: %g\n", substeps, gpuTime,
+           cpuSolver->GetNumWorkers(), cpuTime, maxDifference, rmsDifference);
+
+    if (solver == Cpu_Solver) cpuSolver->Download();
+}
+
+// Reallocates everything for a new grid resolution. The cloth starts over
+void ClothManager::Resize(int strands, int massesPerStrand) {
+    numThreads = strands;
+    massesPerThread = massesPerStrand;
+    simParameters.restLength = 0.4 * CLOTH_HEIGHT / float(massesPerThread);
+    topology = Grid_Topology;
+    Rebuild();
+}
+
+// Reallocates everything for the current topology and resolution
+void ClothManager::Rebuild() {
+    InitGL();
+
+    GLint previousVAO;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+    glBindVertexArray(ShaderManager::ClothShader.VAO);
+    InitClothTexcoords();
+    InitClothIBO();
+    glBindVertexArray(previousVAO);
+
+    // The CPU solver's arrays are sized for the old cloth
+    cpuSolver.reset();
+    if (solver == Cpu_Solver) {
+        cpuSolver.reset(new ClothCpuSolver());
+        cpuSolver->Download();
+    }
+}
+
+// Times the current integrator and solver on grids from 32x32 to 1024x1024 masses, then goes back to the original cloth
+void ClothManager::RunScalingBenchmark() {
+    int originalThreads = numThreads, originalMassesPerThread = massesPerThread;
+    ClothTopology originalTopology = topology;
+    float originalDt = simParameters.dt;
+    simParameters.dt = COMPUTE_SHADER_TIMESTEP;  // Paused frames would skip the step
+
+    printf("%-12s %8s %8s %12s %16s\n", "Resolution", "Masses", "Frames", "ms/frame", "ns/mass/frame");
+    for (int side = BENCHMARK_MIN_SIDE; side <= BENCHMARK_MAX_SIDE; side *= 2) {
+        Resize(side, side);
+        Simulate();  // Warm up
+        glFinish();
+
+        int frames = 0;
+        double elapsed = 0;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        while (frames < BENCHMARK_MAX_FRAMES && elapsed < BENCHMARK_MS_PER_RESOLUTION) {
+            Simulate();
+            glFinish();
+            frames++;
+            elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        }
+
+        double msPerFrame = elapsed / frames;
+        printf("%4dx%-7d %8d %8d %12.3f %16.3f\n", side, side, NumMasses(), frames, msPerFrame, msPerFrame * 1e6 / NumMasses());
+    }
+
+    Resize(originalThreads, originalMassesPerThread);
+    if (originalTopology != Grid_Topology) SetTopology(originalTopology);
+    simParameters.dt = originalDt;
+}
+
+// Times frames of the strands at every count from BENCHMARK_MIN_STRANDS to BENCHMARK_MAX_STRANDS, at the current masses per strand, then
+// goes back to the original number of them
+void ClothManager::RunStrandBenchmark() {
+    if (topology != Strand_Topology) {
+        printf("The strand benchmark only runs on the strands\n");
+        return;
+    }
+    int originalStrands = numThreads;
+    float originalDt = simParameters.dt;
+    simParameters.dt = COMPUTE_SHADER_TIMESTEP;  // Paused frames would skip the step
+
+    printf("%-8s %8s %8s %8s %12s %16s\n", "Strands", "Masses", "Length", "Frames", "ms/frame", "ns/mass/frame");
+    for (int strands = BENCHMARK_MIN_STRANDS; strands <= BENCHMARK_MAX_STRANDS; strands *= 2) {
+        ResizeStrands(strands, massesPerThread);
+        Simulate();  // Warm up
+        glFinish();
+
+        int frames = 0;
+        double elapsed = 0;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        while (frames < BENCHMARK_MAX_FRAMES && elapsed < BENCHMARK_MS_PER_RESOLUTION) {
+            Simulate();
+            glFinish();
+            frames++;
+            elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        }
+
+        double msPerFrame = elapsed / frames;
+        printf("%-8d %8d %8d %8d %12.3f %16.3f\n", strands, NumMasses(), massesPerThread, frames, msPerFrame,
+               msPerFrame * 1e6 / NumMasses());
+    }
+
+    ResizeStrands(originalStrands, massesPerThread);
+    simParameters.dt = originalDt;
+}
+
+// Lets the cloth fall and hang for BENCHMARK_HANG_FRAMES with XPBD at every iteration count up to BENCHMARK_MAX_ITERATIONS, without and
+// with tethers, and reports how stretched its springs end up. The cloth starts over for each, and once more at the end
+void ClothManager::RunTetherBenchmark() {
+    if (topology != Grid_Topology) {
+        printf("The tether benchmark uses the XPBD integrator, which only works on a grid\n");
+        return;
+    }
+    ClothIntegrator originalIntegrator = integrator;
+    int originalIterations = xpbdIterations;
+    bool originalTethers = tethers;
+    float originalDt = simParameters.dt;
+    integrator = Xpbd;
+    simParameters.dt = COMPUTE_SHADER_TIMESTEP;  // Paused frames would skip the step
+
+    printf("%-8s %10s %12s %14s %14s\n", "Tethers", "Iterations", "ms/frame", "Mean stretch", "Max stretch");
+    for (bool withTethers : {false, true}) {
+        for (int iterations = 1; iterations <= BENCHMARK_MAX_ITERATIONS; iterations *= 2) {
+            xpbdIterations = iterations;
+            tethers = withTethers;
+            Rebuild();
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            for (int frame = 0; frame < BENCHMARK_HANG_FRAMES; frame++) {
+                Simulate();
+            }
+            glFinish();
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+            float meanStretch;
+            float maxStretch = MeasureStretch(&meanStretch);
+            printf("%-8s %10d %12.3f %13.3f%% %13.3f%%\n", withTethers ? "on" : "off", iterations, elapsed / BENCHMARK_HANG_FRAMES,
+                   100 * meanStretch, 100 * maxStretch);
+        }
+    }
+
+    integrator = originalIntegrator;
+    xpbdIterations = originalIterations;
+    tethers = originalTethers;
+    simParameters.dt = originalDt;
+    Rebuild();
+}
+
+// For each explicit scheme on the current solver, finds the largest dt that the cloth survives falling from the start at, and what a
+// simulated second costs at that dt. Only the midpoint scheme has a tiled kernel, so tiling is off to keep every scheme's dispatches the
+// same. The cloth starts over for each trial, and once more at the end
+void ClothManager::RunIntegratorBenchmark() {
+    ClothIntegrator originalIntegrator = integrator;
+    ExplicitScheme originalScheme = explicitScheme;
+    bool originalTiled = tiledDispatch, originalAdaptive = adaptiveTimestep;
+    float originalDt = simParameters.dt;
+    integrator = Explicit_Integrator;
+    tiledDispatch = false;
+    adaptiveTimestep = false;
+
+    const char *schemeNames[] = {"Euler", "Midpoint", "Spring RK4", "Verlet"};
+    printf("%-10s %16s %16s %26s\n", "Scheme", "Largest dt (ms)", "Substeps/frame", "ms per simulated second");
+    for (int scheme = 0; scheme < NUM_EXPLICIT_SCHEMES; scheme++) {
+        SetExplicitScheme(ExplicitScheme(scheme));
+        float stable = 0, unstable = 0;
+        double cost = 0, trialCost;
+        for (float dt = BENCHMARK_MIN_TIMESTEP; dt <= BENCHMARK_MAX_TIMESTEP && unstable == 0; dt *= 2) {
+            if (StaysStable(dt, &trialCost)) {
+                stable = dt, cost = trialCost;
+            } else {
+                unstable = dt;
+            }
+        }
+        for (int i = 0; i < BENCHMARK_BISECTIONS && stable > 0 && unstable > 0; i++) {
+            float dt = std::sqrt(stable * unstable);
+            if (StaysStable(dt, &trialCost)) {
+                stable = dt, cost = trialCost;
+            } else {
+                unstable = dt;
+            }
+        }
+
+        if (stable == 0) {
+            printf("%-10s %16s\n", schemeNames[scheme], "none");
+            continue;
+        }
+        simParameters.dt = stable;
+        printf("%-10s %16.4f %16d %26.1f\n", schemeNames[scheme], 1000 * stable, ExplicitSubsteps(), cost);
+    }
+    printf("Midpoint and spring RK4 only sample each spring on its own, with the rest of the cloth held still, so they aren't the\n"
+           "midpoint method or RK4 on the whole cloth\n");
+
+    integrator = originalIntegrator;
+    SetExplicitScheme(originalScheme);
+    tiledDispatch = originalTiled;
+    adaptiveTimestep = originalAdaptive;
+    simParameters.dt = originalDt;
+    Rebuild();
+}
+
+// Lets the cloth fall from the start for BENCHMARK_STABILITY_FRAMES at dt. It's stable if no spring ends up stretched past
+// UNSTABLE_STRAIN times its rest length
+bool ClothManager::StaysStable(float dt, double *msPerSimulatedSecond) {
+    simParameters.dt = dt;
+    Rebuild();
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < BENCHMARK_STABILITY_FRAMES; frame++) {
+        Simulate();
+    }
+    glFinish();
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    *msPerSimulatedSecond = elapsed / (BENCHMARK_STABILITY_FRAMES * ExplicitSubsteps() * dt);
+
+    float meanStretch;
+    return MeasureStretch(&meanStretch) + 1 < UNSTABLE_STRAIN;
+}
+
+// How far the springs are stretched past their rest lengths, as a fraction of them. Springs that are shorter count as 0, and a cloth
+// with any mass that isn't finite is infinitely stretched
+float ClothManager::MeasureStretch(float *meanStretch) const {
+    std::vector<position> positions(NumMasses());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, posSSbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(position), positions.data());
+
+    double total = 0;
+    float largest = 0;
+    for (int i = 0; i < NumMasses(); i++) {
+        glm::vec3 p1(positions[i].x, positions[i].y, positions[i].z);
+        if (!std::isfinite(p1.x) || !std::isfinite(p1.y) || !std::isfinite(p1.z)) {
+            *meanStretch = largest = std::numeric_limits<float>::infinity();
+            return largest;
+        }
+        for (GLuint s = springs.offsets[i]; s < springs.offsets[i + 1]; s++) {
+            const position &other = positions[springs.neighbours[s]];
+            float stretch = std::max(0.0f, glm::distance(p1, glm::vec3(other.x, other.y, other.z)) / springs.restLengths[s] - 1);
+            total += stretch;
+            largest = std::max(largest, stretch);
+        }
+    }
+    *meanStretch = NumSprings() > 0 ? float(total / NumSprings()) : 0;
+    return largest;
+}
+
 void ClothManager::InitClothTexcoords() {
-    glGenBuffers(1, &ShaderManager::ClothShader.VBO);
+    if (ShaderManager::ClothShader.VBO == 0) glGenBuffers(1, &ShaderManager::ClothShader.VBO);
     glBindBuffer(GL_ARRAY_BUFFER, ShaderManager::ClothShader.VBO);
-    glBufferData(GL_ARRAY_BUFFER, NUM_MASSES * sizeof(texcoord), nullptr, GL_STATIC_DRAW);
-    auto texcoords = (texcoord *)glMapBufferRange(GL_ARRAY_BUFFER, 0, NUM_MASSES * sizeof(texcoord), bufMask);
+    glBufferData(GL_ARRAY_BUFFER, NumMasses() * sizeof(texcoord), nullptr, GL_STATIC_DRAW);
+    auto texcoords = (texcoord *)glMapBufferRange(GL_ARRAY_BUFFER, 0, NumMasses() * sizeof(texcoord), bufMask);
 
-    for (int i = 0; i < NUM_MASSES; i++) {
-        int threadnum = i / MASSES_PER_THREAD;
-        int y = i % MASSES_PER_THREAD;
+    if (topology == Batch_Topology) {  // Each instance gets the whole texture, like the grid
+        for (const clothInstance &instance : batch) {
+            for (int i = 0; i < instance.strands * instance.massesPerStrand; i++) {
+                texcoords[instance.firstMass + i].u = (i / instance.massesPerStrand) / float(instance.strands);
+                texcoords[instance.firstMass + i].v = (i % instance.massesPerStrand) / float(instance.massesPerStrand);
+            }
+        }
+    } else if (topology == Mesh_Topology) {  // Projected straight down onto the mesh's bounding box
+        const std::vector<glm::vec3> &vertices = clothMesh->IndexedVertices();
+        glm::vec3 lower = vertices[0], upper = vertices[0];
+        for (const glm::vec3 &vertex : vertices) {
+            lower = glm::min(lower, vertex);
+            upper = glm::max(upper, vertex);
+        }
+
+        glm::vec3 size = glm::max(upper - lower, glm::vec3(ABSOLUTE_TOLERANCE));
+        for (int i = 0; i < NumMasses(); i++) {
+            texcoords[i].u = (vertices[i].x - lower.x) / size.x;
+            texcoords[i].v = (vertices[i].y - lower.y) / size.y;
+        }
+    } else {
+        for (int i = 0; i < NumMasses(); i++) {
+            int threadnum = i / massesPerThread;
+            int y = i % massesPerThread;
 
-        float u = threadnum / float(NUM_THREADS);
-        float v = y / float(MASSES_PER_THREAD);
+            float u = threadnum / float(numThreads);
+            float v = y / float(massesPerThread);
 
-        texcoords[i].u = u;
-        texcoords[i].v = v;
+            texcoords[i].u = u;
+            texcoords[i].v = v;
+        }
     }
 
     GLint texAttrib = glGetAttribLocation(ShaderManager::ClothShader.Program, "inTexcoord");
@@ -203,20 +1352,50 @@ void ClothManager::InitClothTexcoords() {
     glUnmapBuffer(GL_ARRAY_BUFFER);
 }
 
+// The triangles are also kept in triangleSSbo, which the IBO is masked from as the cloth tears. Strands have no triangles, and their IBO
+// is lines instead
 void ClothManager::InitClothIBO() {
-    assert(NUM_TRIANGLE_INDICES % 3 == 0);
-    assert(TRIANGLES_PER_THREAD % 2 == 0);
+    if (topology == Strand_Topology) {
+        std::vector<GLuint> indices;
+        indices.reserve(NumLineIndices());
+        for (int strand = 0; strand < numThreads; strand++) {
+            for (int along = 0; along < massesPerThread - 1; along++) {
+                GLuint mass = strand * massesPerThread + along;
+                indices.insert(indices.end(), {mass, mass + 1});
+            }
+        }
 
-    glGenBuffers(1, &ShaderManager::ClothShader.IBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ShaderManager::ClothShader.IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, NUM_TRIANGLE_INDICES * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
-    auto indices = (GLuint *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, NUM_TRIANGLE_INDICES * sizeof(GLuint), bufMask);
-
-    glm::uvec3 evenBaseTriangleIndices = {0, 1, MASSES_PER_THREAD};
-    glm::uvec3 oddBaseTriangleIndices = {1, MASSES_PER_THREAD + 1, MASSES_PER_THREAD};
-    for (int i = 0; i < NUM_TRIANGLES; i++) {
-        int y = (i / 2) % (TRIANGLES_PER_THREAD / 2);
-        int threadnum = i / TRIANGLES_PER_THREAD;
+        BuildTriangleAdjacency({});
+        UploadBuffer(&triangleSSbo, std::vector<GLuint>(3));  // Buffers can't be empty. Nothing reads it
+        if (ShaderManager::ClothShader.IBO == 0) glGenBuffers(1, &ShaderManager::ClothShader.IBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ShaderManager::ClothShader.IBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+        return;
+    }
+
+    if (topology != Grid_Topology) {
+        const std::vector<unsigned int> &indices = MeshTriangleIndices();
+        BuildTriangleAdjacency(indices);
+        UploadBuffer(&triangleSSbo, indices);
+        if (ShaderManager::ClothShader.IBO == 0) glGenBuffers(1, &ShaderManager::ClothShader.IBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ShaderManager::ClothShader.IBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+        return;
+    }
+
+    const int trianglesPerThread = 2 * (massesPerThread - 1);
+    const int numTriangles = trianglesPerThread * (numThreads - 1);
+    const int numTriangleIndices = NumTriangleIndices();
+    assert(numTriangleIndices % 3 == 0);
+    assert(trianglesPerThread % 2 == 0);
+
+    std::vector<GLuint> indices(numTriangleIndices);
+
+    glm::uvec3 evenBaseTriangleIndices = glm::uvec3(0, 1, massesPerThread);
+    glm::uvec3 oddBaseTriangleIndices = glm::uvec3(1, massesPerThread + 1, massesPerThread);
+    for (int i = 0; i < numTriangles; i++) {
+        int y = (i / 2) % (trianglesPerThread / 2);
+        int threadnum = i / trianglesPerThread;
         glm::uvec3 baseIndices;
         if (i % 2 == 0) {
             baseIndices = evenBaseTriangleIndices;
@@ -224,24 +1403,51 @@ void ClothManager::InitClothIBO() {
             baseIndices = oddBaseTriangleIndices;
         }
 
-        baseIndices += glm::uvec3(MASSES_PER_THREAD * threadnum);
+        baseIndices += glm::uvec3(massesPerThread * threadnum);
         glm::uvec3 triangleIndices = baseIndices + glm::uvec3(y);
 
         int indexBaseIndex = i * 3;
-        assert(indexBaseIndex < NUM_TRIANGLE_INDICES);
+        assert(indexBaseIndex < numTriangleIndices);
 
         indices[indexBaseIndex] = triangleIndices[0];
         indices[indexBaseIndex + 1] = triangleIndices[1];
         indices[indexBaseIndex + 2] = triangleIndices[2];
     }
 
-    /*for (int i = 0; i < NUM_TRIANGLE_INDICES; i++) {
+    /*for (int i = 0; i < numTriangleIndices; i++) {
         printf("%u, ", indices[i]);
 
         if (i % 3 == 2) printf("\n");
     }*/
 
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    BuildTriangleAdjacency(indices);
+    UploadBuffer(&triangleSSbo, indices);
+    if (ShaderManager::ClothShader.IBO == 0) glGenBuffers(1, &ShaderManager::ClothShader.IBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ShaderManager::ClothShader.IBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numTriangleIndices * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+}
+
+// Counts each mass' triangles, then fills them in, and uploads the lot along with room for the triangles' wind forces
+void ClothManager::BuildTriangleAdjacency(const std::vector<GLuint> &indices) {
+    massTriangles.corners = indices;
+    massTriangles.offsets.assign(NumAllocatedMasses() + 1, 0);
+    for (GLuint corner : indices) {
+        massTriangles.offsets[corner + 1]++;
+    }
+    for (int i = 0; i < NumAllocatedMasses(); i++) {
+        massTriangles.offsets[i + 1] += massTriangles.offsets[i];
+    }
+
+    std::vector<GLuint> filled(massTriangles.offsets.begin(), massTriangles.offsets.end() - 1);
+    massTriangles.triangles.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        massTriangles.triangles[filled[indices[i]]++] = GLuint(i / 3);
+    }
+
+    UploadBuffer(&triangleOffsetSSbo, massTriangles.offsets);
+    // Buffers can't be empty, and the strands have no triangles. Nothing reads it then
+    UploadBuffer(&massTriangleSSbo, indices.empty() ? std::vector<GLuint>(1) : massTriangles.triangles);
+    PrepareBuffer(&triangleForceSSbo, std::max<size_t>(indices.size() / 3, 1) * sizeof(glm::vec4), GL_DYNAMIC_COPY);
 }
 
 void ClothManager::RenderParticles(float dt, Environment *environment) {
@@ -256,7 +1462,20 @@ void ClothManager::RenderParticles(float dt, Environment *environment) {
     glUniform1i(ShaderManager::ClothShader.Attributes.texID, TEX0);                       // Set which texture to use
     glUniform1f(ShaderManager::EnvironmentShader.Attributes.specFactor, 0.2);
 
-    glDrawElements(GL_TRIANGLES, NUM_TRIANGLE_INDICES, GL_UNSIGNED_INT, (void *)0);
+    if (topology == Batch_Topology) {  // Every instance's indices are already into the shared buffers, so they need no base vertex
+        std::vector<GLsizei> counts;
+        std::vector<const void *> offsets;
+        for (const clothInstance &instance : batch) {
+            counts.push_back(instance.numIndices);
+            offsets.push_back((void *)(instance.firstIndex * sizeof(GLuint)));
+        }
+        glMultiDrawElements(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(), GLsizei(batch.size()));
+    } else if (topology == Strand_Topology) {  // Plain colored lines, since a strand is too thin to show a texture
+        glUniform1i(ShaderManager::ClothShader.Attributes.texID, -1);
+        glDrawElements(GL_LINES, NumLineIndices(), GL_UNSIGNED_INT, (void *)0);
+    } else {
+        glDrawElements(GL_TRIANGLES, NumTriangleIndices(), GL_UNSIGNED_INT, (void *)0);
+    }
 
     glBindVertexArray(ShaderManager::EnvironmentShader.VAO);
 }
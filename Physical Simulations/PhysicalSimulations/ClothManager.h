@@ -1,16 +1,25 @@
 #pragma once
+#include <memory>
+#include <vector>
+#include "Constants.h"
 #include "Model.h"
+#include "ObstacleBvh.h"
 #include "glad.h"
 
 class Environment;
+class ClothCpuSolver;
 
 struct simParams {
     GLfloat obstacleCenterX, obstacleCenterY, obstacleCenterZ;
     GLfloat obstacleRadius;
     GLfloat dt;
-    GLfloat ks;
+    GLfloat ks;          // Structural springs. Other spring types scale these, and each spring gets its own copy
     GLfloat kd;
-    GLfloat restLength;
+    GLfloat restLength;  // Between neighbouring masses of the grid
+    GLfloat selfCollisionDistance;  // Closest two masses that don't share a spring can get. 0 when self-collision is off
+    GLfloat lastObstacleCenterX, lastObstacleCenterY, lastObstacleCenterZ;  // Where the obstacle was at the end of the last frame
+    GLfloat tearStrain;  // Springs break when stretched past this many times their rest length. 0 when tearing is off
+    GLfloat tetherStretch;  // How far past its rest distance from its anchor a mass can get. 0 when tethers are off
 };
 
 struct position {
@@ -39,30 +48,238 @@ struct texcoord {
     GLfloat u, v;
 };
 
+// A mass' long-range attachment to the pinned mass it's closest to along the cloth
+struct tether {
+    GLuint anchor;  // BAD_INDEX for pinned masses, and ones with no way to a pinned mass
+    GLfloat length;  // Along the springs at rest
+};
+
+// Springs in compressed sparse row form. Mass i's springs are entries offsets[i] through offsets[i + 1] - 1 of the other arrays
+struct springAdjacency {
+    std::vector<GLuint> offsets;
+    std::vector<GLuint> neighbours;
+    std::vector<GLfloat> restLengths;
+    std::vector<GLfloat> stiffnesses;
+    std::vector<GLfloat> dampings;
+    std::vector<GLuint> oppositeMasses;  // Third corner of the triangle to the spring's left, for mesh normals. BAD_INDEX if none
+};
+
+// The cloth's triangles, and each mass' triangles in compressed sparse row form so their forces can be gathered instead of scattered.
+// Mass i's triangles are entries offsets[i] through offsets[i + 1] - 1 of triangles
+struct triangleAdjacency {
+    std::vector<GLuint> corners;  // Three masses per triangle
+    std::vector<GLuint> offsets;
+    std::vector<GLuint> triangles;
+};
+
+// Structural springs join neighbours, shear springs join diagonal neighbours and bend springs skip over a mass. A mesh's bend springs
+// join the far corners of the two triangles on either side of an edge, and it has no shear springs since triangles can't shear
+enum SpringType { Structural_Spring = 0, Shear_Spring = 1, Bend_Spring = 2 };
+
+// Where the other end of one of a grid mass' springs is, in strands and in masses along the strand
+struct gridSpring {
+    int strands, masses;
+    SpringType type;
+};
+
+enum ClothSolver { Gpu_Solver = 0, Cpu_Solver = 1 };
+
+enum ClothIntegrator { Explicit_Integrator = 0, Implicit_Euler = 1, Xpbd = 2, NUM_CLOTH_INTEGRATORS };
+
+// How the explicit integrator steps. Euler, midpoint and spring RK4 differ in how many samples of each spring they take over a substep,
+// Verlet steps from the last position. The samples move only the mass itself, with the spring's other end, gravity, drag and the mass'
+// other springs held at the start of the substep. So spring RK4 is RK4 on each spring alone, not on the whole cloth, and its stable dt
+// says nothing about RK4's. Each is its own variant of clothComputeShader.glsl, so the values must match its EXPLICIT_SCHEME ones
+enum ExplicitScheme { Euler_Scheme = 0, Midpoint_Scheme = 1, Spring_Rk4_Scheme = 2, Verlet_Scheme = 3, NUM_EXPLICIT_SCHEMES };
+
+// How the air acts on the cloth. Still air drags each mass against its velocity along its normal. The winds instead give each triangle
+// an aerodynamic lift and drag against the wind velocity where it is, on the explicit integrator. Must match clothComputeShader.glsl
+enum WindMode { Normal_Drag = 0, Steady_Wind = 1, Gusty_Wind = 2, NUM_WIND_MODES };
+
+// Must match the topologies in clothComputeShader.glsl. A batch is several separate cloths packed into the same buffers, so everything
+// but the grid is a mesh as far as the springs are concerned. Strands are laid out like the grid, but hang separately as hair or rope
+enum ClothTopology { Grid_Topology = 0, Mesh_Topology = 1, Batch_Topology = 2, Strand_Topology = 3 };
+
+// One cloth of a batch. A grid of masses spanning along and across from its corner, pinned by the first mass of every strand
+struct clothInstance {
+    glm::vec3 corner, along, across;
+    int strands, massesPerStrand;
+    float weight;
+    float stiffness;  // Relative to simParams' ks and kd
+    // Where it's packed into the shared buffers. Filled in when the batch is built
+    int firstMass, firstIndex, numIndices;
+};
+
+// Must match the stages in clothComputeShader.glsl
+enum ClothComputeStage {
+    Forces_Stage = 0,
+    Integrate_Stage = 1,
+    Build_Implicit_System_Stage = 2,
+    Apply_System_Stage = 3,
+    Update_Solution_Stage = 4,
+    Update_Search_Direction_Stage = 5,
+    Finish_Implicit_Step_Stage = 6,
+    Normals_Stage = 7,
+    Xpbd_Predict_Stage = 8,
+    Xpbd_Constraint_Stage = 9,
+    Xpbd_Collision_Stage = 10,
+    Xpbd_Velocity_Stage = 11,
+    Hash_Clear_Stage = 12,
+    Hash_Count_Stage = 13,
+    Hash_Scan_Groups_Stage = 14,
+    Hash_Scan_Totals_Stage = 15,
+    Hash_Offset_Stage = 16,
+    Hash_Fill_Stage = 17,
+    Self_Collision_Stage = 18,
+    Apply_Self_Collision_Stage = 19,
+    Tear_Springs_Stage = 20,
+    Mask_Triangles_Stage = 21,
+    Measure_Energy_Stage = 22,
+    Sum_Energy_Stage = 23,
+    Start_Verlet_Stage = 24,
+    Restrict_To_Coarse_Stage = 25,
+    Prolong_From_Coarse_Stage = 26,
+    Wind_Forces_Stage = 27
+};
+
+// What the energy monitor reads back. Laid out like the shader's vec4
+struct energyReading {
+    GLfloat kinetic;
+    GLfloat potential;  // In the springs
+    GLfloat maxStrain;  // Longest spring relative to its rest length
+    GLfloat numNans;    // Masses whose position or velocity isn't finite
+};
+
+struct mat3Block {
+    GLfloat columns[3][4];  // std430 pads each mat3 column out to a vec4
+};
+
 class ClothManager {
    public:
-    ClothManager();
+    ClothManager(int strands = DEFAULT_NUM_THREADS, int massesPerStrand = DEFAULT_MASSES_PER_THREAD);
+    ~ClothManager();
 
     void RenderParticles(float dt, Environment *environment);
     void InitGL();
     void UpdateComputeParameters() const;
     void ExecuteComputeShader();
+    void ExecuteTiledComputeShader();
+    void ExecuteImplicitStep();
+    void ExecuteXpbdStep();
+    void ExecuteStrandStep();
+    void Simulate();
+    void SetSolver(ClothSolver newSolver);
+    void SetIntegrator(ClothIntegrator newIntegrator);
+    void SetExplicitScheme(ExplicitScheme newScheme);
+    bool IntegratorAvailable(ClothIntegrator candidate) const;
+    void SetTopology(ClothTopology newTopology);
+    void SetSelfCollisions(bool enabled);
+    void SetTearing(bool enabled);
+    void SetAdaptiveTimestep(bool enabled);
+    void SetTethers(bool enabled);
+    int ExplicitSubsteps() const;
+    bool UsesTiledDispatch() const;
+    bool UsesMultiresolution() const;
+    int MultiresolutionSubsteps() const;
+    void UpdateObstacles(const Environment &environment);
+    void CompareSolvers();
+    void Resize(int strands, int massesPerStrand);
+    void RunScalingBenchmark();
+    void RunTetherBenchmark();
+    void RunIntegratorBenchmark();
+    void RunStrandBenchmark();
     static void InitClothTexcoords();
     static void InitClothIBO();
+    static void BuildTriangleAdjacency(const std::vector<GLuint> &indices);
 
     static const int WORK_GROUP_SIZE = 128;
 
-    static const int NUM_THREADS = 128;
-    static const int MASSES_PER_THREAD = 180;
-    static const int NUM_MASSES = NUM_THREADS * MASSES_PER_THREAD;
+    static const int DEFAULT_NUM_THREADS = 128;
+    static const int DEFAULT_MASSES_PER_THREAD = 180;
 
+    // The cloth's physical size stays the same at every resolution
     static const int CLOTH_WIDTH = 32;
     static const int CLOTH_HEIGHT = 32;
     static const int CLOTH_WEIGHT = 25;
 
-    static const int TRIANGLES_PER_THREAD = (2 * (MASSES_PER_THREAD - 1));
-    static const int NUM_TRIANGLES = TRIANGLES_PER_THREAD * (NUM_THREADS - 1);
-    static const int NUM_TRIANGLE_INDICES = NUM_TRIANGLES * 3;
+    // Strand mode. An upright square patch of roots, each with a strand of STRAND_LENGTH sticking straight out from it to start with
+    static const int DEFAULT_NUM_STRANDS = 16384;
+    static const int DEFAULT_MASSES_PER_STRAND = 32;
+    static const int MAX_STRAND_MASSES = 256;  // A whole work group. Must match strandComputeShader.glsl
+    static constexpr float STRAND_LENGTH = 8;
+    static constexpr float STRAND_PATCH_SIZE = 8;
+    static constexpr float STRAND_MASS = 0.001f;  // Of each mass
+
+    // Resolution of the grid. Each thread is a strand of masses
+    static int numThreads;
+    static int massesPerThread;
+
+    // Cloth that's any triangle mesh instead of a grid. Only the springs' CSR adjacency knows its shape
+    static ClothTopology topology;
+    static std::unique_ptr<Model> clothMesh;  // Loaded the first time it's needed
+    static constexpr const char *CLOTH_MESH_FILE = "models/tablecloth.obj";
+
+    // Every instance of the batch, one after another. Each instance's parameters are baked into its springs and masses, so they all
+    // step in the same dispatches, and they're drawn with one multi-draw call
+    static std::vector<clothInstance> batch;
+    static std::vector<glm::vec3> batchVertices;
+    static std::vector<unsigned int> batchIndices;
+    static void BuildBatch();
+    static const clothInstance &InstanceOf(int mass);
+
+    static bool IsPinned(int mass);
+
+    // Strands are stored like the grid, a strand per thread
+    static bool IsGridLayout() {
+        return topology == Grid_Topology || topology == Strand_Topology;
+    }
+
+    // The mesh or the batch's masses and triangles
+    static const std::vector<glm::vec3> &MeshVertices() {
+        return topology == Batch_Topology ? batchVertices : clothMesh->IndexedVertices();
+    }
+
+    static const std::vector<unsigned int> &MeshTriangleIndices() {
+        return topology == Batch_Topology ? batchIndices : clothMesh->TriangleIndices();
+    }
+
+    static int NumMasses() {
+        if (!IsGridLayout()) return int(MeshVertices().size());
+        return numThreads * massesPerThread;
+    }
+
+    // Buffers are padded out to a whole number of work groups with pinned, unconnected masses
+    static int NumAllocatedMasses() {
+        return NumWorkGroups() * WORK_GROUP_SIZE;
+    }
+
+    static int NumWorkGroups() {
+        return (NumMasses() + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    }
+
+    static int NumTriangleIndices() {
+        if (topology == Strand_Topology) return 0;
+        if (topology != Grid_Topology) return int(MeshTriangleIndices().size());
+        return 2 * (massesPerThread - 1) * (numThreads - 1) * 3;
+    }
+
+    // Strands are drawn as a line between each pair of neighbouring masses
+    static int NumLineIndices() {
+        return 2 * (massesPerThread - 1) * numThreads;
+    }
+
+    // Invocations per strand in strandComputeShader.glsl, its masses rounded up to a power of two so the reduction's strides fit. Its
+    // work groups are MAX_STRAND_MASSES invocations, so they take several strands each when they're short
+    static int StrandSlot() {
+        int slot = 1;
+        while (slot < massesPerThread) slot *= 2;
+        return slot;
+    }
+
+    static int StrandWorkGroups() {
+        int strandsPerGroup = MAX_STRAND_MASSES / StrandSlot();
+        return (numThreads + strandsPerGroup - 1) / strandsPerGroup;
+    }
 
     static GLuint posSSbo;
     static GLuint velSSbo;
@@ -72,5 +289,209 @@ class ClothManager {
     static GLuint paramSSbo;
     static GLuint lastPosSSbo;
 
+    // Implicit solver state
+    static GLuint deltaVelSSbo;
+    static GLuint residualSSbo;
+    static GLuint searchSSbo;
+    static GLuint preconditionedSSbo;
+    static GLuint productSSbo;
+    static GLuint springBlockSSbo;
+    static GLuint preconditionerSSbo;
+    static GLuint partialsSSbo;
+
+    static int NumPartials() {
+        return 3 * NumWorkGroups();  // p.q, then r.z for even and odd iterations
+    }
+
+    static GLuint lambdaSSbo;  // XPBD multipliers
+
+    static springAdjacency springs;
+    static GLuint springOffsetSSbo;
+    static GLuint springNeighbourSSbo;
+    static GLuint springRestLengthSSbo;
+    static GLuint springStiffnessSSbo;
+    static GLuint springDampingSSbo;
+    static GLuint springOppositeSSbo;
+
+    // Stiffness and damping of each spring type relative to the structural springs. Must match clothTiledComputeShader.glsl. XPBD's
+    // bend constraints use the same factor
+    static constexpr float SHEAR_STIFFNESS_FACTOR = 0.5f;
+    static constexpr float BEND_STIFFNESS_FACTOR = 0.05f;
+
+    static const int NUM_GRID_SPRINGS = 12;
+    static const gridSpring GRID_SPRINGS[NUM_GRID_SPRINGS];
+
+    static float StiffnessFactor(SpringType type) {
+        return type == Shear_Spring ? SHEAR_STIFFNESS_FACTOR : type == Bend_Spring ? BEND_STIFFNESS_FACTOR : 1;
+    }
+
+    // Self-collision spatial hash. One cell per allocated mass, then room for each work group's count while they're scanned
+    static GLuint hashCellSSbo;
+    static GLuint hashMassSSbo;
+    static GLuint selfCollisionSSbo;  // Each mass' position and velocity correction
+
+    static int NumHashCellEntries() {
+        return NumAllocatedMasses() + 1 + NumWorkGroups();
+    }
+
+    static const int SELF_COLLISION_INTERVAL = 32;  // Explicit substeps between self-collision passes
+
+    // Tearing. Torn springs have no stiffness left, and the IBO is the cloth's triangles with the torn ones masked out
+    static GLuint triangleSSbo;  // The triangles before any tearing
+    static constexpr float TEAR_STRAIN = 2.0f;  // A hanging cloth stretches its springs to ~1.5x
+    static const int TEAR_INTERVAL = 8;         // Explicit substeps between checks for torn springs
+
+    // Wind. Each triangle's force is worked out from the IBO, so torn triangles catch no wind. Built along with the IBO
+    static triangleAdjacency massTriangles;
+    static GLuint triangleForceSSbo;  // What each corner of each triangle gets
+    static GLuint triangleOffsetSSbo;
+    static GLuint massTriangleSSbo;
+
+    // Energy monitor. Each work group's reading, after the total the CPU reads back
+    static GLuint energySSbo;
+    static const int ENERGY_INTERVAL = 128;  // Explicit substeps between readings
+
+    static int NumEnergyReadings() {
+        return 1 + NumWorkGroups();
+    }
+
+    // Adaptive explicit timestep. Grows while the readings stay calm and backs off when the energy jumps or the cloth overstretches
+    static constexpr float MIN_ADAPTIVE_TIMESTEP = 0.000005f;  // A quarter of COMPUTE_SHADER_TIMESTEP
+    static constexpr float MAX_ADAPTIVE_TIMESTEP = 0.00016f;   // 8x
+    static constexpr float TIMESTEP_GROWTH = 1.1f;
+    static constexpr float TIMESTEP_BACKOFF = 0.5f;
+    static const int CALM_READINGS_TO_GROW = 4;
+    static constexpr float ENERGY_SPIKE_FACTOR = 4;  // Between one reading and the next
+    static constexpr float ENERGY_SPIKE_FLOOR = 1;   // So a cloth at rest can start moving
+    static constexpr float UNSTABLE_STRAIN = 3;      // Well past anything a hanging cloth or tearing reaches
+
+    // Tethers. Off while springs may be torn, since a torn-off piece would still be held to its anchor
+    static std::vector<tether> massTethers;
+    static GLuint tetherSSbo;
+    static constexpr float TETHER_STRETCH = 1.0f;
+
+    // Every obstacle in the environment but the gravity center, which stays a sphere
+    static ObstacleBvh obstacles;
+    static GLuint obstacleNodeSSbo;
+    static GLuint obstacleTriangleSSbo;
+
+    static int NumSprings() {
+        return int(springs.neighbours.size());  // Each spring is counted once from each end
+    }
+
+    // Tiles of the fused explicit kernel. Must match clothTiledComputeShader.glsl. Bend springs reach two masses, so the halo loses two
+    // rings per substep, and the normals need one more. The tile is as big as fits in shared memory around a halo for 5 substeps
+    static const int TILE_ALONG = 36;
+    static const int TILE_ACROSS = 37;
+    static const int TILE_HALO = 11;
+    static const int MAX_TILED_SUBSTEPS = (TILE_HALO - 1) / 2;
+
+    static int TilesCovering(int masses, int tileSize) {
+        return (masses + tileSize - 2 * TILE_HALO - 1) / (tileSize - 2 * TILE_HALO);
+    }
+
+    static int NumTilesAlong() {
+        return TilesCovering(massesPerThread, TILE_ALONG);
+    }
+
+    static int NumTilesAcross() {
+        return TilesCovering(numThreads, TILE_ACROSS);
+    }
+
+    // Multiresolution. A grid MULTIRESOLUTION_FACTOR times coarser each way is every MULTIRESOLUTION_FACTOR-th mass of every
+    // MULTIRESOLUTION_FACTOR-th strand. It takes the cloth's global motion through the frame in big steps with the tiled kernel, and the
+    // fine grid then steps only its local detail through the same frame, moving relative to that. Must match clothComputeShader.glsl
+    static const int MULTIRESOLUTION_FACTOR = 4;
+    static GLuint coarsePosSSbo;
+    static GLuint coarseVelSSbo;
+    static GLuint coarsePosOutSSbo;  // The tiled kernel's spare buffers
+    static GLuint coarseVelOutSSbo;
+    static GLuint coarseNormSSbo;
+    static GLuint coarseMassSSbo;
+    static GLuint coarseParamSSbo;
+    static GLuint coarseStartSSbo;  // Each coarse mass' position and velocity at the start of the frame
+
+    static int CoarseMassesPerThread() {
+        return (massesPerThread - 1) / MULTIRESOLUTION_FACTOR + 1;
+    }
+
+    static int CoarseNumThreads() {
+        return (numThreads - 1) / MULTIRESOLUTION_FACTOR + 1;
+    }
+
+    static int NumCoarseMasses() {
+        return topology == Grid_Topology ? CoarseNumThreads() * CoarseMassesPerThread() : 0;
+    }
+
+    static const int XPBD_NUM_COLORS = 8;  // Stretch and bend constraints, across and along strands, each in two colors
+
+    // Scaling benchmark
+    static const int BENCHMARK_MIN_SIDE = 32;
+    static const int BENCHMARK_MAX_SIDE = 1024;
+    static const int BENCHMARK_MAX_FRAMES = 30;
+    static constexpr double BENCHMARK_MS_PER_RESOLUTION = 2000;
+
+    // Strand benchmark. Same frame limits as the scaling benchmark
+    static const int BENCHMARK_MIN_STRANDS = 1024;
+    static const int BENCHMARK_MAX_STRANDS = 32768;
+
+    // Tether benchmark
+    static const int BENCHMARK_MAX_ITERATIONS = 64;
+    static const int BENCHMARK_HANG_FRAMES = 120;
+
+    // Integrator benchmark. dt doubles from the smallest until the cloth blows up, then the largest stable one is narrowed down
+    static constexpr float BENCHMARK_MIN_TIMESTEP = 0.000005f;
+    static constexpr float BENCHMARK_MAX_TIMESTEP = 1 / 60.0f;  // A whole frame
+    static const int BENCHMARK_BISECTIONS = 4;
+    static const int BENCHMARK_STABILITY_FRAMES = 60;
+
     simParams simParameters;
+    ClothSolver solver = Gpu_Solver;
+    ClothIntegrator integrator = Explicit_Integrator;
+    ExplicitScheme explicitScheme = Midpoint_Scheme;
+    int xpbdIterations = XPBD_ITERATIONS;
+    bool tiledDispatch = true;  // Fuse explicit substeps into tiled dispatches
+    bool multiresolution = false;
+    bool selfCollisions = true;
+    bool tearing = false;
+    bool adaptiveTimestep = false;  // Also what turns the energy monitor on
+    bool tethers = false;
+    WindMode windMode = Normal_Drag;
+    float windTime = 0;  // Simulated seconds of wind, for the gusts
+    energyReading lastEnergy = {};
+
+   private:
+    void Rebuild();
+    void ResizeStrands(int strands, int massesPerStrand);
+    void BuildSpringAdjacency();
+    void BuildTethers();
+    float MeasureStretch(float *meanStretch) const;
+    bool StaysStable(float dt, double *msPerSimulatedSecond);
+    void AddSpring(int other, SpringType type, float restLength, GLuint opposite = BAD_INDEX, float stiffness = 1);
+    void BindSSbos() const;
+    void UnbindSSbos() const;
+    void DispatchStage(ClothComputeStage stage);
+    void DispatchSelfCollisions();
+    void StepCoarseGrid();
+    void DispatchTearing();
+    void MaskTornTriangles();
+    void DispatchWindForces(int substep);
+    void DispatchEnergyMeasurement();
+    void ReadBackEnergy();
+    void AdaptTimestep(const energyReading &reading);
+
+    // Since tearing was last turned on or the cloth was last rebuilt. The tiled kernel always uses the whole grid of springs
+    bool springsMayBeTorn = false;
+
+    // The last frame's readings are read back once the GPU's finished with them. Nothing's measured while they're still on their way
+    GLsync energyFence = 0;
+    int energyReadingsThisFrame = 0;
+    float lastReadEnergy = 0;
+    int calmReadings = 0;
+
+    // The cloth's resolution, kept while the strands use the grid's
+    int clothThreads = DEFAULT_NUM_THREADS;
+    int clothMassesPerThread = DEFAULT_MASSES_PER_THREAD;
+
+    std::unique_ptr<ClothCpuSolver> cpuSolver;  // Created the first time it's needed, since it starts threads
 };
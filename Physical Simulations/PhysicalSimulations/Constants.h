@@ -28,3 +28,16 @@ const float COMPUTE_SHADER_TIMESTEP = 0.00002;
 const float IDEAL_FRAMERATE = 60;
 const int COMPUTES_PER_FRAME = int(((1 / IDEAL_FRAMERATE) / COMPUTE_SHADER_TIMESTEP) + 0.5);
 const unsigned int BAD_INDEX = 8000001;
+
+// The implicit integrator is unconditionally stable, so it takes a couple of big steps per frame instead of hundreds of tiny ones
+const int IMPLICIT_STEPS_PER_FRAME = 2;
+const float IMPLICIT_TIMESTEP = (1 / IDEAL_FRAMERATE) / IMPLICIT_STEPS_PER_FRAME;
+const int PCG_ITERATIONS = 24;
+
+// XPBD takes one step per frame and gets its stiffness from constraint iterations instead
+const float XPBD_TIMESTEP = 1 / IDEAL_FRAMERATE;
+const int XPBD_ITERATIONS = 20;
+
+// Strands solve each substep's constraints directly, so a few substeps with a couple of iterations each keep them from stretching
+const int STRAND_SUBSTEPS_PER_FRAME = 4;
+const int STRAND_ITERATIONS = 2;
@@ -19,6 +19,14 @@ void Environment::SetGravityCenterPosition(const glm::vec3& position) {
     _gameObjects[_gravityCenterIndex].SetPosition(position);
 }
 
+std::vector<const GameObject*> Environment::Obstacles() const {
+    std::vector<const GameObject*> obstacles;
+    for (const GameObject& gameObject : _gameObjects) {
+        if (gameObject.IsObstacle()) obstacles.push_back(&gameObject);
+    }
+    return obstacles;
+}
+
 void Environment::CreateEnvironment() {
     GameObject gameObject;
 
@@ -43,4 +51,12 @@ void Environment::CreateEnvironment() {
     gameObject.SetScale(8, 8, 8);
     _gameObjects.push_back(gameObject);
     _gravityCenterIndex = _gameObjects.size() - 1;
+
+    gameObject = GameObject(_cubeModel);  // table, for the cloth to fall onto
+    gameObject.SetTextureIndex(UNTEXTURED);
+    gameObject.SetColor(glm::vec3(60 / 255.0, 60 / 255.0, 80 / 255.0));
+    gameObject.SetScale(8, 8, 1);
+    gameObject.SetPosition(glm::vec3(6, 5, 13.5));
+    gameObject.SetObstacle(true);
+    _gameObjects.push_back(gameObject);
 }
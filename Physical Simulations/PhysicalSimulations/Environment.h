@@ -7,6 +7,7 @@ class Environment {
 
     void UpdateAll();
     void SetGravityCenterPosition(const glm::vec3& position);
+    std::vector<const GameObject*> Obstacles() const;  // Objects the cloth collides with, besides the gravity center
 
    private:
     void CreateEnvironment();
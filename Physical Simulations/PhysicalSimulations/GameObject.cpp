@@ -9,7 +9,7 @@
 
 GameObject::GameObject() : GameObject(nullptr) {}
 
-GameObject::GameObject(Model* model) : model_(model), texture_index_(UNTEXTURED) {
+GameObject::GameObject(Model* model) : model_(model), texture_index_(UNTEXTURED), is_obstacle_(false) {
     transform_ = glm::mat4();
     material_ = Material(glm::vec3(1, 0, 1));
 }
@@ -20,6 +20,22 @@ void GameObject::SetTextureIndex(TEXTURE texture_index) {
     texture_index_ = texture_index;
 }
 
+void GameObject::SetObstacle(bool is_obstacle) {
+    is_obstacle_ = is_obstacle;
+}
+
+Model* GameObject::GetModel() const {
+    return model_;
+}
+
+const glm::mat4& GameObject::GetTransform() const {
+    return transform_;
+}
+
+bool GameObject::IsObstacle() const {
+    return is_obstacle_;
+}
+
 void GameObject::Update() {
     if (model_ == nullptr) {
         printf("GameObject must be given a valid model before calling Update()\n");
@@ -16,6 +16,11 @@ class GameObject {
     void EulerRotate(float yaw, float pitch, float roll);
     void SetColor(const glm::vec3& color);
     void SetTextureIndex(TEXTURE texture_index);
+    void SetObstacle(bool is_obstacle);  // Whether the cloth collides with this object's triangles
+
+    Model* GetModel() const;
+    const glm::mat4& GetTransform() const;
+    bool IsObstacle() const;
 
     void Update();
 
@@ -25,4 +30,5 @@ class GameObject {
     Model* model_;
     TEXTURE texture_index_;
     glm::mat4 transform_;
+    bool is_obstacle_;
 };
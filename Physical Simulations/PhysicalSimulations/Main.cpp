@@ -4,6 +4,7 @@
 
 #define GLM_FORCE_RADIANS
 #include <SDL_image.h>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -21,6 +22,23 @@ const char* INSTRUCTIONS =
     "Controls:\n"
     "Space - Play/Pause simulation"
     "Left click - Set position of the ball\n"
+    "c - Switch between simulating on the GPU and the CPU\n"
+    "v - Run one frame on both the GPU and the CPU and print how far apart they end up\n"
+    "i - Cycle between the explicit, implicit (backward Euler) and XPBD integrators\n"
+    "j - Cycle the explicit integrator between the Euler, midpoint, spring RK4 and Verlet schemes\n"
+    "[/] - Decrease/increase the number of XPBD constraint iterations\n"
+    "t - Toggle fusing the explicit GPU substeps into tiled dispatches\n"
+    "g - Toggle multiresolution, where a 4x coarser grid takes the GPU cloth's global motion in big steps. Grid only, not while tearing\n"
+    ",/. - Halve/double the cloth's resolution\n"
+    "m - Cycle between the rectangular cloth, a tablecloth loaded from an obj, a batch of curtains, flags and capes, and strands of hair\n"
+    "x - Toggle self-collision\n"
+    "y - Toggle tearing, on the GPU. Changing the cloth's resolution or shape mends it\n"
+    "e - Toggle the GPU energy monitor, which adapts the explicit integrator's timestep\n"
+    "b - Time a frame at every resolution from 32x32 to 1024x1024 and print the results. On the strands, at 1024 to 32768 of them\n"
+    "l - Toggle tethering every mass to its closest pinned mass, so the cloth can't stretch away from it. Off while tearing\n"
+    "k - Let the cloth hang with XPBD at 1 to 64 iterations, with and without tethers, and print how stretched it ends up\n"
+    "n - Cycle between still air, a steady wind and a gusty one. Wind pushes on each triangle, on the explicit integrator\n"
+    "h - Find each explicit scheme's largest stable timestep and print what a simulated second costs at it\n"
     "WASD - Camera movement\n"
     "R/F - Camera up/down"
     "+/- - Increase/decrease various parameters, depending on the other keys held:\n"
@@ -202,7 +220,7 @@ int main(int argc, char* argv[]) {
 
     Environment environment = Environment();
 
-    ClothManager clothManager = ClothManager();
+    ClothManager clothManager;
 
     ShaderManager::InitShaders();
 
@@ -228,6 +246,7 @@ int main(int argc, char* argv[]) {
     int mouseX = -1, mouseY = -1;
     float normalizedMouseX, normalizedMouseY;
     glm::vec3 lastMouseWorldCoord;
+    bool draggingBall = false;
     float gravityCenterDistance = 10;
     while (!quit) {
         while (SDL_PollEvent(&windowEvent)) {  // inspect all events in the queue
@@ -254,6 +273,52 @@ int main(int argc, char* argv[]) {
                     } else {
                         clothManager.simParameters.dt = COMPUTE_SHADER_TIMESTEP;
                     }
+                } else if (windowEvent.key.keysym.sym == SDLK_c) {
+                    clothManager.SetSolver(clothManager.solver == Gpu_Solver ? Cpu_Solver : Gpu_Solver);
+                } else if (windowEvent.key.keysym.sym == SDLK_v) {
+                    clothManager.CompareSolvers();
+                } else if (windowEvent.key.keysym.sym == SDLK_i) {
+                    auto next = ClothIntegrator((clothManager.integrator + 1) % NUM_CLOTH_INTEGRATORS);
+                    while (!clothManager.IntegratorAvailable(next)) {
+                        next = ClothIntegrator((next + 1) % NUM_CLOTH_INTEGRATORS);
+                    }
+                    clothManager.SetIntegrator(next);
+                } else if (windowEvent.key.keysym.sym == SDLK_t) {
+                    clothManager.tiledDispatch = !clothManager.tiledDispatch;
+                } else if (windowEvent.key.keysym.sym == SDLK_n) {
+                    clothManager.windMode = WindMode((clothManager.windMode + 1) % NUM_WIND_MODES);
+                } else if (windowEvent.key.keysym.sym == SDLK_g) {
+                    clothManager.multiresolution = !clothManager.multiresolution;
+                } else if (windowEvent.key.keysym.sym == SDLK_LEFTBRACKET) {
+                    clothManager.xpbdIterations = std::max(1, clothManager.xpbdIterations - 5);
+                } else if (windowEvent.key.keysym.sym == SDLK_RIGHTBRACKET) {
+                    clothManager.xpbdIterations += 5;
+                } else if (windowEvent.key.keysym.sym == SDLK_m) {
+                    clothManager.SetTopology(ClothTopology((ClothManager::topology + 1) % (Strand_Topology + 1)));
+                } else if (windowEvent.key.keysym.sym == SDLK_COMMA && ClothManager::topology == Grid_Topology &&
+                           ClothManager::NumMasses() > 4) {
+                    clothManager.Resize(std::max(2, ClothManager::numThreads / 2), std::max(2, ClothManager::massesPerThread / 2));
+                } else if (windowEvent.key.keysym.sym == SDLK_PERIOD && ClothManager::topology == Grid_Topology &&
+                           ClothManager::NumMasses() < 2048 * 2048) {
+                    clothManager.Resize(ClothManager::numThreads * 2, ClothManager::massesPerThread * 2);
+                } else if (windowEvent.key.keysym.sym == SDLK_x) {
+                    clothManager.SetSelfCollisions(!clothManager.selfCollisions);
+                } else if (windowEvent.key.keysym.sym == SDLK_y) {
+                    clothManager.SetTearing(!clothManager.tearing);
+                } else if (windowEvent.key.keysym.sym == SDLK_e) {
+                    clothManager.SetAdaptiveTimestep(!clothManager.adaptiveTimestep);
+                } else if (windowEvent.key.keysym.sym == SDLK_b && ClothManager::topology == Strand_Topology) {
+                    clothManager.RunStrandBenchmark();
+                } else if (windowEvent.key.keysym.sym == SDLK_b) {
+                    clothManager.RunScalingBenchmark();
+                } else if (windowEvent.key.keysym.sym == SDLK_l) {
+                    clothManager.SetTethers(!clothManager.tethers);
+                } else if (windowEvent.key.keysym.sym == SDLK_k) {
+                    clothManager.RunTetherBenchmark();
+                } else if (windowEvent.key.keysym.sym == SDLK_j) {
+                    clothManager.SetExplicitScheme(ExplicitScheme((clothManager.explicitScheme + 1) % NUM_EXPLICIT_SCHEMES));
+                } else if (windowEvent.key.keysym.sym == SDLK_h) {
+                    clothManager.RunIntegratorBenchmark();
                 }
             }
 
@@ -314,19 +379,64 @@ int main(int argc, char* argv[]) {
             clothManager.simParameters.obstacleCenterX = lastMouseWorldCoord.x;
             clothManager.simParameters.obstacleCenterY = lastMouseWorldCoord.y;
             clothManager.simParameters.obstacleCenterZ = lastMouseWorldCoord.z;
+            if (!draggingBall) {  // A click puts the ball straight there. Only dragging sweeps it through the cloth
+                clothManager.simParameters.lastObstacleCenterX = lastMouseWorldCoord.x;
+                clothManager.simParameters.lastObstacleCenterY = lastMouseWorldCoord.y;
+                clothManager.simParameters.lastObstacleCenterZ = lastMouseWorldCoord.z;
+            }
+            draggingBall = true;
+        } else {
+            draggingBall = false;
         }
 
         stringstream debugText;
-        debugText << fixed << setprecision(3) << COMPUTES_PER_FRAME << " steps per frame, " << ClothManager::NUM_THREADS << "x"
-                  << ClothManager::MASSES_PER_THREAD << " masses "
-                  << " | " << lastAverageFrameTime << " per frame (" << lastFramerate << "FPS) average over " << framesPerSample
+        int stepsPerFrame = clothManager.ExplicitSubsteps();
+        if (clothManager.integrator == Implicit_Euler) stepsPerFrame = IMPLICIT_STEPS_PER_FRAME;
+        if (clothManager.integrator == Xpbd) stepsPerFrame = 1;
+        if (ClothManager::topology == Strand_Topology) stepsPerFrame = STRAND_SUBSTEPS_PER_FRAME;
+        const char *integratorNames[] = {"explicit", "implicit", "XPBD"};
+        const char *schemeNames[] = {"Euler", "midpoint", "spring RK4", "Verlet"};
+        const char *windNames[] = {"still air", "steady", "gusty"};
+        debugText << fixed << setprecision(3) << stepsPerFrame << " steps per frame, ";
+        if (ClothManager::topology == Batch_Topology) {
+            debugText << ClothManager::NumMasses() << " masses in " << ClothManager::batch.size() << " cloths ";
+        } else if (ClothManager::topology == Mesh_Topology) {
+            debugText << ClothManager::NumMasses() << " mesh masses ";
+        } else if (ClothManager::topology == Strand_Topology) {
+            debugText << ClothManager::numThreads << "x" << ClothManager::massesPerThread << " strands ";
+        } else {
+            debugText << ClothManager::numThreads << "x" << ClothManager::massesPerThread << " masses ";
+        }
+        debugText << " | " << lastAverageFrameTime << " per frame (" << lastFramerate << "FPS) average over " << framesPerSample
                   << " frames "
                   << " | cameraPosition: " << camera.GetPosition() << " | CoG position: " << lastMouseWorldCoord
-                  << " | Sim running: " << (clothManager.simParameters.dt > 0);
+                  << " | Sim running: " << (clothManager.simParameters.dt > 0)
+                  << " | Solver: " << (clothManager.solver == Cpu_Solver ? "CPU" : "GPU")
+                  << " | Integrator: ";
+        if (ClothManager::topology == Strand_Topology) {
+            debugText << "strand direct solve (" << STRAND_ITERATIONS << " iterations)";
+        } else {
+            debugText << integratorNames[clothManager.integrator];
+            if (clothManager.integrator == Explicit_Integrator) debugText << " (" << schemeNames[clothManager.explicitScheme] << ")";
+            if (clothManager.integrator == Xpbd) debugText << " (" << clothManager.xpbdIterations << " iterations)";
+        }
+        if (clothManager.UsesTiledDispatch()) debugText << " (tiled)";
+        if (clothManager.UsesMultiresolution()) {
+            debugText << " (multiresolution, " << ClothManager::CoarseNumThreads() << "x" << ClothManager::CoarseMassesPerThread()
+                      << " coarse in " << clothManager.MultiresolutionSubsteps() << " steps)";
+        }
+        debugText << " | Self-collision: " << clothManager.selfCollisions << " | Tearing: " << clothManager.tearing
+                  << " | Tethers: " << (clothManager.simParameters.tetherStretch > 0) << " | Wind: " << windNames[clothManager.windMode];
+        if (clothManager.adaptiveTimestep) {
+            const energyReading &energy = clothManager.lastEnergy;
+            debugText << " | dt: " << clothManager.simParameters.dt * 1000 << "ms, KE: " << energy.kinetic << ", PE: " << energy.potential
+                      << ", max strain: " << energy.maxStrain << ", NaNs: " << energy.numNans;
+        }
         SDL_SetWindowTitle(window, debugText.str().c_str());
 
-        // Simulate using compute shader
-        clothManager.ExecuteComputeShader();
+        // Simulate using compute shader, or the CPU
+        clothManager.UpdateObstacles(environment);
+        clothManager.Simulate();
 
         // Render the environment
         ShaderManager::ActivateShader(ShaderManager::EnvironmentShader);
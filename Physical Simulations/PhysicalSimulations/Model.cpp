@@ -11,7 +11,7 @@
 using std::string;
 using std::vector;
 
-Model::Model(const string& file) {
+Model::Model(const string& file, bool register_model) {
     unsigned int dot_position = file.find_last_of('.');
     if (dot_position == string::npos) {
         printf("Given file \"%s\" did not have an extension. Exiting...\n", file.c_str());
@@ -28,7 +28,7 @@ Model::Model(const string& file) {
         exit(1);
     }
 
-    ModelManager::RegisterModel(this);
+    if (register_model) ModelManager::RegisterModel(this);
 }
 
 void Model::LoadTxt(const std::string& file) {
@@ -127,6 +127,12 @@ void Model::LoadObj(const std::string& filename) {
         model_[uv_offset] = model_[uv_offset + 1] = 0;  // Set uv's to zero because this parser doesn't handle them and they're expected
     }
 
+    indexed_vertices_ = temp_vertices;
+    triangle_indices_.clear();
+    for (unsigned int vertex_index : vertex_indices) {
+        triangle_indices_.push_back(vertex_index - 1);
+    }
+
     num_verts_ = num_verts;
     fclose(file);
 }
@@ -147,3 +153,11 @@ std::vector<glm::vec4> Model::Vertices() const {
 
     return verts;
 }
+
+const std::vector<glm::vec3>& Model::IndexedVertices() const {
+    return indexed_vertices_;
+}
+
+const std::vector<unsigned int>& Model::TriangleIndices() const {
+    return triangle_indices_;
+}
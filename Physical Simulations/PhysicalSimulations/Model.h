@@ -5,7 +5,8 @@
 
 class Model {
    public:
-    explicit Model(const std::string& file);
+    // Models that aren't part of the environment, like cloth meshes, can skip being registered with the ModelManager
+    explicit Model(const std::string& file, bool register_model = true);
 
     void LoadTxt(const std::string& file);
     void LoadObj(const std::string& file);
@@ -15,9 +16,15 @@ class Model {
 
     std::vector<glm::vec4> Vertices() const;
 
+    // The obj's own vertices and triangles, before they're unrolled into model_. Only filled in by LoadObj
+    const std::vector<glm::vec3>& IndexedVertices() const;
+    const std::vector<unsigned int>& TriangleIndices() const;  // Three per triangle, from 0
+
     float* model_;
     int vbo_vertex_start_index_;
 
    private:
     int num_verts_;
+    std::vector<glm::vec3> indexed_vertices_;
+    std::vector<unsigned int> triangle_indices_;
 };
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <numeric>
+#include "GameObject.h"
+#include "ObstacleBvh.h"
+
+const float OBSTACLE_FRICTION = 0.9999f;  // Same as the sphere's
+
+int ObstacleBvh::Add(const GameObject& object) {
+    std::vector<glm::vec4> corners = object.GetModel()->Vertices();
+    obstacle added;
+    added.firstNode = int(nodes.size());
+    added.firstTriangle = int(triangles.size()) / 3;
+    added.numTriangles = int(corners.size()) / 3;
+    added.transform = object.GetTransform();
+
+    std::vector<glm::vec3> centroids(added.numTriangles);
+    for (int t = 0; t < added.numTriangles; t++) {
+        glm::vec4 sum = added.transform * (corners[3 * t] + corners[3 * t + 1] + corners[3 * t + 2]);
+        centroids[t] = glm::vec3(sum) / 3.0f;
+    }
+
+    // The tree is built over triangle numbers, then the triangles are stored in the order its leaves ended up with
+    std::vector<int> order(added.numTriangles);
+    std::iota(order.begin(), order.end(), 0);
+    if (added.numTriangles > 0) Build(order, 0, added.numTriangles, centroids, added.firstTriangle);
+    added.numNodes = int(nodes.size()) - added.firstNode;
+
+    for (int t : order) {
+        for (int corner = 0; corner < 3; corner++) {
+            localTriangles.push_back(corners[3 * t + corner]);
+            triangles.push_back(added.transform * corners[3 * t + corner]);
+        }
+    }
+
+    obstacles.push_back(added);
+    Refit(NumObstacles() - 1, object);
+    return NumObstacles() - 1;
+}
+
+// Splits at the median centroid along the longest axis. Leaves get their first triangle now, and their boxes once the triangles are in
+int ObstacleBvh::Build(std::vector<int>& order, int first, int count, const std::vector<glm::vec3>& centroids, int triangleBase) {
+    int index = int(nodes.size());
+    nodes.push_back(bvhNode());
+    if (count <= MAX_LEAF_TRIANGLES) {
+        nodes[index].firstTriangle = triangleBase + first;
+        nodes[index].numTriangles = count;
+        nodes[index].escape = index + 1;
+        return index;
+    }
+
+    glm::vec3 low = centroids[order[first]], high = low;
+    for (int k = first; k < first + count; k++) {
+        low = glm::min(low, centroids[order[k]]);
+        high = glm::max(high, centroids[order[k]]);
+    }
+    glm::vec3 extent = high - low;
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    Build(order, first, half, centroids, triangleBase);
+    Build(order, first + half, count - half, centroids, triangleBase);
+
+    nodes[index].numTriangles = 0;
+    nodes[index].escape = int(nodes.size());
+    return index;
+}
+
+void ObstacleBvh::FitLeaf(bvhNode& node) const {
+    glm::vec3 low = glm::vec3(triangles[3 * node.firstTriangle]), high = low;
+    for (int corner = 3 * node.firstTriangle; corner < 3 * (node.firstTriangle + node.numTriangles); corner++) {
+        low = glm::min(low, glm::vec3(triangles[corner]));
+        high = glm::max(high, glm::vec3(triangles[corner]));
+    }
+    node.minX = low.x, node.minY = low.y, node.minZ = low.z;
+    node.maxX = high.x, node.maxY = high.y, node.maxZ = high.z;
+}
+
+// Children come after their parent, so going backwards fits every box after the boxes inside it
+void ObstacleBvh::Refit(int index, const GameObject& object) {
+    obstacle& moved = obstacles[index];
+    moved.transform = object.GetTransform();
+    for (int corner = 3 * moved.firstTriangle; corner < 3 * (moved.firstTriangle + moved.numTriangles); corner++) {
+        triangles[corner] = moved.transform * localTriangles[corner];
+    }
+
+    for (int n = moved.firstNode + moved.numNodes - 1; n >= moved.firstNode; n--) {
+        bvhNode& node = nodes[n];
+        if (node.numTriangles > 0) {
+            FitLeaf(node);
+            continue;
+        }
+
+        const bvhNode& left = nodes[n + 1];
+        const bvhNode& right = nodes[left.escape];
+        node.minX = std::min(left.minX, right.minX), node.maxX = std::max(left.maxX, right.maxX);
+        node.minY = std::min(left.minY, right.minY), node.maxY = std::max(left.maxY, right.maxY);
+        node.minZ = std::min(left.minZ, right.minZ), node.maxZ = std::max(left.maxZ, right.maxZ);
+    }
+}
+
+bool ObstacleBvh::Moved(int index, const GameObject& object) const {
+    return obstacles[index].transform != object.GetTransform();
+}
+
+void ObstacleBvh::Clear() {
+    obstacles.clear();
+    nodes.clear();
+    triangles.clear();
+    localTriangles.clear();
+}
+
+// From Real-Time Collision Detection, 5.1.5
+glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denominator = 1 / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Pushes the point back out to THICKNESS from the closest point on the triangle, and takes away its velocity into the triangle
+void CollideWithTriangle(glm::vec3& position, glm::vec3& velocity, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 closest = ClosestPointOnTriangle(position, a, b, c);
+    glm::vec3 away = position - closest;
+    float distance = glm::length(away);
+    if (distance >= ObstacleBvh::THICKNESS) return;
+
+    glm::vec3 faceNormal = glm::cross(b - a, c - a);
+    if (distance == 0 && glm::length(faceNormal) == 0) return;  // Degenerate triangle, and nowhere to push to
+    glm::vec3 normal = distance > 0 ? away / distance : glm::normalize(faceNormal);
+    position = closest + normal * ObstacleBvh::THICKNESS;
+
+    float intoSurface = glm::dot(velocity, normal);
+    if (intoSurface < 0) velocity -= intoSurface * normal;
+    velocity *= OBSTACLE_FRICTION;
+}
+
+void ObstacleBvh::Collide(glm::vec3& position, glm::vec3& velocity) const {
+    int n = 0;
+    while (n < int(nodes.size())) {
+        const bvhNode& node = nodes[n];
+        bool inBox = position.x >= node.minX - THICKNESS && position.y >= node.minY - THICKNESS && position.z >= node.minZ - THICKNESS &&
+                     position.x <= node.maxX + THICKNESS && position.y <= node.maxY + THICKNESS && position.z <= node.maxZ + THICKNESS;
+        if (!inBox) {
+            n = node.escape;
+            continue;
+        }
+
+        for (int t = node.firstTriangle; t < node.firstTriangle + node.numTriangles; t++) {
+            CollideWithTriangle(position, velocity, glm::vec3(triangles[3 * t]), glm::vec3(triangles[3 * t + 1]),
+                                glm::vec3(triangles[3 * t + 2]));
+        }
+        n++;  // Into the first child, or on from a leaf
+    }
+}
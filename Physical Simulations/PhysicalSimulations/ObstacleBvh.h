@@ -0,0 +1,78 @@
+#pragma once
+#include <glm.hpp>
+#include <vector>
+#include "glad.h"
+
+class GameObject;
+
+// A box of the bounding volume hierarchy, laid out for std430. Nodes are stored depth first, so an interior node's first child is the
+// node after it. Escape is the node to visit next once this one's been missed or finished
+struct bvhNode {
+    GLfloat minX, minY, minZ;
+    GLint escape;
+    GLfloat maxX, maxY, maxZ;
+    GLint firstTriangle;
+    GLint numTriangles;  // 0 for interior nodes
+    GLint padding[3];
+};
+
+// Triangles of every obstacle in world space, with a tree per obstacle. The trees are stored one after another and each root escapes to
+// the next root, so every obstacle is checked in one stackless walk from node 0
+class ObstacleBvh {
+   public:
+    // Builds a tree over the object's triangles where the object is now. Returns the obstacle's index
+    int Add(const GameObject& object);
+
+    // Moves an obstacle's triangles to where its object is now and refits the boxes around them. The tree keeps its shape
+    void Refit(int obstacle, const GameObject& object);
+    bool Moved(int obstacle, const GameObject& object) const;
+    void Clear();
+
+    // Same as CollideWithObstacles in clothComputeShader.glsl
+    void Collide(glm::vec3& position, glm::vec3& velocity) const;
+
+    int NumObstacles() const {
+        return int(obstacles.size());
+    }
+
+    const std::vector<bvhNode>& Nodes() const {
+        return nodes;
+    }
+
+    const std::vector<glm::vec4>& Triangles() const {  // Three corners per triangle
+        return triangles;
+    }
+
+    // Where an obstacle's nodes and triangles are in the shared arrays, for uploading just the ones that moved
+    int FirstNode(int obstacle) const {
+        return obstacles[obstacle].firstNode;
+    }
+    int NumNodes(int obstacle) const {
+        return obstacles[obstacle].numNodes;
+    }
+    int FirstTriangle(int obstacle) const {
+        return obstacles[obstacle].firstTriangle;
+    }
+    int NumTriangles(int obstacle) const {
+        return obstacles[obstacle].numTriangles;
+    }
+
+    // How close cloth can get to an obstacle's surface. The compute shaders are compiled with it as OBSTACLE_THICKNESS
+    static constexpr float THICKNESS = 0.05f;
+    static const int MAX_LEAF_TRIANGLES = 4;
+
+   private:
+    struct obstacle {
+        int firstNode, numNodes;
+        int firstTriangle, numTriangles;
+        glm::mat4 transform;
+    };
+
+    int Build(std::vector<int>& order, int first, int count, const std::vector<glm::vec3>& centroids, int triangleBase);
+    void FitLeaf(bvhNode& node) const;
+
+    std::vector<obstacle> obstacles;
+    std::vector<bvhNode> nodes;
+    std::vector<glm::vec4> triangles;
+    std::vector<glm::vec4> localTriangles;  // The model's own corners, in the same order, for refitting
+};
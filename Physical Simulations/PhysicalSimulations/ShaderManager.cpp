@@ -1,11 +1,46 @@
+#include <cstring>
 #include <fstream>
 #include "ClothManager.h"
 #include "Constants.h"
 #include "ModelManager.h"
+#include "ObstacleBvh.h"
 #include "ShaderManager.h"
 
 GLuint ShaderManager::ClothComputeShader;
+std::vector<GLuint> ShaderManager::ClothComputeVariants;
 GLuint ShaderManager::ClothComputeStage;
+GLuint ShaderManager::ClothSolverIteration;
+GLuint ShaderManager::ClothImplicitDt;
+GLuint ShaderManager::ClothXpbdDt;
+GLuint ShaderManager::ClothXpbdColor;
+GLuint ShaderManager::ClothMassesPerThread;
+GLuint ShaderManager::ClothTopology;
+GLuint ShaderManager::ClothNumMasses;
+GLuint ShaderManager::ClothObstacleNodes;
+GLuint ShaderManager::ClothObstacleSubstep;
+GLuint ShaderManager::ClothObstacleSubsteps;
+GLuint ShaderManager::ClothNumTriangles;
+GLuint ShaderManager::ClothFirstEnergyReading;
+GLuint ShaderManager::ClothInternalForcesOnly;
+GLuint ShaderManager::ClothWindMode;
+GLuint ShaderManager::ClothWindTime;
+GLuint ShaderManager::ClothTiledComputeShader;
+GLuint ShaderManager::ClothTiledSubsteps;
+GLuint ShaderManager::ClothTiledMassesPerThread;
+GLuint ShaderManager::ClothTiledNumThreads;
+GLuint ShaderManager::ClothTiledObstacleNodes;
+GLuint ShaderManager::ClothTiledObstacleSubstep;
+GLuint ShaderManager::ClothTiledObstacleSubsteps;
+GLuint ShaderManager::StrandComputeShader;
+GLuint ShaderManager::StrandNumStrands;
+GLuint ShaderManager::StrandMassesPerStrand;
+GLuint ShaderManager::StrandSlot;
+GLuint ShaderManager::StrandSubsteps;
+GLuint ShaderManager::StrandIterations;
+GLuint ShaderManager::StrandFrameTime;
+GLuint ShaderManager::StrandObstacleNodes;
+GLuint ShaderManager::StrandWindMode;
+GLuint ShaderManager::StrandWindTime;
 RenderShader ShaderManager::EnvironmentShader;
 RenderShader ShaderManager::ClothShader;
 
@@ -13,16 +48,69 @@ std::map<int, std::function<void(ShaderAttributes)>> ShaderManager::ShaderFuncti
 
 void ShaderManager::InitShaders() {
     ClothShader.Program = EnvironmentShader.Program = CompileRenderShader("environment-Vertex.glsl", "environment-Fragment.glsl");
-    ClothComputeShader = CompileComputeShaderProgram("clothComputeShader.glsl");
-    ClothComputeStage = glGetUniformLocation(ClothComputeShader, "computationStage");
+    for (int scheme = 0; scheme < NUM_EXPLICIT_SCHEMES; scheme++) {
+        std::string defines = "#define EXPLICIT_SCHEME " + std::to_string(scheme) + "\n";
+        ClothComputeVariants.push_back(CompileComputeShaderProgram("clothComputeShader.glsl", defines));
+    }
+    ClothComputeShader = ClothComputeVariants[Midpoint_Scheme];
+    InitClothComputeUniforms();
+    ClothTiledComputeShader = CompileComputeShaderProgram("clothTiledComputeShader.glsl");
+    ClothTiledSubsteps = glGetUniformLocation(ClothTiledComputeShader, "substeps");
+    ClothTiledMassesPerThread = glGetUniformLocation(ClothTiledComputeShader, "massesPerThread");
+    ClothTiledNumThreads = glGetUniformLocation(ClothTiledComputeShader, "numThreads");
+    ClothTiledObstacleNodes = glGetUniformLocation(ClothTiledComputeShader, "numObstacleNodes");
+    ClothTiledObstacleSubstep = glGetUniformLocation(ClothTiledComputeShader, "obstacleSubstep");
+    ClothTiledObstacleSubsteps = glGetUniformLocation(ClothTiledComputeShader, "obstacleSubsteps");
+    StrandComputeShader = CompileComputeShaderProgram("strandComputeShader.glsl");
+    StrandNumStrands = glGetUniformLocation(StrandComputeShader, "numStrands");
+    StrandMassesPerStrand = glGetUniformLocation(StrandComputeShader, "massesPerStrand");
+    StrandSlot = glGetUniformLocation(StrandComputeShader, "strandSlot");
+    StrandSubsteps = glGetUniformLocation(StrandComputeShader, "obstacleSubsteps");
+    StrandIterations = glGetUniformLocation(StrandComputeShader, "iterations");
+    StrandFrameTime = glGetUniformLocation(StrandComputeShader, "frameTime");
+    StrandObstacleNodes = glGetUniformLocation(StrandComputeShader, "numObstacleNodes");
+    StrandWindMode = glGetUniformLocation(StrandComputeShader, "windMode");
+    StrandWindTime = glGetUniformLocation(StrandComputeShader, "windTime");
 
     InitEnvironmentShaderAttributes();
     InitClothShaderAttributes();
 }
 
+// Every variant has its own uniform locations. numObstacleNodes is only set when the obstacles change, so it's carried over
+void ShaderManager::UseClothComputeVariant(int variant) {
+    GLint obstacleNodes = 0;
+    glGetUniformiv(ClothComputeShader, ClothObstacleNodes, &obstacleNodes);
+    ClothComputeShader = ClothComputeVariants[variant];
+    InitClothComputeUniforms();
+    glProgramUniform1i(ClothComputeShader, ClothObstacleNodes, obstacleNodes);
+}
+
+void ShaderManager::InitClothComputeUniforms() {
+    ClothComputeStage = glGetUniformLocation(ClothComputeShader, "computationStage");
+    ClothSolverIteration = glGetUniformLocation(ClothComputeShader, "solverIteration");
+    ClothImplicitDt = glGetUniformLocation(ClothComputeShader, "implicitDt");
+    ClothXpbdDt = glGetUniformLocation(ClothComputeShader, "xpbdDt");
+    ClothXpbdColor = glGetUniformLocation(ClothComputeShader, "xpbdColor");
+    ClothMassesPerThread = glGetUniformLocation(ClothComputeShader, "massesPerThread");
+    ClothTopology = glGetUniformLocation(ClothComputeShader, "topology");
+    ClothNumMasses = glGetUniformLocation(ClothComputeShader, "numMasses");
+    ClothObstacleNodes = glGetUniformLocation(ClothComputeShader, "numObstacleNodes");
+    ClothObstacleSubstep = glGetUniformLocation(ClothComputeShader, "obstacleSubstep");
+    ClothObstacleSubsteps = glGetUniformLocation(ClothComputeShader, "obstacleSubsteps");
+    ClothNumTriangles = glGetUniformLocation(ClothComputeShader, "numTriangles");
+    ClothFirstEnergyReading = glGetUniformLocation(ClothComputeShader, "firstEnergyReading");
+    ClothInternalForcesOnly = glGetUniformLocation(ClothComputeShader, "internalForcesOnly");
+    ClothWindMode = glGetUniformLocation(ClothComputeShader, "windMode");
+    ClothWindTime = glGetUniformLocation(ClothComputeShader, "windTime");
+}
+
 void ShaderManager::Cleanup() {
     glDeleteProgram(EnvironmentShader.Program);
-    glDeleteProgram(ClothComputeShader);
+    for (GLuint variant : ClothComputeVariants) {
+        glDeleteProgram(variant);
+    }
+    glDeleteProgram(ClothTiledComputeShader);
+    glDeleteProgram(StrandComputeShader);
     glDeleteProgram(ClothShader.Program);
 
     glDeleteVertexArrays(1, &EnvironmentShader.VAO);
@@ -199,7 +287,7 @@ GLuint ShaderManager::CompileRenderShader(const std::string& vertex_shader_file,
     return program;
 }
 
-GLuint ShaderManager::CompileComputeShaderProgram(const std::string& compute_shader_file) {
+GLuint ShaderManager::CompileComputeShaderProgram(const std::string& compute_shader_file, const std::string& defines) {
     GLuint compute_shader;
     GLchar* vs_text;
     GLuint computeProgram;
@@ -223,9 +311,15 @@ GLuint ShaderManager::CompileComputeShaderProgram(const std::string& compute_sha
         printf("=====================\n\n");
     }
 
-    // Load Compute Shader
-    const char* vv = vs_text;
-    glShaderSource(compute_shader, 1, &vv, NULL);  // Read source
+    // Load Compute Shader. The defines have to go after the #version line
+    std::string source = SpliceIncludes(vs_text);
+    std::string allDefines = "#define OBSTACLE_THICKNESS " + std::to_string(ObstacleBvh::THICKNESS) + "\n" + defines;
+    const char* text = source.c_str();
+    const char* versionEnd = strchr(text, '\n');
+    versionEnd = versionEnd ? versionEnd + 1 : text + strlen(text);
+    const char* sources[] = {text, allDefines.c_str(), versionEnd};
+    GLint lengths[] = {GLint(versionEnd - text), GLint(allDefines.size()), -1};
+    glShaderSource(compute_shader, 3, sources, lengths);  // Read source
     glCompileShader(compute_shader);               // Compile shaders
     VerifyShaderCompiled(compute_shader);          // Check for errors
 
@@ -270,6 +364,31 @@ char* ShaderManager::ReadShaderSource(const char* shaderFile) {
     return buffer;
 }
 
+// GLSL has no #include, so every line that's just #include "file" is replaced with the file. The compute shaders share their obstacle
+// collisions this way
+std::string ShaderManager::SpliceIncludes(const std::string& source) {
+    const std::string directive = "#include \"";
+    std::string spliced;
+    size_t lineStart = 0;
+    while (lineStart < source.size()) {
+        size_t lineEnd = source.find('\n', lineStart);
+        lineEnd = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+        std::string line = source.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd;
+        if (line.compare(0, directive.size(), directive) != 0) {
+            spliced += line;
+            continue;
+        }
+
+        std::string file = line.substr(directive.size(), line.find('"', directive.size()) - directive.size());
+        char* included = ReadShaderSource(file.c_str());
+        spliced += included;
+        spliced += "\n";
+        delete[] included;
+    }
+    return spliced;
+}
+
 void ShaderManager::VerifyShaderCompiled(GLuint shader) {
     GLint compiled;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
@@ -2,6 +2,7 @@
 #include <functional>
 #include <map>
 #include <string>
+#include <vector>
 #include "glad.h"
 
 typedef struct {
@@ -30,19 +31,55 @@ class ShaderManager {
     static void Cleanup();
     static void ActivateShader(RenderShader shader);
     static void ApplyToEachRenderShader(std::function<void(ShaderAttributes)> Func, int shaderFunctionId);
+    static void UseClothComputeVariant(int variant);
 
     static RenderShader EnvironmentShader;
     static RenderShader ClothShader;
-    static GLuint ClothComputeShader;
+    static GLuint ClothComputeShader;  // Whichever of the variants is in use
+    static std::vector<GLuint> ClothComputeVariants;  // One per ExplicitScheme
     static GLuint ClothComputeStage;
+    static GLuint ClothSolverIteration;
+    static GLuint ClothImplicitDt;
+    static GLuint ClothXpbdDt;
+    static GLuint ClothXpbdColor;
+    static GLuint ClothMassesPerThread;
+    static GLuint ClothTopology;
+    static GLuint ClothNumMasses;
+    static GLuint ClothObstacleNodes;
+    static GLuint ClothObstacleSubstep;
+    static GLuint ClothObstacleSubsteps;
+    static GLuint ClothNumTriangles;
+    static GLuint ClothFirstEnergyReading;
+    static GLuint ClothInternalForcesOnly;
+    static GLuint ClothWindMode;
+    static GLuint ClothWindTime;
+    static GLuint ClothTiledComputeShader;
+    static GLuint ClothTiledSubsteps;
+    static GLuint ClothTiledMassesPerThread;
+    static GLuint ClothTiledNumThreads;
+    static GLuint ClothTiledObstacleNodes;
+    static GLuint ClothTiledObstacleSubstep;
+    static GLuint ClothTiledObstacleSubsteps;
+    static GLuint StrandComputeShader;
+    static GLuint StrandNumStrands;
+    static GLuint StrandMassesPerStrand;
+    static GLuint StrandSlot;
+    static GLuint StrandSubsteps;
+    static GLuint StrandIterations;
+    static GLuint StrandFrameTime;
+    static GLuint StrandObstacleNodes;
+    static GLuint StrandWindMode;
+    static GLuint StrandWindTime;
 
    private:
     static void InitEnvironmentShaderAttributes();
     static void InitClothShaderAttributes();
     static void InitShaderUniforms(RenderShader& shaderProgram);
+    static void InitClothComputeUniforms();
     static GLuint CompileRenderShader(const std::string& vertex_shader_file, const std::string& fragment_shader_file);
-    static GLuint CompileComputeShaderProgram(const std::string& compute_shader_file);
+    static GLuint CompileComputeShaderProgram(const std::string& compute_shader_file, const std::string& defines = "");
     static char* ReadShaderSource(const char* shaderFile);
+    static std::string SpliceIncludes(const std::string& source);
     static void VerifyShaderCompiled(GLuint shader);
 
     static std::map<int, std::function<void(ShaderAttributes)>> ShaderFunctions;
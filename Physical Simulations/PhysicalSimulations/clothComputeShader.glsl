@@ -38,21 +38,245 @@ layout(std430, binding = 6) buffer MssPrps {
     MassParams MassParameters[];
 };
 
-layout(std430, binding = 4) buffer Parameters {
-    vec3 obstacleCenter;
-    float obstacleRadius;
-    float dt;
-    float ks;
-    float kd;
-    float restLength;
+// -- Implicit solver state -- //
+// Backward Euler: (M - h*dF/dv - h^2*dF/dx) * dv = h * (F + h * dF/dx * v), solved for dv with preconditioned conjugate gradient
+layout(std430, binding = 8) buffer DltV {
+    vec4 DeltaVelocities[];  // The solution, dv
 };
 
+layout(std430, binding = 9) buffer Rsdl {
+    vec4 Residuals[];  // r
+};
+
+layout(std430, binding = 10) buffer Srch {
+    vec4 SearchDirections[];  // p
+};
+
+layout(std430, binding = 11) buffer Prcnd {
+    vec4 PreconditionedResiduals[];  // z
+};
+
+layout(std430, binding = 12) buffer Prdct {
+    vec4 Products[];  // q = A * p
+};
+
+// The sparse spring Jacobian. h*Kd + h^2*Ks for each spring, in the same order as the spring adjacency
+layout(std430, binding = 13) buffer SprngBlcks {
+    mat3 SpringBlocks[];
+};
+
+// Inverse of each mass' diagonal block of A
+layout(std430, binding = 14) buffer Prcndtnrs {
+    mat3 Preconditioners[];
+};
+
+// One partial sum per work group for each dot product. p.q first, then r.z for even and odd iterations
+layout(std430, binding = 15) buffer Rdctns {
+    float Partials[];
+};
+// -- -- //
+
+// XPBD multipliers of the constraints each mass owns: stretch to the left, stretch down, bend to the left, bend down
+layout(std430, binding = 16) buffer Lmbds {
+    vec4 Lambdas[];
+};
+
+// -- Spring adjacency, in compressed sparse row form -- //
+// Mass i's springs are entries SpringOffsets[i] through SpringOffsets[i + 1] - 1 of the arrays after it
+layout(std430, binding = 17) buffer SprngOffsts {
+    uint SpringOffsets[];
+};
+
+layout(std430, binding = 18) buffer SprngNghbrs {
+    uint SpringNeighbours[];
+};
+
+layout(std430, binding = 19) buffer SprngRstLngths {
+    float SpringRestLengths[];
+};
+
+// The third corner of the triangle to the left of the spring, going from this mass to its neighbour. Only used for mesh normals
+layout(std430, binding = 20) buffer SprngOppsts {
+    uint SpringOpposites[];
+};
+
+layout(std430, binding = 21) buffer SprngStffnsss {
+    float SpringStiffnesses[];
+};
+
+layout(std430, binding = 22) buffer SprngDmpngs {
+    float SpringDampings[];
+};
+// -- -- //
+
+// -- Self-collision spatial hash -- //
+// Masses are counting sorted by the hash of the cell they're in. After the fill, cell h's masses are entries CellStarts[h] through
+// CellStarts[h + 1] - 1 of CellMasses. The table has a cell per allocated mass, and each work group's count goes after the last cell
+// while they're being scanned
+layout(std430, binding = 23) buffer HshClls {
+    int CellStarts[];
+};
+
+layout(std430, binding = 24) buffer HshMsss {
+    uint CellMasses[];
+};
+
+// Position then velocity correction of each mass. Each mass only writes its own, so contacts don't need atomics
+layout(std430, binding = 25) buffer SlfCllsn {
+    vec4 SelfCollisionDeltas[];
+};
+// -- -- //
+
+#include "obstacleCollisions.glsl"
+
+// -- Tearing -- //
+// The cloth's triangles as they were built. Ones with a torn edge are collapsed in the copy that's drawn
+layout(std430, binding = 28) buffer Trngls {
+    uint TriangleIndices[];
+};
+
+layout(std430, binding = 29) buffer RndrdTrngls {
+    uint RenderedTriangleIndices[];  // The cloth's index buffer
+};
+// -- -- //
+
+// -- Energy monitor -- //
+// Kinetic energy, spring potential energy, largest strain and the number of masses that have gone NaN or infinite. Entry 0 is what the
+// CPU reads back, and each work group's reading goes in the entry after its number
+layout(std430, binding = 30) buffer NrgRdngs {
+    vec4 EnergyReadings[];
+};
+// -- -- //
+
+// -- Tethers -- //
+// Each mass' closest pinned mass, and how far away it is along the cloth at rest. BAD_INDEX if it has none
+struct Tether {
+    uint anchor;
+    float length;
+};
+
+layout(std430, binding = 31) buffer Tthrs {
+    Tether Tethers[];
+};
+// -- -- //
+
+// -- Multiresolution -- //
+// The coarse grid is every MultiresolutionFactor-th mass of every MultiresolutionFactor-th strand, stepped by the tiled kernel
+layout(std430, binding = 32) buffer CrsPos {
+    vec4 CoarsePositions[];
+};
+
+layout(std430, binding = 33) buffer CrsVel {
+    vec4 CoarseVelocities[];
+};
+
+layout(std430, binding = 34) buffer CrsStrts {
+    vec4 CoarseStarts[];  // Each coarse mass' position then velocity at the start of the frame
+};
+// -- -- //
+
+// -- Wind -- //
+// Each triangle's aerodynamic force, already split between its corners. Each mass gathers its share from its triangles through the CSR
+// adjacency, so nothing is written by more than one invocation
+layout(std430, binding = 35) buffer TrnglFrcs {
+    vec4 TriangleForces[];
+};
+
+layout(std430, binding = 36) buffer TrnglOffsts {
+    uint TriangleOffsets[];
+};
+
+layout(std430, binding = 37) buffer MssTrngls {
+    uint MassTriangles[];
+};
+// -- -- //
+
 uniform int computationStage;
+uniform int solverIteration;
+uniform float implicitDt;
+uniform float xpbdDt;
+uniform int xpbdColor;
+uniform int massesPerThread;
+uniform int topology;
+uniform int numMasses;
+uniform int obstacleSubstep;   // Of the frame, for sweeping the obstacle
+uniform int numTriangles;
+uniform bool firstEnergyReading;  // Of those the CPU will read back together
+uniform bool internalForcesOnly;  // The coarse grid has already taken care of everything else, and moves the masses along with it
+uniform int windMode;
+uniform float windTime;  // Simulated seconds, at the start of the substep
 
 layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
 
+// Explicit integration scheme. ShaderManager compiles a variant of this shader for each, defining EXPLICIT_SCHEME ahead of the source.
+// Must match ExplicitScheme in ClothManager.h
+#define EULER_SCHEME 0
+#define MIDPOINT_SCHEME 1
+#define SPRING_RK4_SCHEME 2
+#define VERLET_SCHEME 3
+#ifndef EXPLICIT_SCHEME
+#define EXPLICIT_SCHEME MIDPOINT_SCHEME
+#endif
+
 uint gid;
 const vec3 gravity = vec3(0, 0, -9.8);
+const float dragFactor = 0.4;
+const float dampingFactor = 0.1;
+const float bendStiffnessFactor = 0.05;  // Bending constraints are this much softer than stretching ones
+const int MultiresolutionFactor = 4;  // Must match ClothManager::MULTIRESOLUTION_FACTOR
+const vec3 windVelocity = vec3(5, 0, 0);  // Straight through the cloth as it starts out hanging
+const float airDensity = 0.1;
+const float windDragCoefficient = 1.0;
+const float windLiftCoefficient = 0.5;
+
+// -- Poor man's enums -- //
+const int ForcesStage = 0;
+const int IntegrateStage = 1;
+const int BuildImplicitSystemStage = 2;
+const int ApplySystemStage = 3;
+const int UpdateSolutionStage = 4;
+const int UpdateSearchDirectionStage = 5;
+const int FinishImplicitStepStage = 6;
+const int NormalsStage = 7;
+const int XpbdPredictStage = 8;
+const int XpbdConstraintStage = 9;
+const int XpbdCollisionStage = 10;
+const int XpbdVelocityStage = 11;
+const int HashClearStage = 12;
+const int HashCountStage = 13;
+const int HashScanGroupsStage = 14;
+const int HashScanTotalsStage = 15;
+const int HashOffsetStage = 16;
+const int HashFillStage = 17;
+const int SelfCollisionStage = 18;
+const int ApplySelfCollisionStage = 19;
+const int TearSpringsStage = 20;
+const int MaskTrianglesStage = 21;
+const int MeasureEnergyStage = 22;
+const int SumEnergyStage = 23;
+const int StartVerletStage = 24;
+const int RestrictToCoarseStage = 25;
+const int ProlongFromCoarseStage = 26;
+const int WindForcesStage = 27;
+
+const int GridTopology = 0;
+const int MeshTopology = 1;
+const int BatchTopology = 2;  // Separate meshes, as far as the shader can tell
+const int StrandTopology = 3;  // Stepped by strandComputeShader.glsl instead, never by this one
+
+const int StretchLeftConstraint = 0;
+const int StretchDownConstraint = 1;
+const int BendLeftConstraint = 2;
+const int BendDownConstraint = 3;
+
+const int NormalDrag = 0;  // Must match WindMode in ClothManager.h
+const int SteadyWind = 1;
+const int GustyWind = 2;
+// -- -- //
+
+shared float groupSums[128];
+shared int groupCounts[128];
+shared vec4 groupReadings[128];
 
 // I'm rather sad that I need this.
 // Because I need to be able to use both gid and the connection index as inputs, getAccelerationFromSpringConnection takes uints
@@ -69,7 +293,7 @@ bool isInf(vec3 v) {
     return isinf(v.x) || isinf(v.y) || isinf(v.z);
 }
 
-vec3 getSpringAcceleration(vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2) {
+vec3 getSpringAcceleration(vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2, float rest, float stiffness, float damping) {
     vec3 toMassOneFromTwo = p1 - p2;
     float length = length(toMassOneFromTwo);
     if (length == 0) {
@@ -81,8 +305,8 @@ vec3 getSpringAcceleration(vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2) {
     float dampV1 = dot(toMassOneFromTwo, v1);
     float dampV2 = dot(toMassOneFromTwo, v2);
 
-    float springForce = -ks * (length - restLength);
-    float dampForce = -kd * (dampV1 - dampV2);
+    float springForce = -stiffness * (length - rest);
+    float dampForce = -damping * (dampV1 - dampV2);
     float force = springForce + dampForce;
 
     vec3 massOneAcc = 0.5 * force * toMassOneFromTwo / m1;
@@ -92,100 +316,217 @@ vec3 getSpringAcceleration(vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2) {
     return massOneAcc;
 }
 
-// RK4 integration
-//vec3 getAccelerationFromSpringConnection(uint massOne, uint massTwo) {
-//    if (massOne == BAD_INDEX || massTwo == BAD_INDEX) return vec3(0, 0, 0);
-//    vec3 originalPosition = Positions[massOne].xyz;
-//    vec3 originalVelocity = Velocities[massOne].xyz;
-//    float mass = MassParameters[massOne].mass;
-//    vec3 p2 = Positions[massTwo].xyz;
-//    vec3 v2 = Velocities[massTwo].xyz;
-//
-//    vec3 a1 = getSpringAcceleration(originalPosition, originalVelocity, mass, p2, v2);
-//    
-//    vec3 v_half = originalVelocity + a1 * 0.5 * dt;
-//    vec3 p_half = originalPosition + v_half * 0.5 * dt;
-//    vec3 a2 = getSpringAcceleration(p_half, v_half, mass, p2, v2);
-//   
-//    vec3 v_half2 = originalVelocity + a2 * 0.5 * dt;
-//    vec3 p_half2 = originalPosition + v_half2 * 0.5 * dt;
-//    vec3 a3 = getSpringAcceleration(p_half2, v_half2, mass, p2, v2);
-//   
-//    vec3 v_end = originalVelocity + a3 * dt;
-//    vec3 p_end = originalPosition + v_end * dt;
-//    vec3 a4 = getSpringAcceleration(p_end, v_end, mass, p2, v2);
-//
-//
-//    return (1.0 / 6.0) * (a1 + 2 * a2 + 2 * a3 + a4);
-//}
-
-// Midpoint
-vec3 getAccelerationFromSpringConnection(uint massOne, uint massTwo) {
-    if (massOne == BAD_INDEX || massTwo == BAD_INDEX) return vec3(0, 0, 0);
-    vec3 originalPosition = Positions[massOne].xyz;
-    vec3 originalVelocity = Velocities[massOne].xyz;
-    float mass = MassParameters[massOne].mass;
+// The spring's acceleration once the mass has moved on for h with acceleration a. The other end stays where it is
+vec3 getSpringAccelerationAfter(float h, vec3 a, vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2, float rest, float stiffness, float damping) {
+    vec3 v = v1 + a * h;
+    vec3 p = p1 + v * h;
+    return getSpringAcceleration(p, v, m1, p2, v2, rest, stiffness, damping);
+}
+
+// The mass' own state is passed in, since it's the same for all of its springs. Euler and Verlet take the spring as it is, the midpoint
+// method takes it half a step on and spring RK4 averages four samples over the step. Only this end moves between samples
+vec3 getAccelerationFromSpringConnection(vec3 originalPosition, vec3 originalVelocity, float mass, uint spring) {
+    uint massTwo = SpringNeighbours[spring];
     vec3 p2 = Positions[massTwo].xyz;
     vec3 v2 = Velocities[massTwo].xyz;
+    float rest = SpringRestLengths[spring];
+    float stiffness = SpringStiffnesses[spring];
+    float damping = SpringDampings[spring];
 
-    vec3 a = getSpringAcceleration(originalPosition, originalVelocity, mass, p2, v2);
-    vec3 v_half = originalVelocity + a * 0.5 * dt;
-    vec3 p_half = originalPosition + v_half * 0.5 * dt;
-
-    vec3 a_half = getSpringAcceleration(p_half, v_half, mass, p2, v2);
-    return a_half;
+    vec3 a = getSpringAcceleration(originalPosition, originalVelocity, mass, p2, v2, rest, stiffness, damping);
+#if EXPLICIT_SCHEME == MIDPOINT_SCHEME
+    a = getSpringAccelerationAfter(0.5 * dt, a, originalPosition, originalVelocity, mass, p2, v2, rest, stiffness, damping);
+#elif EXPLICIT_SCHEME == SPRING_RK4_SCHEME
+    vec3 a2 = getSpringAccelerationAfter(0.5 * dt, a, originalPosition, originalVelocity, mass, p2, v2, rest, stiffness, damping);
+    vec3 a3 = getSpringAccelerationAfter(0.5 * dt, a2, originalPosition, originalVelocity, mass, p2, v2, rest, stiffness, damping);
+    vec3 a4 = getSpringAccelerationAfter(dt, a3, originalPosition, originalVelocity, mass, p2, v2, rest, stiffness, damping);
+    a = (a + 2.0 * a2 + 2.0 * a3 + a4) / 6.0;
+#endif
+    return a;
 }
 
 void CalculateForces() {
-    vec3 leftAcc = getAccelerationFromSpringConnection(gid, MassParameters[gid].connections.left);
-    vec3 rightAcc = getAccelerationFromSpringConnection(gid, MassParameters[gid].connections.right);
-    vec3 upAcc = getAccelerationFromSpringConnection(gid, MassParameters[gid].connections.up);
-    vec3 downAcc = getAccelerationFromSpringConnection(gid, MassParameters[gid].connections.down);
+    vec3 position = Positions[gid].xyz;
+    vec3 velocity = Velocities[gid].xyz;
+    float mass = MassParameters[gid].mass;
 
-    vec3 acc = gravity + leftAcc + rightAcc + upAcc + downAcc;
+    vec3 acc = internalForcesOnly ? vec3(0, 0, 0) : gravity;
+    for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+        acc += getAccelerationFromSpringConnection(position, velocity, mass, s);
+    }
+    if (internalForcesOnly) {
+        Accelerations[gid].xyz = acc;
+        return;
+    }
 
-    // 'Drag'
-    float amt = dot(Normals[gid].xyz, Velocities[gid].xyz);
-    vec3 opposeVelocityAlongNormal = -1 * amt * Normals[gid].xyz;
-    acc += 0.4 * opposeVelocityAlongNormal;
+    if (windMode == NormalDrag) {
+        // 'Drag'
+        float amt = dot(Normals[gid].xyz, Velocities[gid].xyz);
+        vec3 opposeVelocityAlongNormal = -1 * amt * Normals[gid].xyz;
+        acc += dragFactor * opposeVelocityAlongNormal;
+    } else {
+        for (uint t = TriangleOffsets[gid]; t < TriangleOffsets[gid + 1]; t++) {
+            acc += TriangleForces[MassTriangles[t]].xyz / mass;
+        }
+    }
 
     // Extra damping
-    acc -= 0.1 * Velocities[gid].xyz;
+    acc -= dampingFactor * Velocities[gid].xyz;
 
     Accelerations[gid].xyz = acc;
     //NewVelocities[gid].xyz += acc * dt;
 }
 
-void IntegrateForces() {
-    //Velocities[gid].xyz = Positions[gid].xyz - LastPositions[gid].xyz;
+// -- Multiresolution -- //
+// Masses along a strand, then strands
+ivec2 CoarseGridSize() {
+    int strands = numMasses / massesPerThread;
+    return ivec2((massesPerThread - 1) / MultiresolutionFactor + 1, (strands - 1) / MultiresolutionFactor + 1);
+}
+
+// Injection. Fine masses that sit on a coarse one hand it their state
+void RestrictToCoarse() {
+    if (int(gid) >= numMasses) return;
+    ivec2 fine = ivec2(int(gid) % massesPerThread, int(gid) / massesPerThread);
+    if (fine.x % MultiresolutionFactor != 0 || fine.y % MultiresolutionFactor != 0) return;
+
+    ivec2 coarse = fine / MultiresolutionFactor;
+    int c = coarse.y * CoarseGridSize().x + coarse.x;
+    CoarsePositions[c] = Positions[gid];
+    CoarseVelocities[c] = Velocities[gid];
+    CoarseStarts[2 * c] = Positions[gid];
+    CoarseStarts[2 * c + 1] = Velocities[gid];
+}
+
+// The coarse masses around this fine one, bilinearly weighted. Masses past the last coarse strand or the last coarse mass along one are
+// extrapolated from the last pair
+void CoarseCorners(out int corners[4], out float weights[4]) {
+    ivec2 size = CoarseGridSize();
+    vec2 at = vec2(int(gid) % massesPerThread, int(gid) / massesPerThread) / float(MultiresolutionFactor);
+    ivec2 first = min(ivec2(at), max(size - 2, ivec2(0, 0)));
+    ivec2 last = min(first + 1, size - 1);
+    vec2 t = at - vec2(first);
 
+    for (int i = 0; i < 4; i++) {
+        bool farAlong = (i & 1) != 0;
+        bool farAcross = (i & 2) != 0;
+        corners[i] = (farAcross ? last.y : first.y) * size.x + (farAlong ? last.x : first.x);
+        weights[i] = (farAlong ? t.x : 1.0 - t.x) * (farAcross ? t.y : 1.0 - t.y);
+    }
+}
+
+// Moves the mass along with whatever the coarse grid did over the frame
+void ProlongFromCoarse() {
+    if (int(gid) >= numMasses || MassParameters[gid].isFixed) return;
+    int corners[4];
+    float weights[4];
+    CoarseCorners(corners, weights);
+
+    vec3 moved = vec3(0, 0, 0);
+    vec3 accelerated = vec3(0, 0, 0);
+    for (int i = 0; i < 4; i++) {
+        int c = corners[i];
+        moved += weights[i] * (CoarsePositions[c].xyz - CoarseStarts[2 * c].xyz);
+        accelerated += weights[i] * (CoarseVelocities[c].xyz - CoarseStarts[2 * c + 1].xyz);
+    }
+    Positions[gid].xyz += moved;
+    Velocities[gid].xyz += accelerated;
+}
+
+// The part of the mass' velocity that the coarse grid has already moved it by. The fine grid then only moves the masses by the rest, so
+// it can step through the whole frame without the cloth's global motion being counted twice
+vec3 CarriedVelocity() {
+    if (!internalForcesOnly) return vec3(0, 0, 0);
+    int corners[4];
+    float weights[4];
+    CoarseCorners(corners, weights);
+
+    vec3 carried = vec3(0, 0, 0);
+    for (int i = 0; i < 4; i++) carried += weights[i] * CoarseVelocities[corners[i]].xyz;
+    return carried;
+}
+// -- -- //
+
+// Verlet steps on from where the mass was a substep ago instead of from its velocity, which is the central difference. The others are
+// semi-implicit Euler with their own accelerations
+void IntegrateForces() {
     if (!MassParameters[gid].isFixed) {
-        /*vec3 newPos = 2 * Positions[gid].xyz - LastPositions[gid].xyz + Accelerations[gid].xyz * dt * dt;
+#if EXPLICIT_SCHEME == VERLET_SCHEME
+        vec3 newPos = 2.0 * Positions[gid].xyz - LastPositions[gid].xyz + Accelerations[gid].xyz * dt * dt;
+        // Paused frames step by nothing
+        if (dt > 0) Velocities[gid].xyz = (newPos - LastPositions[gid].xyz) / (2.0 * dt) + CarriedVelocity();
         LastPositions[gid].xyz = Positions[gid].xyz;
-        Positions[gid].xyz = newPos;*/
+        Positions[gid].xyz = newPos;
+#else
         Velocities[gid].xyz += Accelerations[gid].xyz * dt;
-        //Positions[gid].xyz += Velocities[gid].xyz * dt + Accelerations[gid].xyz * dt * dt;
-        Positions[gid].xyz += Velocities[gid].xyz * dt;
+        Positions[gid].xyz += (Velocities[gid].xyz - CarriedVelocity()) * dt;
+#endif
     } else {
         Velocities[gid].xyz = vec3(0, 0, 0);
+#if EXPLICIT_SCHEME == VERLET_SCHEME
+        LastPositions[gid].xyz = Positions[gid].xyz;
+#endif
     }
 }
 
-void ExecuteCollisions() {
-    float extraRadiusFactor = 1.01;
-    if (distance(Positions[gid].xyz, obstacleCenter) < obstacleRadius * extraRadiusFactor) {
-        vec3 normal = normalize(Positions[gid].xyz - obstacleCenter);
-        Positions[gid].xyz = obstacleCenter + normal * obstacleRadius * extraRadiusFactor;
+// Where the mass would have been a substep ago at its current velocity. Anything outside the explicit substeps may have moved the masses
+// or changed dt, so Verlet starts over from here every frame
+void StartVerlet() {
+    LastPositions[gid].xyz = Positions[gid].xyz - (Velocities[gid].xyz - CarriedVelocity()) * dt;
+}
+
+// A mass that a collision or tether moved carries on from the velocity it was left with, rather than from where it was
+void RestartVerletIfMoved(vec3 integrated) {
+#if EXPLICIT_SCHEME == VERLET_SCHEME
+    if (Positions[gid].xyz != integrated) StartVerlet();
+#endif
+}
+
+// Long-range attachment. A mass can't get further from its anchor than it is along the cloth at rest, so the cloth keeps its length
+// without waiting for the stretch to travel down every spring in between
+void ApplyTether(inout vec3 position, inout vec3 velocity) {
+    Tether tether = Tethers[gid];
+    if (tetherStretch == 0 || tether.anchor == BAD_INDEX) return;
+    vec3 fromAnchor = position - Positions[tether.anchor].xyz;
+    float reach = length(fromAnchor);
+    float longest = tetherStretch * tether.length;
+    if (reach <= longest) return;
+
+    vec3 outward = fromAnchor / reach;
+    position -= (reach - longest) * outward;
+    velocity -= max(dot(velocity, outward), 0.0) * outward;
+}
+
+// The mass moved from start to where it is over the step
+void ExecuteCollisions(vec3 start, float stepDt) {
+    vec3 position = Positions[gid].xyz, velocity = Velocities[gid].xyz;
+    CollideWithSphere(start, position, velocity, obstacleSubstep, stepDt);
+    if (!MassParameters[gid].isFixed) ApplyTether(position, velocity);
+    if (!MassParameters[gid].isFixed) CollideWithObstacles(position, velocity);
+    Positions[gid].xyz = position;
+    Velocities[gid].xyz = velocity;
+}
 
-        vec3 velTowardCenter = dot(-1 * normal, Velocities[gid].xyz) * (-1 * normal);
-        Velocities[gid].xyz -= velTowardCenter;
-        Velocities[gid].xyz *= 0.9999;
-        //Velocities[gid].xyz = normal * (dot(Velocities[gid].xyz * -0.9, normal));
-        //Velocities[gid].xyz = vec3(0, 0, 0);
+// Sum of the mass' triangles' normals, weighted by their area
+void ComputeMeshNormals() {
+    vec3 position = Positions[gid].xyz;
+    vec3 normal = vec3(0, 0, 0);
+    for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+        uint opposite = SpringOpposites[s];
+        if (opposite == BAD_INDEX) continue;
+        normal += cross(Positions[SpringNeighbours[s]].xyz - position, Positions[opposite].xyz - position);
     }
+
+    float normalLength = length(normal);
+    Normals[gid].xyz = normalLength > 0 ? normal / normalLength : vec3(0, 0, 0);
 }
 
 void ComputeNormals() {
+    if (topology != GridTopology) {
+        ComputeMeshNormals();
+        return;
+    }
+
     Connections connections = MassParameters[gid].connections;
     uint leftIndex = BAD_INDEX, upIndex = BAD_INDEX;
 
@@ -216,14 +557,602 @@ void ComputeNormals() {
     Normals[gid].xyz = normal;
 }
 
+// -- Implicit integration -- //
+// Must be reached by every invocation in the work group
+void WriteGroupSum(float value, uint partialsOffset) {
+    barrier();  // groupSums may still be being read from the last reduction
+    groupSums[gl_LocalInvocationIndex] = value;
+    barrier();
+    for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2) {
+        if (gl_LocalInvocationIndex < stride) {
+            groupSums[gl_LocalInvocationIndex] += groupSums[gl_LocalInvocationIndex + stride];
+        }
+        barrier();
+    }
+
+    if (gl_LocalInvocationIndex == 0) {
+        Partials[partialsOffset + gl_WorkGroupID.x] = groupSums[0];
+    }
+}
+
+// Every work group adds up the same partials in the same order, so they all get the same total without another dispatch.
+// Must be reached by every invocation in the work group
+float SumPartials(uint partialsOffset) {
+    float sum = 0;
+    for (uint g = gl_LocalInvocationIndex; g < gl_NumWorkGroups.x; g += gl_WorkGroupSize.x) {
+        sum += Partials[partialsOffset + g];
+    }
+
+    barrier();  // groupSums may still be being read from the last reduction
+    groupSums[gl_LocalInvocationIndex] = sum;
+    barrier();
+    for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2) {
+        if (gl_LocalInvocationIndex < stride) {
+            groupSums[gl_LocalInvocationIndex] += groupSums[gl_LocalInvocationIndex + stride];
+        }
+        barrier();
+    }
+    return groupSums[0];
+}
+
+uint ProductPartials() {
+    return 0;
+}
+
+uint ResidualPartials(int iteration) {
+    return gl_NumWorkGroups.x * (1 + uint(iteration % 2));
+}
+
+// The explicit step's damping and normal drag, as a matrix applied to a velocity
+mat3 DragJacobian(vec3 normal) {
+    return dampingFactor * mat3(1) + dragFactor * outerProduct(normal, normal);
+}
+
+void BuildImplicitSystem() {
+    float h = implicitDt;
+    float mass = MassParameters[gid].mass;
+    vec3 position = Positions[gid].xyz;
+    vec3 velocity = Velocities[gid].xyz;
+    mat3 drag = DragJacobian(Normals[gid].xyz);
+
+    vec3 force = mass * (gravity - drag * velocity);
+    vec3 stiffnessTimesVelocity = vec3(0, 0, 0);
+    mat3 diagonal = mass * (mat3(1) + h * drag);
+
+    for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+        uint other = SpringNeighbours[s];
+        float rest = SpringRestLengths[s];
+
+        // Each spring is shared between its two masses, which the explicit step models as each getting half of the force
+        float springKs = 0.5 * SpringStiffnesses[s];
+        float springKd = 0.5 * SpringDampings[s];
+        vec3 toThis = position - Positions[other].xyz;
+        float springLength = length(toThis);
+        vec3 direction = springLength > 0 ? toThis / springLength : vec3(0, 0, 1);
+        vec3 relativeVelocity = velocity - Velocities[other].xyz;
+        force += (-springKs * (springLength - rest) - springKd * dot(direction, relativeVelocity)) * direction;
+
+        // Dropping the transverse term under compression keeps the system positive definite
+        mat3 alongSpring = outerProduct(direction, direction);
+        float transverse = springLength > 0 ? max(1 - rest / springLength, 0) : 0;
+        mat3 stiffness = springKs * (alongSpring + transverse * (mat3(1) - alongSpring));
+        mat3 block = h * springKd * alongSpring + h * h * stiffness;
+
+        SpringBlocks[s] = block;
+        diagonal += block;
+        stiffnessTimesVelocity += stiffness * relativeVelocity;
+    }
+
+    vec3 rhs = h * force - h * h * stiffnessTimesVelocity;
+    if (MassParameters[gid].isFixed) rhs = vec3(0, 0, 0);  // Pinned masses can't change velocity
+
+    mat3 preconditioner = inverse(diagonal);
+    vec3 z = preconditioner * rhs;
+    Preconditioners[gid] = preconditioner;
+    DeltaVelocities[gid] = vec4(0, 0, 0, 0);
+    Residuals[gid] = vec4(rhs, 0);
+    PreconditionedResiduals[gid] = vec4(z, 0);
+    SearchDirections[gid] = vec4(z, 0);
+
+    WriteGroupSum(dot(rhs, z), ResidualPartials(0));
+}
+
+void ApplySystem() {
+    float mass = MassParameters[gid].mass;
+    vec3 p = SearchDirections[gid].xyz;
+    vec3 q = mass * (mat3(1) + implicitDt * DragJacobian(Normals[gid].xyz)) * p;
+
+    for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+        q += SpringBlocks[s] * (p - SearchDirections[SpringNeighbours[s]].xyz);
+    }
+
+    if (MassParameters[gid].isFixed) q = vec3(0, 0, 0);
+    Products[gid] = vec4(q, 0);
+
+    WriteGroupSum(dot(p, q), ProductPartials());
+}
+
+void UpdateSolution() {
+    float pq = SumPartials(ProductPartials());
+    float rz = SumPartials(ResidualPartials(solverIteration));
+    float alpha = pq != 0 ? rz / pq : 0;
+
+    DeltaVelocities[gid].xyz += alpha * SearchDirections[gid].xyz;
+    vec3 r = Residuals[gid].xyz - alpha * Products[gid].xyz;
+    vec3 z = Preconditioners[gid] * r;
+    Residuals[gid].xyz = r;
+    PreconditionedResiduals[gid].xyz = z;
+
+    WriteGroupSum(dot(r, z), ResidualPartials(solverIteration + 1));
+}
+
+void UpdateSearchDirection() {
+    float oldRz = SumPartials(ResidualPartials(solverIteration));
+    float newRz = SumPartials(ResidualPartials(solverIteration + 1));
+    float beta = oldRz != 0 ? newRz / oldRz : 0;
+
+    SearchDirections[gid].xyz = PreconditionedResiduals[gid].xyz + beta * SearchDirections[gid].xyz;
+}
+
+void FinishImplicitStep() {
+    if (!MassParameters[gid].isFixed) {
+        Velocities[gid].xyz += DeltaVelocities[gid].xyz;
+        Positions[gid].xyz += Velocities[gid].xyz * implicitDt;
+    } else {
+        Velocities[gid].xyz = vec3(0, 0, 0);
+    }
+}
+// -- -- //
+
+// -- XPBD -- //
+vec3 DampedAcceleration(vec3 velocity) {
+    vec3 normal = Normals[gid].xyz;
+    return gravity - dragFactor * dot(normal, velocity) * normal - dampingFactor * velocity;
+}
+
+void XpbdPredict() {
+    LastPositions[gid] = Positions[gid];
+    Lambdas[gid] = vec4(0, 0, 0, 0);
+
+    if (!MassParameters[gid].isFixed) {
+        Velocities[gid].xyz += DampedAcceleration(Velocities[gid].xyz) * xpbdDt;
+        Positions[gid].xyz += Velocities[gid].xyz * xpbdDt;
+    } else {
+        Velocities[gid].xyz = vec3(0, 0, 0);
+    }
+}
+
+float InverseMass(uint i) {
+    return MassParameters[i].isFixed ? 0 : 1 / MassParameters[i].mass;
+}
+
+// Moves both masses toward the rest length and returns how much the constraint's lambda changed
+float ProjectDistance(uint a, uint b, float rest, float compliance, float lambda) {
+    vec3 delta = Positions[a].xyz - Positions[b].xyz;
+    float distance = length(delta);
+    float weightA = InverseMass(a), weightB = InverseMass(b);
+    float alphaTilde = compliance / (xpbdDt * xpbdDt);
+    float denominator = weightA + weightB + alphaTilde;
+    if (distance == 0 || denominator == 0) return 0;
+
+    vec3 direction = delta / distance;
+    float deltaLambda = (rest - distance - alphaTilde * lambda) / denominator;
+    Positions[a].xyz += weightA * deltaLambda * direction;
+    Positions[b].xyz -= weightB * deltaLambda * direction;
+    return deltaLambda;
+}
+
+// The grid's constraints split into colors that share no masses, so a whole color can be projected at once. Each constraint type
+// takes two colors: even and odd strands for the ones across strands, even and odd positions along the strand for the others.
+// Bending constraints span two springs, so they alternate every other pair
+void XpbdProjectColor() {
+    int constraint = xpbdColor / 2;
+    int parity = xpbdColor % 2;
+    int strand = int(gid) / massesPerThread;
+    int alongStrand = int(gid) % massesPerThread;
+    Connections connections = MassParameters[gid].connections;
+
+    uint other;
+    int position;
+    if (constraint == StretchLeftConstraint) {
+        other = connections.left;
+        position = strand;
+    } else if (constraint == StretchDownConstraint) {
+        other = connections.down;
+        position = alongStrand;
+    } else if (constraint == BendLeftConstraint) {
+        other = connections.left != BAD_INDEX ? MassParameters[connections.left].connections.left : BAD_INDEX;
+        position = strand / 2;
+    } else {
+        other = connections.down != BAD_INDEX ? MassParameters[connections.down].connections.down : BAD_INDEX;
+        position = alongStrand / 2;
+    }
+    if (other == BAD_INDEX || position % 2 != parity) return;
+
+    bool isBend = constraint >= BendLeftConstraint;
+    float rest = isBend ? 2 * restLength : restLength;
+    float compliance = 1 / (isBend ? bendStiffnessFactor * ks : ks);
+    Lambdas[gid][constraint] += ProjectDistance(gid, other, rest, compliance, Lambdas[gid][constraint]);
+}
+
+void XpbdProjectCollision() {
+    vec3 position = Positions[gid].xyz, unused = vec3(0, 0, 0);  // Velocities come from how far the masses moved
+    CollideWithSphere(LastPositions[gid].xyz, position, unused, obstacleSubstep, xpbdDt);
+    if (!MassParameters[gid].isFixed) ApplyTether(position, unused);
+    if (!MassParameters[gid].isFixed) CollideWithObstacles(position, unused);
+    Positions[gid].xyz = position;
+}
+
+void XpbdUpdateVelocity() {
+    if (MassParameters[gid].isFixed) {
+        Velocities[gid].xyz = vec3(0, 0, 0);
+        return;
+    }
+
+    vec3 velocity = (Positions[gid].xyz - LastPositions[gid].xyz) / xpbdDt;
+
+    // Masses resting on the obstacle keep only their tangential velocity, as in ExecuteCollisions
+    vec3 fromCenter = Positions[gid].xyz - obstacleCenter;
+    if (length(fromCenter) <= obstacleRadius * extraRadiusFactor * 1.0001) {
+        vec3 normal = normalize(fromCenter);
+        velocity -= min(dot(velocity, normal), 0) * normal;
+        velocity *= 0.9999;
+    }
+    Velocities[gid].xyz = velocity;
+}
+// -- -- //
+
+// Whether there's an untorn spring from one mass to the other
+bool SpringIntact(uint from, uint to) {
+    for (uint s = SpringOffsets[from]; s < SpringOffsets[from + 1]; s++) {
+        if (SpringNeighbours[s] == to) return SpringStiffnesses[s] > 0;
+    }
+    return false;
+}
+
+// -- Self-collision -- //
+// Every few substeps, masses closer than selfCollisionDistance are pushed apart and lose the velocity that brought them together.
+// Masses joined by a spring are left to the spring. Any two others are at least selfCollisionDistance apart at rest
+
+int HashTableSize() {
+    return (numMasses + 127) / 128 * 128;  // NumAllocatedMasses in ClothManager.h
+}
+
+ivec3 HashCell(vec3 position) {
+    return ivec3(floor(position / selfCollisionDistance));
+}
+
+// Must match HashOf in ClothCpuSolver.cpp
+uint HashOf(ivec3 cell) {
+    uint hash = (uint(cell.x) * 92837111u) ^ (uint(cell.y) * 689287499u) ^ (uint(cell.z) * 283923481u);
+    return hash % uint(HashTableSize());
+}
+
+void ClearHash() {
+    CellStarts[gid] = 0;
+    if (gid == 0) CellStarts[HashTableSize()] = numMasses;  // The end of the last cell
+}
+
+void CountHashCell() {
+    if (gid < uint(numMasses)) atomicAdd(CellStarts[HashOf(HashCell(Positions[gid].xyz))], 1);
+}
+
+// Inclusive scan of the group's counts, so each cell holds where it ends within the group
+void ScanHashGroup() {
+    uint local = gl_LocalInvocationIndex;
+    groupCounts[local] = CellStarts[gid];
+    barrier();
+
+    for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2) {
+        int before = local >= offset ? groupCounts[local - offset] : 0;
+        barrier();
+        groupCounts[local] += before;
+        barrier();
+    }
+
+    CellStarts[gid] = groupCounts[local];
+    if (local == gl_WorkGroupSize.x - 1) CellStarts[uint(HashTableSize() + 1) + gl_WorkGroupID.x] = groupCounts[local];
+}
+
+// Run as a single work group. Turns the group totals into the count of everything before each group. Each thread scans its own run
+// of the groups, then the runs are offset by the totals before them
+void ScanHashTotals() {
+    uint numGroups = uint(HashTableSize()) / gl_WorkGroupSize.x;
+    uint perThread = (numGroups + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    uint first = min(gl_LocalInvocationIndex * perThread, numGroups);
+    uint last = min(first + perThread, numGroups);
+    uint totals = uint(HashTableSize()) + 1;
+
+    int sum = 0;
+    for (uint g = first; g < last; g++) {
+        sum += CellStarts[totals + g];
+    }
+    groupCounts[gl_LocalInvocationIndex] = sum;
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        int running = 0;
+        for (uint t = 0; t < gl_WorkGroupSize.x; t++) {
+            int count = groupCounts[t];
+            groupCounts[t] = running;
+            running += count;
+        }
+    }
+    barrier();
+
+    int running = groupCounts[gl_LocalInvocationIndex];
+    for (uint g = first; g < last; g++) {
+        int count = CellStarts[totals + g];
+        CellStarts[totals + g] = running;
+        running += count;
+    }
+}
+
+void OffsetHashGroup() {
+    CellStarts[gid] += CellStarts[uint(HashTableSize() + 1) + gl_WorkGroupID.x];
+}
+
+// Each mass takes the last free entry of its cell, so once every mass is in, each cell's end has become where it starts
+void FillHashCell() {
+    if (gid < uint(numMasses)) CellMasses[atomicAdd(CellStarts[HashOf(HashCell(Positions[gid].xyz))], -1) - 1] = gid;
+}
+
+// Torn springs don't count, so the two sides of a tear collide with each other
+bool SharesSpring(uint other) {
+    return SpringIntact(gid, other);
+}
+
+// Averages the push from every mass that's too close, so a mass squeezed from both sides doesn't get thrown out of the cloth
+void FindSelfCollisions() {
+    SelfCollisionDeltas[2 * gid] = vec4(0, 0, 0, 0);
+    SelfCollisionDeltas[2 * gid + 1] = vec4(0, 0, 0, 0);
+    if (gid >= uint(numMasses) || MassParameters[gid].isFixed) return;
+
+    vec3 position = Positions[gid].xyz;
+    vec3 velocity = Velocities[gid].xyz;
+    ivec3 cell = HashCell(position);
+    vec3 push = vec3(0, 0, 0), slow = vec3(0, 0, 0);
+    int contacts = 0;
+
+    // Neighbouring cells can share a bucket of the table, which mustn't be looked through twice
+    uint visited[27];
+    int numVisited = 0;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            for (int z = -1; z <= 1; z++) {
+                uint hash = HashOf(cell + ivec3(x, y, z));
+                bool seen = false;
+                for (int v = 0; v < numVisited; v++) {
+                    seen = seen || visited[v] == hash;
+                }
+                if (seen) continue;
+                visited[numVisited++] = hash;
+
+                for (int entry = CellStarts[hash]; entry < CellStarts[hash + 1]; entry++) {
+                    uint other = CellMasses[entry];
+                    vec3 toThis = position - Positions[other].xyz;
+                    float distanceSquared = dot(toThis, toThis);
+                    if (other == gid || distanceSquared >= selfCollisionDistance * selfCollisionDistance || distanceSquared == 0 ||
+                        SharesSpring(other)) {
+                        continue;
+                    }
+
+                    float distance = sqrt(distanceSquared);
+                    vec3 normal = toThis / distance;
+                    push += 0.5 * (selfCollisionDistance - distance) * normal;
+                    float approachSpeed = dot(velocity - Velocities[other].xyz, normal);
+                    if (approachSpeed < 0) slow -= 0.5 * approachSpeed * normal;
+                    contacts++;
+                }
+            }
+        }
+    }
+
+    if (contacts == 0) return;
+    SelfCollisionDeltas[2 * gid] = vec4(push / float(contacts), 0);
+    SelfCollisionDeltas[2 * gid + 1] = vec4(slow / float(contacts), 0);
+}
+
+void ApplySelfCollision() {
+    Positions[gid].xyz += SelfCollisionDeltas[2 * gid].xyz;
+    Velocities[gid].xyz += SelfCollisionDeltas[2 * gid + 1].xyz;
+#if EXPLICIT_SCHEME == VERLET_SCHEME
+    // Verlet's velocity is how far the mass has come since its last position, so that moves with it. XPBD predicts its own anyway
+    LastPositions[gid].xyz += SelfCollisionDeltas[2 * gid].xyz - SelfCollisionDeltas[2 * gid + 1].xyz * dt;
+#endif
+}
+// -- -- //
+
+// -- Tearing -- //
+// Springs stretched past tearStrain times their rest length break, losing their stiffness and damping, and a grid mass loses the
+// connection too. Both ends hold their own copy of a spring and see exactly the same strain, so both copies break in the same pass
+// without either end writing to the other's
+void TearSprings() {
+    vec3 position = Positions[gid].xyz;
+    for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+        uint other = SpringNeighbours[s];
+        if (SpringStiffnesses[s] == 0 || distance(position, Positions[other].xyz) <= tearStrain * SpringRestLengths[s]) continue;
+        SpringStiffnesses[s] = 0;
+        SpringDampings[s] = 0;
+
+        Connections connections = MassParameters[gid].connections;
+        if (connections.left == other) MassParameters[gid].connections.left = BAD_INDEX;
+        if (connections.right == other) MassParameters[gid].connections.right = BAD_INDEX;
+        if (connections.up == other) MassParameters[gid].connections.up = BAD_INDEX;
+        if (connections.down == other) MassParameters[gid].connections.down = BAD_INDEX;
+    }
+}
+
+// One invocation per triangle. A triangle with a torn edge is drawn with all three corners on its first mass, so it doesn't show
+void MaskTriangles() {
+    if (gid >= uint(numTriangles)) return;
+    uint a = TriangleIndices[3 * gid], b = TriangleIndices[3 * gid + 1], c = TriangleIndices[3 * gid + 2];
+    bool intact = SpringIntact(a, b) && SpringIntact(b, c) && SpringIntact(c, a);
+    RenderedTriangleIndices[3 * gid] = a;
+    RenderedTriangleIndices[3 * gid + 1] = intact ? b : a;
+    RenderedTriangleIndices[3 * gid + 2] = intact ? c : a;
+}
+// -- -- //
+
+// -- Energy monitor -- //
+// Energies and NaN counts add up, strains take the largest
+vec4 CombineReadings(vec4 a, vec4 b) {
+    return vec4(a.x + b.x, a.y + b.y, max(a.z, b.z), a.w + b.w);
+}
+
+// Must be reached by every invocation in the work group
+vec4 ReduceGroupReadings(vec4 reading) {
+    groupReadings[gl_LocalInvocationIndex] = reading;
+    barrier();
+    for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2) {
+        if (gl_LocalInvocationIndex < stride) {
+            groupReadings[gl_LocalInvocationIndex] = CombineReadings(groupReadings[gl_LocalInvocationIndex],
+                                                                     groupReadings[gl_LocalInvocationIndex + stride]);
+        }
+        barrier();
+    }
+    return groupReadings[0];
+}
+
+// Each end of a spring holds a copy and gets half its force, so each copy stores a quarter of 1/2 k x^2. Torn springs store nothing
+void MeasureEnergy() {
+    vec4 reading = vec4(0, 0, 0, 0);  // Padding reads as nothing
+    vec3 position = Positions[gid].xyz, velocity = Velocities[gid].xyz;
+    bool real = gid < uint(numMasses);
+    if (real && (isNan(position) || isInf(position) || isNan(velocity) || isInf(velocity))) {
+        reading.w = 1;
+    } else if (real) {
+        reading.x = 0.5 * MassParameters[gid].mass * dot(velocity, velocity);
+        for (uint s = SpringOffsets[gid]; s < SpringOffsets[gid + 1]; s++) {
+            if (SpringStiffnesses[s] == 0) continue;
+            float length = distance(position, Positions[SpringNeighbours[s]].xyz);
+            float stretch = length - SpringRestLengths[s];
+            reading.y += 0.125 * SpringStiffnesses[s] * stretch * stretch;
+            reading.z = max(reading.z, length / SpringRestLengths[s]);
+        }
+    }
+
+    vec4 total = ReduceGroupReadings(reading);
+    if (gl_LocalInvocationIndex == 0) EnergyReadings[1 + gl_WorkGroupID.x] = total;
+}
+
+// A single work group. Readings taken since the CPU last read them back keep their peaks, so a spike between readbacks isn't missed
+void SumEnergy() {
+    uint numGroups = (uint(numMasses) + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    vec4 reading = vec4(0, 0, 0, 0);
+    for (uint g = gl_LocalInvocationIndex; g < numGroups; g += gl_WorkGroupSize.x) {
+        reading = CombineReadings(reading, EnergyReadings[1 + g]);
+    }
+
+    vec4 total = ReduceGroupReadings(reading);
+    if (gl_LocalInvocationIndex == 0) EnergyReadings[0] = firstEnergyReading ? total : max(EnergyReadings[0], total);
+}
+// -- -- //
+
+// -- Wind -- //
+// Gusts sweep through the cloth along the wind, while a slower swirl pushes it about across it
+vec3 WindAt(vec3 p, float t) {
+    if (windMode != GustyWind) return windVelocity;
+    float gust = 1.0 + 0.6 * sin(1.3 * t - 0.25 * p.x) * sin(0.7 * t + 0.2 * p.y);
+    vec3 swirl = vec3(0.0, sin(0.9 * t + 0.3 * p.z), 0.5 * cos(1.1 * t + 0.3 * p.y));
+    return gust * windVelocity + 1.5 * swirl;
+}
+
+// A flat plate's drag along the air's velocity relative to it and its lift across it. Both scale with the dynamic pressure on the area
+// facing the air, and lift is strongest side-on to it
+vec3 AerodynamicForce(vec3 areaNormal, vec3 relativeWind) {
+    float area = length(areaNormal);
+    float speed = length(relativeWind);
+    if (area == 0.0 || speed == 0.0) return vec3(0, 0, 0);
+
+    vec3 n = areaNormal / area;
+    vec3 along = relativeWind / speed;
+    float facing = dot(n, along);
+    if (facing < 0.0) {  // The side the air hits
+        n = -n;
+        facing = -facing;
+    }
+    vec3 across = n - facing * along;  // As long as the sine of the angle of attack
+    float pressure = 0.5 * airDensity * speed * speed * area * facing;
+    return pressure * (windDragCoefficient * along + windLiftCoefficient * across);
+}
+
+// Triangles the cloth has torn through are collapsed onto their first corner in the IBO, so have no area to catch the wind
+void ComputeWindForce() {
+    if (gid >= uint(numTriangles)) return;
+    uint a = RenderedTriangleIndices[3 * gid], b = RenderedTriangleIndices[3 * gid + 1], c = RenderedTriangleIndices[3 * gid + 2];
+    vec3 pa = Positions[a].xyz, pb = Positions[b].xyz, pc = Positions[c].xyz;
+    vec3 center = (pa + pb + pc) / 3.0;
+    vec3 velocity = (Velocities[a].xyz + Velocities[b].xyz + Velocities[c].xyz) / 3.0;
+    vec3 areaNormal = 0.5 * cross(pb - pa, pc - pa);
+    TriangleForces[gid] = vec4(AerodynamicForce(areaNormal, WindAt(center, windTime) - velocity) / 3.0, 0.0);
+}
+// -- -- //
+
 void main() {
     gid = gl_GlobalInvocationID.x;
 
-    if (computationStage == 0) {
+    if (computationStage == ForcesStage) {
         CalculateForces();
-    } else if (computationStage == 1) {
+    } else if (computationStage == IntegrateStage) {
+        vec3 start = Positions[gid].xyz;
         IntegrateForces();
-        ExecuteCollisions();
+        vec3 integrated = Positions[gid].xyz;
+        ExecuteCollisions(start, dt);
+        RestartVerletIfMoved(integrated);
+        ComputeNormals();
+    } else if (computationStage == BuildImplicitSystemStage) {
+        BuildImplicitSystem();
+    } else if (computationStage == ApplySystemStage) {
+        ApplySystem();
+    } else if (computationStage == UpdateSolutionStage) {
+        UpdateSolution();
+    } else if (computationStage == UpdateSearchDirectionStage) {
+        UpdateSearchDirection();
+    } else if (computationStage == FinishImplicitStepStage) {
+        FinishImplicitStep();
+        ExecuteCollisions(Positions[gid].xyz - Velocities[gid].xyz * implicitDt, implicitDt);
+    } else if (computationStage == NormalsStage) {
         ComputeNormals();
+    } else if (computationStage == XpbdPredictStage) {
+        XpbdPredict();
+    } else if (computationStage == XpbdConstraintStage) {
+        XpbdProjectColor();
+    } else if (computationStage == XpbdCollisionStage) {
+        XpbdProjectCollision();
+    } else if (computationStage == XpbdVelocityStage) {
+        XpbdUpdateVelocity();
+    } else if (computationStage == HashClearStage) {
+        ClearHash();
+    } else if (computationStage == HashCountStage) {
+        CountHashCell();
+    } else if (computationStage == HashScanGroupsStage) {
+        ScanHashGroup();
+    } else if (computationStage == HashScanTotalsStage) {
+        ScanHashTotals();
+    } else if (computationStage == HashOffsetStage) {
+        OffsetHashGroup();
+    } else if (computationStage == HashFillStage) {
+        FillHashCell();
+    } else if (computationStage == SelfCollisionStage) {
+        FindSelfCollisions();
+    } else if (computationStage == ApplySelfCollisionStage) {
+        ApplySelfCollision();
+    } else if (computationStage == TearSpringsStage) {
+        TearSprings();
+    } else if (computationStage == MaskTrianglesStage) {
+        MaskTriangles();
+    } else if (computationStage == MeasureEnergyStage) {
+        MeasureEnergy();
+    } else if (computationStage == SumEnergyStage) {
+        SumEnergy();
+    } else if (computationStage == StartVerletStage) {
+        StartVerlet();
+    } else if (computationStage == RestrictToCoarseStage) {
+        RestrictToCoarse();
+    } else if (computationStage == ProlongFromCoarseStage) {
+        ProlongFromCoarse();
+    } else if (computationStage == WindForcesStage) {
+        ComputeWindForce();
     }
 }
\ No newline at end of file
@@ -0,0 +1,290 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Runs several of clothComputeShader.glsl's explicit midpoint substeps per dispatch. Each work group copies a tile of the cloth plus a
+// halo into shared memory and steps it there. Masses in the halo go stale from the outside in, two rings per substep, so only the
+// tile's interior is still exact at the end and gets written back. Neighbouring tiles only see each other's results between dispatches.
+// A tile's halo is some other tile's interior, so results go to a second set of buffers and the CPU swaps them between dispatches
+
+precision highp float;
+
+layout(std140, binding = 1) buffer Pos {
+    vec4 Positions[];
+};
+
+layout(std140, binding = 2) buffer Vel {
+    vec4 Velocities[];
+};
+
+layout(std140, binding = 3) buffer Norms {
+    vec4 Normals[];  // Only written, since normals are recomputed from positions
+};
+
+layout(std140, binding = 7) buffer PosOut {
+    vec4 PositionsOut[];
+};
+
+layout(std140, binding = 5) buffer VelOut {
+    vec4 VelocitiesOut[];
+};
+
+struct Connections {
+    uint left, right, up, down;
+};
+
+struct MassParams {
+    bool isFixed;
+    float mass;
+    Connections connections;
+};
+
+layout(std430, binding = 6) buffer MssPrps {
+    MassParams MassParameters[];
+};
+
+#include "obstacleCollisions.glsl"
+
+uniform int substeps;  // At most MaxSubsteps
+uniform int massesPerThread;
+uniform int numThreads;
+uniform int obstacleSubstep;  // Of the frame, at this dispatch's first substep
+
+layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
+
+// Must match ClothManager.h
+const int TileAlong = 36;   // Masses along a strand
+const int TileAcross = 37;  // Strands
+const int TileHalo = 11;
+const int MaxSubsteps = (TileHalo - 1) / 2;
+const int TileSize = TileAlong * TileAcross;
+const int MassesPerInvocation = (TileSize + 127) / 128;
+
+const vec3 gravity = vec3(0, 0, -9.8);
+const float dragFactor = 0.4;
+const float dampingFactor = 0.1;
+const float shearStiffnessFactor = 0.5;  // Must match ClothManager.h
+const float bendStiffnessFactor = 0.05;
+
+// Three floats each for a mass' position and velocity, and a bit for whether it's pinned, keep a tile with a halo wide enough for
+// MaxSubsteps under the 32KB of shared memory every GL 4.3 implementation has. Masses are read from MassParameters when they're needed
+shared float tilePositions[3 * TileSize];
+shared float tileVelocities[3 * TileSize];
+shared uint tileFixed[(TileSize + 31) / 32];
+
+ivec2 tileOrigin;  // Position along the strand and strand of the tile's first cell
+
+int CellIndex(ivec2 cell) {
+    return cell.y * TileAlong + cell.x;
+}
+
+ivec2 CellAt(int index) {
+    return ivec2(index % TileAlong, index / TileAlong);
+}
+
+uint MassAt(ivec2 cell) {
+    ivec2 mass = tileOrigin + cell;
+    return uint(mass.y * massesPerThread + mass.x);
+}
+
+bool OnCloth(ivec2 cell) {
+    ivec2 mass = tileOrigin + cell;
+    return mass.x >= 0 && mass.x < massesPerThread && mass.y >= 0 && mass.y < numThreads;
+}
+
+// Cells outside the tile are treated like cells off the cloth. That's only wrong in the halo, which is thrown away
+bool Exists(ivec2 cell) {
+    return cell.x >= 0 && cell.x < TileAlong && cell.y >= 0 && cell.y < TileAcross && OnCloth(cell);
+}
+
+bool IsFree(int index) {
+    return OnCloth(CellAt(index)) && (tileFixed[index / 32] & (1u << uint(index % 32))) == 0;
+}
+
+vec3 TilePosition(int index) {
+    return vec3(tilePositions[3 * index], tilePositions[3 * index + 1], tilePositions[3 * index + 2]);
+}
+
+vec3 TileVelocity(int index) {
+    return vec3(tileVelocities[3 * index], tileVelocities[3 * index + 1], tileVelocities[3 * index + 2]);
+}
+
+void SetTileState(int index, vec3 position, vec3 velocity) {
+    for (int axis = 0; axis < 3; axis++) {
+        tilePositions[3 * index + axis] = position[axis];
+        tileVelocities[3 * index + axis] = velocity[axis];
+    }
+}
+
+void LoadTile() {
+    for (int w = int(gl_LocalInvocationIndex); w < tileFixed.length(); w += int(gl_WorkGroupSize.x)) {
+        tileFixed[w] = 0;
+    }
+    barrier();
+
+    for (int c = int(gl_LocalInvocationIndex); c < TileSize; c += int(gl_WorkGroupSize.x)) {
+        if (!OnCloth(CellAt(c))) {
+            SetTileState(c, vec3(0, 0, 0), vec3(0, 0, 0));
+            continue;
+        }
+
+        uint gid = MassAt(CellAt(c));
+        SetTileState(c, Positions[gid].xyz, Velocities[gid].xyz);
+        if (MassParameters[gid].isFixed) atomicOr(tileFixed[c / 32], 1u << uint(c % 32));
+    }
+    barrier();
+}
+
+// Same as getSpringAcceleration in clothComputeShader.glsl. On a grid, every spring of a type has the same parameters, so they're
+// worked out from the spring's type instead of being read from the spring adjacency
+vec3 SpringAcceleration(vec3 p1, vec3 v1, float m1, vec3 p2, vec3 v2, float rest, float stiffness, float damping) {
+    vec3 toMassOneFromTwo = p1 - p2;
+    float springLength = length(toMassOneFromTwo);
+    if (springLength == 0) {
+        toMassOneFromTwo = vec3(0, 0, 1);
+    } else {
+        toMassOneFromTwo = toMassOneFromTwo / springLength;
+    }
+
+    float springForce = -stiffness * (springLength - rest);
+    float dampForce = -damping * (dot(toMassOneFromTwo, v1) - dot(toMassOneFromTwo, v2));
+    vec3 massOneAcc = 0.5 * (springForce + dampForce) * toMassOneFromTwo / m1;
+
+    if (any(isinf(massOneAcc)) || any(isnan(massOneAcc))) massOneAcc = vec3(0, 0, 0);
+    return massOneAcc;
+}
+
+vec3 MidpointSpringAcceleration(vec3 p1, vec3 v1, float m1, int two, ivec2 span, float factor) {
+    vec3 p2 = TilePosition(two), v2 = TileVelocity(two);
+    float rest = length(vec2(span)) * restLength;
+
+    vec3 a = SpringAcceleration(p1, v1, m1, p2, v2, rest, factor * ks, factor * kd);
+    vec3 vHalf = v1 + a * 0.5 * dt;
+    vec3 pHalf = p1 + vHalf * 0.5 * dt;
+    return SpringAcceleration(pHalf, vHalf, m1, p2, v2, rest, factor * ks, factor * kd);
+}
+
+// Same neighbour preference as ComputeNormals in clothComputeShader.glsl. Left is the next strand, up is the previous mass on this one
+vec3 TileNormal(ivec2 cell) {
+    ivec2 left = cell + ivec2(0, 1), right = cell - ivec2(0, 1), up = cell - ivec2(1, 0), down = cell + ivec2(1, 0);
+    ivec2 first, second;
+    if (Exists(left) && Exists(up)) {
+        first = left, second = up;
+    } else if (Exists(up) && Exists(right)) {
+        first = up, second = right;
+    } else if (Exists(right) && Exists(down)) {
+        first = right, second = down;
+    } else if (Exists(down) && Exists(left)) {
+        first = down, second = left;
+    } else {
+        return vec3(0, 0, 0);
+    }
+
+    vec3 position = TilePosition(CellIndex(cell));
+    vec3 toFirst = normalize(TilePosition(CellIndex(first)) - position);
+    vec3 toSecond = normalize(TilePosition(CellIndex(second)) - position);
+    return normalize(cross(toFirst, toSecond));
+}
+
+// Offsets (along the strand, across strands) to the other end of each spring, in the same order as ClothManager::GRID_SPRINGS:
+// structural, shear, then bend
+const int NumGridSprings = 12;
+const ivec2 GridSprings[NumGridSprings] = ivec2[NumGridSprings](ivec2(0, 1), ivec2(0, -1), ivec2(-1, 0), ivec2(1, 0), ivec2(-1, 1),
+                                                               ivec2(-1, -1), ivec2(1, 1), ivec2(1, -1), ivec2(0, 2), ivec2(0, -2),
+                                                               ivec2(-2, 0), ivec2(2, 0));
+
+float SpringFactor(int spring) {
+    return spring < 4 ? 1 : spring < 8 ? shearStiffnessFactor : bendStiffnessFactor;
+}
+
+// CalculateForces, for a cell of the tile. The normal comes from the current positions, which is what stage 1 would have left behind
+vec3 TileAcceleration(ivec2 cell) {
+    int index = CellIndex(cell);
+    vec3 position = TilePosition(index), velocity = TileVelocity(index);
+    float mass = MassParameters[MassAt(cell)].mass;
+    vec3 acc = gravity;
+
+    for (int n = 0; n < NumGridSprings; n++) {
+        ivec2 other = cell + GridSprings[n];
+        if (Exists(other)) acc += MidpointSpringAcceleration(position, velocity, mass, CellIndex(other), GridSprings[n], SpringFactor(n));
+    }
+
+    vec3 normal = TileNormal(cell);
+    acc -= dragFactor * dot(normal, velocity) * normal;
+    acc -= dampingFactor * velocity;
+    return acc;
+}
+
+// ApplyTether, for a grid. A mass' anchor is the first mass of its strand, which never moves, so it's read from the last dispatch
+void TileTether(int index, inout vec3 position, inout vec3 velocity) {
+    if (tetherStretch == 0) return;
+    ivec2 mass = tileOrigin + CellAt(index);
+    vec3 fromAnchor = position - Positions[mass.y * massesPerThread].xyz;
+    float reach = length(fromAnchor);
+    float longest = tetherStretch * float(mass.x) * restLength;
+    if (reach <= longest) return;
+
+    vec3 outward = fromAnchor / reach;
+    position -= (reach - longest) * outward;
+    velocity -= max(dot(velocity, outward), 0.0) * outward;
+}
+
+// IntegrateForces and ExecuteCollisions, for a cell of the tile
+void TileIntegrate(int index, vec3 acc, int step) {
+    vec3 start = TilePosition(index);
+    vec3 position = start;
+    vec3 velocity = TileVelocity(index);
+    bool isFree = IsFree(index);
+    if (isFree) {
+        velocity += acc * dt;
+        position += velocity * dt;
+    } else {
+        velocity = vec3(0, 0, 0);
+    }
+
+    CollideWithSphere(start, position, velocity, obstacleSubstep + step, dt);
+    if (isFree) TileTether(index, position, velocity);
+    if (isFree) CollideWithObstacles(position, velocity);
+
+    SetTileState(index, position, velocity);
+}
+
+void StoreInterior() {
+    for (int c = int(gl_LocalInvocationIndex); c < TileSize; c += int(gl_WorkGroupSize.x)) {
+        ivec2 cell = CellAt(c);
+        bool inInterior = all(greaterThanEqual(cell, ivec2(TileHalo))) && cell.x < TileAlong - TileHalo && cell.y < TileAcross - TileHalo;
+        if (!inInterior || !OnCloth(cell)) continue;
+
+        uint gid = MassAt(cell);
+        PositionsOut[gid] = vec4(TilePosition(c), 1);
+        VelocitiesOut[gid] = vec4(TileVelocity(c), 0);
+        Normals[gid].xyz = TileNormal(cell);
+    }
+}
+
+void main() {
+    ivec2 interiorSize = ivec2(TileAlong, TileAcross) - 2 * TileHalo;
+    tileOrigin = ivec2(gl_WorkGroupID.xy) * interiorSize - TileHalo;
+
+    LoadTile();
+
+    for (int step = 0; step < substeps; step++) {
+        vec3 accelerations[MassesPerInvocation];
+        for (int k = 0; k < MassesPerInvocation; k++) {
+            accelerations[k] = vec3(0, 0, 0);
+        }
+        for (int k = 0; k < MassesPerInvocation; k++) {
+            int c = int(gl_LocalInvocationIndex) + k * int(gl_WorkGroupSize.x);
+            if (c < TileSize && IsFree(c)) accelerations[k] = TileAcceleration(CellAt(c));
+        }
+        barrier();
+
+        for (int k = 0; k < MassesPerInvocation; k++) {
+            int c = int(gl_LocalInvocationIndex) + k * int(gl_WorkGroupSize.x);
+            if (c < TileSize && OnCloth(CellAt(c))) TileIntegrate(c, accelerations[k], step);
+        }
+        barrier();
+    }
+
+    StoreInterior();
+}
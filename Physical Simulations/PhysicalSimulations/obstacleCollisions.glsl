@@ -0,0 +1,131 @@
+// Collisions with the sphere and the mesh obstacles, shared by the compute shaders. ShaderManager splices this in wherever a shader has
+// an #include "obstacleCollisions.glsl" line, and defines OBSTACLE_THICKNESS from ObstacleBvh::THICKNESS
+
+// All of simParams, since the sphere is part of it
+layout(std430, binding = 4) buffer Parameters {
+    vec3 obstacleCenter;
+    float obstacleRadius;
+    float dt;
+    float ks;
+    float kd;
+    float restLength;
+    float selfCollisionDistance;
+    float lastObstacleCenterX, lastObstacleCenterY, lastObstacleCenterZ;  // Where obstacleCenter was at the end of the last frame
+    float tearStrain;  // 0 when tearing is off
+    float tetherStretch;  // 0 when tethers are off
+};
+
+uniform int obstacleSubsteps;  // Of the frame, for sweeping the sphere
+
+const float extraRadiusFactor = 1.01;
+
+// -- Mesh obstacles -- //
+// ObstacleBvh's trees, depth first, one obstacle's after another. Each node says which node comes after it and everything inside it, so
+// walking the trees needs no stack
+struct BvhNode {
+    vec3 boxMin;
+    int escape;
+    vec3 boxMax;
+    int firstTriangle;
+    int numTriangles;  // 0 for interior nodes
+};
+
+layout(std430, binding = 26) buffer ObstclNds {
+    BvhNode ObstacleNodes[];
+};
+
+layout(std430, binding = 27) buffer ObstclTrngls {
+    vec4 ObstacleTriangles[];  // Three corners per triangle, in world space
+};
+
+uniform int numObstacleNodes;
+
+const float obstacleThickness = OBSTACLE_THICKNESS;
+
+// From Real-Time Collision Detection, 5.1.5. Same as ClosestPointOnTriangle in ObstacleBvh.cpp
+vec3 ClosestPointOnTriangle(vec3 p, vec3 a, vec3 b, vec3 c) {
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return a;
+
+    vec3 bp = p - b;
+    float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+
+    vec3 cp = p - c;
+    float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denominator = 1.0 / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+void CollideWithTriangle(inout vec3 position, inout vec3 velocity, vec3 a, vec3 b, vec3 c) {
+    vec3 closest = ClosestPointOnTriangle(position, a, b, c);
+    vec3 away = position - closest;
+    float distance = length(away);
+    if (distance >= obstacleThickness) return;
+
+    vec3 faceNormal = cross(b - a, c - a);
+    if (distance == 0 && length(faceNormal) == 0) return;
+    vec3 normal = distance > 0 ? away / distance : normalize(faceNormal);
+    position = closest + normal * obstacleThickness;
+
+    velocity -= min(dot(velocity, normal), 0) * normal;
+    velocity *= 0.9999;
+}
+
+// Same as ObstacleBvh::Collide
+void CollideWithObstacles(inout vec3 position, inout vec3 velocity) {
+    int n = 0;
+    while (n < numObstacleNodes) {
+        BvhNode node = ObstacleNodes[n];
+        if (any(lessThan(position, node.boxMin - obstacleThickness)) || any(greaterThan(position, node.boxMax + obstacleThickness))) {
+            n = node.escape;
+            continue;
+        }
+
+        for (int t = node.firstTriangle; t < node.firstTriangle + node.numTriangles; t++) {
+            CollideWithTriangle(position, velocity, ObstacleTriangles[3 * t].xyz, ObstacleTriangles[3 * t + 1].xyz,
+                                ObstacleTriangles[3 * t + 2].xyz);
+        }
+        n++;  // Into the first child, or on from a leaf
+    }
+}
+// -- -- //
+
+// Where the obstacle is after the given substep of the frame. It moves in a straight line from where it was at the end of the last one
+vec3 ObstacleCenterAfter(int substep) {
+    vec3 lastObstacleCenter = vec3(lastObstacleCenterX, lastObstacleCenterY, lastObstacleCenterZ);
+    return mix(lastObstacleCenter, obstacleCenter, float(substep) / float(obstacleSubsteps));
+}
+
+// Swept against the obstacle as it moves over a substep. Relative to the obstacle, the mass moves in a straight line from start to
+// position, so a mass the obstacle went right over during the substep is caught on the side it was hit from
+void CollideWithSphere(vec3 start, inout vec3 position, inout vec3 velocity, int substep, float stepDt) {
+    vec3 fromCenter = ObstacleCenterAfter(substep), toCenter = ObstacleCenterAfter(substep + 1);
+    float radius = obstacleRadius * extraRadiusFactor;
+    vec3 begin = start - fromCenter, end = position - toCenter, travel = end - begin;
+
+    float a = dot(travel, travel), b = dot(begin, travel), c = dot(begin, begin) - radius * radius;
+    float discriminant = b * b - a * c;
+    bool crossed = c > 0 && b < 0 && discriminant > 0;
+    float t = crossed ? (-b - sqrt(discriminant)) / a : 1.0;
+    crossed = crossed && t < 1;
+    if (!crossed && dot(end, end) >= radius * radius) return;
+
+    vec3 normal = normalize(crossed ? begin + travel * t : end);
+    position = toCenter + normal * radius;
+    vec3 obstacleVelocity = stepDt > 0 ? (toCenter - fromCenter) / stepDt : vec3(0, 0, 0);
+    velocity -= dot(velocity - obstacleVelocity, normal) * normal;
+    velocity *= 0.9999;
+}
@@ -0,0 +1,214 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Strand mode. Every strand hangs from its first mass with no springs to any other strand, so each strand is stepped through the whole
+// frame in shared memory, an invocation per mass. A work group takes as many strands as fit, each in a slot of strandSlot invocations,
+// which is its length rounded up to a power of two. Each substep is XPBD, with a stretch constraint between neighbouring masses and a
+// bending one between every other mass. Each constraint of a kind only shares masses with the ones on either side of it, so all of a
+// strand's constraints of that kind make one tridiagonal system. Parallel cyclic reduction solves it directly in log2(strandSlot)
+// steps, where Gauss-Seidel would need a sweep per mass to carry a correction from one end of the strand to the other
+
+precision highp float;
+
+layout(std140, binding = 1) buffer Pos {
+    vec4 Positions[];
+};
+
+layout(std140, binding = 2) buffer Vel {
+    vec4 Velocities[];
+};
+
+layout(std140, binding = 3) buffer Norms {
+    vec4 Normals[];  // Only written, for shading the strands
+};
+
+struct Connections {
+    uint left, right, up, down;
+};
+
+struct MassParams {
+    bool isFixed;
+    float mass;
+    Connections connections;
+};
+
+layout(std430, binding = 6) buffer MssPrps {
+    MassParams MassParameters[];
+};
+
+#include "obstacleCollisions.glsl"
+
+uniform int numStrands;
+uniform int massesPerStrand;
+uniform int strandSlot;  // A power of two, at most MaxStrandMasses
+uniform int iterations;
+uniform float frameTime;
+uniform int windMode;
+uniform float windTime;  // Simulated seconds, at the start of the frame
+
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+const int MaxStrandMasses = 256;  // The work group's size. Must match ClothManager::MAX_STRAND_MASSES
+const vec3 gravity = vec3(0, 0, -9.8);
+const float airDragFactor = 1.0;  // Against the air's velocity relative to the mass, whether there's wind or not
+const float stretchCompliance = 0.0;  // Strands don't stretch
+const float bendCompliance = 0.002;   // Stiff, for masses of ClothManager::STRAND_MASS
+
+// Must match clothComputeShader.glsl
+const int GustyWind = 2;
+const int NormalDrag = 0;
+const vec3 windVelocity = vec3(5, 0, 0);
+
+// Each strand's slot of every array starts at its base
+shared vec4 strandPositions[MaxStrandMasses];       // w is the inverse mass, 0 for the root
+shared vec4 constraintDirections[MaxStrandMasses];  // From each constraint's first mass to its second
+shared float lower[MaxStrandMasses];                // Each constraint's row of the system
+shared float diagonal[MaxStrandMasses];
+shared float upper[MaxStrandMasses];
+shared float rhs[MaxStrandMasses];
+
+int k;     // The mass this invocation steps along its strand, and the first mass of the constraints it sets up
+int base;  // Where the strand's slot starts in the shared arrays
+bool isMass;
+uint gid;
+
+// Same as WindAt in clothComputeShader.glsl. Still air doesn't move
+vec3 WindAt(vec3 p, float t) {
+    if (windMode == NormalDrag) return vec3(0, 0, 0);
+    if (windMode != GustyWind) return windVelocity;
+    float gust = 1.0 + 0.6 * sin(1.3 * t - 0.25 * p.x) * sin(0.7 * t + 0.2 * p.y);
+    vec3 swirl = vec3(0.0, sin(0.9 * t + 0.3 * p.z), 0.5 * cos(1.1 * t + 0.3 * p.y));
+    return gust * windVelocity + 1.5 * swirl;
+}
+
+// Parallel cyclic reduction. Each step folds the rows stride away on either side into every row, leaving it coupled to the rows twice as
+// far away, until every row stands alone. Rows past the strand's constraints are identity rows, so they stay out of the way
+float SolveTridiagonal(int stride) {
+    int i = base + k;
+    for (int s = stride; s < strandSlot; s *= 2) {
+        bool hasLower = k >= s, hasUpper = k + s < strandSlot;
+        float a = hasLower ? -lower[i] / diagonal[i - s] : 0.0;
+        float c = hasUpper ? -upper[i] / diagonal[i + s] : 0.0;
+        float newDiagonal = diagonal[i] + (hasLower ? a * upper[i - s] : 0.0) + (hasUpper ? c * lower[i + s] : 0.0);
+        float newRhs = rhs[i] + (hasLower ? a * rhs[i - s] : 0.0) + (hasUpper ? c * rhs[i + s] : 0.0);
+        float newLower = hasLower ? a * lower[i - s] : 0.0;
+        float newUpper = hasUpper ? c * upper[i + s] : 0.0;
+        barrier();
+
+        diagonal[i] = newDiagonal;
+        rhs[i] = newRhs;
+        lower[i] = newLower;
+        upper[i] = newUpper;
+        barrier();
+    }
+
+    float solution = rhs[i] / diagonal[i];
+    barrier();
+    return solution;
+}
+
+// One XPBD iteration over every constraint between a mass and the one span further along the strand. Constraint k only shares a mass with
+// constraints k - span and k + span, so the system (J W J^T + compliance / dt^2) dLambda = -C - compliance / dt^2 lambda is tridiagonal,
+// with a stride of span
+void SolveConstraints(int span, float rest, float compliance, float stepDt, inout float lambda) {
+    int i = base + k, count = massesPerStrand - span;
+    bool active = k < count;
+    vec3 direction = vec3(0, 0, 0);
+    float error = 0.0, weights = 0.0;
+    if (active) {
+        vec4 first = strandPositions[i], second = strandPositions[i + span];
+        vec3 between = second.xyz - first.xyz;
+        float apart = length(between);
+        direction = apart > 0.0 ? between / apart : vec3(0, 0, -1);
+        error = apart - rest;
+        weights = first.w + second.w;
+    }
+    constraintDirections[i] = vec4(direction, 0.0);
+    barrier();
+
+    // Neither end can move if both are roots. Then its neighbours' rows don't reach it either, since it shares a root with them
+    float alpha = compliance / (stepDt * stepDt);
+    active = active && weights + alpha > 0.0;
+    diagonal[i] = active ? weights + alpha : 1.0;
+    lower[i] = active && k >= span ? -strandPositions[i].w * dot(direction, constraintDirections[i - span].xyz) : 0.0;
+    upper[i] = active && k + span < count ? -strandPositions[i + span].w * dot(direction, constraintDirections[i + span].xyz) : 0.0;
+    rhs[i] = active ? -error - alpha * lambda : 0.0;
+    barrier();
+
+    float deltaLambda = SolveTridiagonal(span);
+    lambda += deltaLambda;
+    rhs[i] = deltaLambda;
+    barrier();
+
+    vec4 position = strandPositions[i];
+    if (isMass && position.w > 0.0) {
+        vec3 correction = vec3(0, 0, 0);
+        if (k < count) correction -= constraintDirections[i].xyz * rhs[i];
+        if (k >= span) correction += constraintDirections[i - span].xyz * rhs[i - span];
+        strandPositions[i].xyz = position.xyz + position.w * correction;
+    }
+    barrier();
+}
+
+// Lines have no surface, so they're shaded like thin cylinders lit from above. The normal is the part of up that's across the strand
+vec3 StrandNormal() {
+    vec3 tangent = strandPositions[base + min(k + 1, massesPerStrand - 1)].xyz - strandPositions[base + max(k - 1, 0)].xyz;
+    if (length(tangent) == 0.0) return vec3(0, 0, 1);
+    tangent = normalize(tangent);
+    vec3 across = vec3(0, 0, 1) - tangent.z * tangent;
+    if (length(across) < 0.001) across = vec3(1, 0, 0) - tangent.x * tangent;
+    return normalize(across);
+}
+
+void main() {
+    int slot = int(gl_LocalInvocationIndex) / strandSlot;
+    int strand = int(gl_WorkGroupID.x) * (MaxStrandMasses / strandSlot) + slot;
+    k = int(gl_LocalInvocationIndex) % strandSlot;
+    base = slot * strandSlot;
+    isMass = k < massesPerStrand && strand < numStrands;
+    gid = uint(strand * massesPerStrand + k);
+
+    vec3 position = vec3(0, 0, 0), velocity = vec3(0, 0, 0);
+    float inverseMass = 0.0;
+    if (isMass) {
+        position = Positions[gid].xyz;
+        velocity = Velocities[gid].xyz;
+        inverseMass = MassParameters[gid].isFixed ? 0.0 : 1.0 / MassParameters[gid].mass;
+    }
+
+    // Every invocation has to reach every barrier, so ones past the end of the strands go through the motions with nothing to move
+    float stepDt = frameTime / float(obstacleSubsteps);
+    for (int step = 0; step < obstacleSubsteps; step++) {
+        vec3 start = position;
+        if (inverseMass > 0.0) {
+            vec3 air = WindAt(position, windTime + float(step) * stepDt) - velocity;
+            velocity += (gravity + airDragFactor * air) * stepDt;
+            position += velocity * stepDt;
+        }
+        strandPositions[base + k] = vec4(position, inverseMass);
+        barrier();
+
+        float stretchLambda = 0.0, bendLambda = 0.0;
+        for (int i = 0; i < iterations; i++) {
+            SolveConstraints(1, restLength, stretchCompliance, stepDt, stretchLambda);
+            SolveConstraints(2, 2.0 * restLength, bendCompliance, stepDt, bendLambda);
+        }
+
+        position = strandPositions[base + k].xyz;
+        if (inverseMass > 0.0) {
+            velocity = (position - start) / stepDt;
+            CollideWithSphere(start, position, velocity, step, stepDt);
+            CollideWithObstacles(position, velocity);
+        } else {
+            velocity = vec3(0, 0, 0);
+        }
+    }
+
+    strandPositions[base + k].xyz = position;
+    barrier();
+    if (!isMass) return;
+    Positions[gid].xyz = position;
+    Velocities[gid].xyz = velocity;
+    Normals[gid] = vec4(StrandNormal(), 0.0);
+}